@@ -0,0 +1,85 @@
+#include "audio_resampler.h"
+
+#include <pico/platform.h>
+
+void audio_resampler_init(audio_resampler_t *rs, uint32_t target_fill) {
+    rs->step = AUDIO_RESAMPLER_ONE;
+    rs->pos = 0;
+    rs->prev_left = 0;
+    rs->prev_right = 0;
+    rs->target_fill = target_fill;
+}
+
+/**
+ * Update the ratio from the ring fill, called once per emulated frame with a
+ * fill sampled at the same point of every frame (averaged by the caller).
+ * A fuller ring than wanted consumes input faster (fewer output frames),
+ * an emptier one slows down, proportionally outside the deadband and clamped
+ * to +-0.5%. The fill settles where the ratio matches the clock drift.
+ */
+void audio_resampler_adjust(audio_resampler_t *rs, uint32_t fill) {
+    int32_t deviation = (int32_t)fill - (int32_t)rs->target_fill;
+    if (deviation > AUDIO_RESAMPLER_DEADBAND) {
+        deviation -= AUDIO_RESAMPLER_DEADBAND;
+    } else if (deviation < -AUDIO_RESAMPLER_DEADBAND) {
+        deviation += AUDIO_RESAMPLER_DEADBAND;
+    } else {
+        deviation = 0;
+    }
+    int32_t adj = deviation * AUDIO_RESAMPLER_MAX_ADJ / (int32_t)rs->target_fill;
+
+    if (adj > AUDIO_RESAMPLER_MAX_ADJ) {
+        adj = AUDIO_RESAMPLER_MAX_ADJ;
+    } else if (adj < -AUDIO_RESAMPLER_MAX_ADJ) {
+        adj = -AUDIO_RESAMPLER_MAX_ADJ;
+    }
+    rs->step = AUDIO_RESAMPLER_ONE + adj;
+}
+
+/**
+ * Resample frames x 2 x 16 bits interleaved samples into the ring, applying
+ * the volume shift on the way. Output frames that do not fit are counted in
+ * *dropped. Returns the number of frames written.
+ */
+uint32_t __not_in_flash_func(audio_resampler_process)(audio_resampler_t *rs, const int16_t *samples, uint32_t frames,
+                                                      audio_ring_t *ring, uint8_t volume, uint32_t *dropped) {
+    const uint32_t mask = audio_ring_mask(ring);
+    uint32_t head;
+    /* at most frames / (1 - 0.5%) + 1 outputs, round the margin up */
+    uint32_t room = audio_ring_reserve(ring, frames + (frames >> 6) + 2, &head);
+    uint32_t out = 0;
+
+    uint32_t pos = rs->pos;
+    int32_t prev_left = rs->prev_left;
+    int32_t prev_right = rs->prev_right;
+
+    for (uint32_t i = 0; i < frames; i++) {
+        int32_t left = samples[2 * i];
+        int32_t right = samples[2 * i + 1];
+
+        while (pos < AUDIO_RESAMPLER_ONE) {
+            if (out < room) {
+                /* Q15 weight keeps the product inside 32 bits */
+                int32_t weight = pos >> 1;
+                int32_t l = prev_left + (((left - prev_left) * weight) >> 15);
+                int32_t r = prev_right + (((right - prev_right) * weight) >> 15);
+                ring->buf[(head + out) & mask] = audio_ring_pack(l >> volume, r >> volume);
+                out++;
+            } else {
+                (*dropped)++;
+            }
+            pos += rs->step;
+        }
+
+        pos -= AUDIO_RESAMPLER_ONE;
+        prev_left = left;
+        prev_right = right;
+    }
+
+    rs->pos = pos;
+    rs->prev_left = prev_left;
+    rs->prev_right = prev_right;
+
+    audio_ring_commit(ring, out);
+    return out;
+}
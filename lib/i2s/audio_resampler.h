@@ -0,0 +1,34 @@
+/**
+ * Fixed-point linear resampler feeding an audio_ring_t.
+ *
+ * The emulators produce samples at their nominal rate, the I2S clock consumes
+ * them at its own. Both drift slightly, so the resampler stretches or squeezes
+ * the stream by up to AUDIO_RESAMPLER_MAX_ADJ (Q16) depending on how far the
+ * ring fill is from target_fill. Latency stays constant without audible pitch
+ * change (0.5% is well below what the ear notices).
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include "audio_ring.h"
+
+#define AUDIO_RESAMPLER_ONE     (1u << 16)
+/* 0.5% of 1.0 in Q16 */
+#define AUDIO_RESAMPLER_MAX_ADJ 328
+/* ring frames around target_fill treated as on target: DMA block granularity, not drift */
+#define AUDIO_RESAMPLER_DEADBAND 64
+
+typedef struct audio_resampler_t
+{
+    uint32_t step;          /* Q16 input frames consumed per output frame */
+    uint32_t pos;           /* Q16 position between prev and the next input frame */
+    int16_t  prev_left;
+    int16_t  prev_right;
+    uint32_t target_fill;   /* ring frames to hold, i.e. the output latency */
+} audio_resampler_t;
+
+void audio_resampler_init(audio_resampler_t *rs, uint32_t target_fill);
+void audio_resampler_adjust(audio_resampler_t *rs, uint32_t fill);
+uint32_t audio_resampler_process(audio_resampler_t *rs, const int16_t *samples, uint32_t frames,
+                                 audio_ring_t *ring, uint8_t volume, uint32_t *dropped);
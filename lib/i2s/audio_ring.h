@@ -0,0 +1,98 @@
+/**
+ * Single-producer / single-consumer ring of 32 bits stereo frames
+ * (left sample in the low half, right sample in the high half).
+ *
+ * The producer only writes head, the consumer only writes tail. Both indices
+ * run freely and are masked on access, so the ring size must be a power of 2.
+ * Index updates use acquire/release atomics, no locks are taken, which makes
+ * the ring safe between the emulation loop and the DMA interrupt or core1.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef struct audio_ring_t
+{
+    uint32_t *buf;
+    uint32_t size;       /* frames, power of 2 */
+    uint32_t head;       /* written by the producer only */
+    uint32_t tail;       /* written by the consumer only */
+    uint32_t min_fill;   /* lowest fill seen by the consumer since reset */
+    uint32_t max_fill;   /* highest fill seen by the producer since reset */
+} audio_ring_t;
+
+static inline void audio_ring_init(audio_ring_t *ring, uint32_t *buf, uint32_t size) {
+    ring->buf = buf;
+    ring->size = size;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->min_fill = size;
+    ring->max_fill = 0;
+}
+
+static inline uint32_t audio_ring_mask(const audio_ring_t *ring) {
+    return ring->size - 1;
+}
+
+static inline uint32_t audio_ring_fill(const audio_ring_t *ring) {
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)
+        - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t audio_ring_free(const audio_ring_t *ring) {
+    return ring->size - audio_ring_fill(ring);
+}
+
+static inline uint32_t audio_ring_pack(int16_t left, int16_t right) {
+    return (uint16_t)left | ((uint32_t)(uint16_t)right << 16);
+}
+
+/**
+ * Producer side: returns how many of the wanted frames may be written,
+ * starting at ring->buf[(*head + i) & mask]. Publish them with
+ * audio_ring_commit().
+ */
+static inline uint32_t audio_ring_reserve(const audio_ring_t *ring, uint32_t wanted, uint32_t *head) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    *head = ring->head;
+    uint32_t space = ring->size - (*head - tail);
+    return wanted < space ? wanted : space;
+}
+
+static inline void audio_ring_commit(audio_ring_t *ring, uint32_t count) {
+    uint32_t head = ring->head + count;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+
+    uint32_t fill = head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (fill > ring->max_fill) {
+        ring->max_fill = fill;
+    }
+}
+
+/**
+ * Consumer side: returns how many of the wanted frames can be read,
+ * starting at ring->buf[(*tail + i) & mask]. Release them with
+ * audio_ring_consume().
+ */
+static inline uint32_t audio_ring_peek(audio_ring_t *ring, uint32_t wanted, uint32_t *tail) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    *tail = ring->tail;
+    uint32_t count = head - *tail;
+    if (count < ring->min_fill) {
+        ring->min_fill = count;
+    }
+    return wanted < count ? wanted : count;
+}
+
+static inline void audio_ring_consume(audio_ring_t *ring, uint32_t count) {
+    __atomic_store_n(&ring->tail, ring->tail + count, __ATOMIC_RELEASE);
+}
+
+/**
+ * Restart the min/max fill telemetry window
+ */
+static inline void audio_ring_reset_stats(audio_ring_t *ring) {
+    ring->min_fill = ring->size;
+    ring->max_fill = 0;
+}
@@ -0,0 +1,40 @@
+#include "audio_telemetry.h"
+
+#include <string.h>
+
+audio_telemetry_t audio_telemetry;
+
+/**
+ * Clear all histograms, collection keeps its enabled state
+ */
+void audio_telemetry_reset(void) {
+    bool enabled = audio_telemetry.enabled;
+    memset(&audio_telemetry, 0, sizeof(audio_telemetry));
+    audio_telemetry.enabled = enabled;
+}
+
+/**
+ * Called once per emulated frame by the emulation core, before pacing.
+ * Produced and consumed come from the ring indices, the DMA interrupt is
+ * not touched.
+ */
+void audio_telemetry_frame(const audio_ring_t *ring) {
+    if (!audio_telemetry.enabled) {
+        return;
+    }
+
+    uint32_t now = time_us_32();
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    if (audio_telemetry.last_frame_us) {
+        audio_histogram_add(&audio_telemetry.frame_us, now - audio_telemetry.last_frame_us);
+        audio_histogram_add(&audio_telemetry.produced, head - audio_telemetry.last_head);
+        audio_histogram_add(&audio_telemetry.consumed, tail - audio_telemetry.last_tail);
+    }
+    audio_histogram_add(&audio_telemetry.fill, head - tail);
+
+    audio_telemetry.last_head = head;
+    audio_telemetry.last_tail = tail;
+    audio_telemetry.last_frame_us = now;
+}
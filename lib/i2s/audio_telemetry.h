@@ -0,0 +1,72 @@
+/**
+ * Audio pipeline telemetry: ring fill, frames produced and consumed per
+ * emulated frame, frame period jitter and synthesis time.
+ *
+ * Everything is gated by audio_telemetry.enabled, so a build with
+ * ENABLE_AUDIO_TELEMETRY but collection switched off only pays one load and
+ * branch per probe. Each histogram is written by a single core.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <hardware/timer.h>
+#include "audio_ring.h"
+
+/* Bin 0 holds 0, bin i holds [2^(i-1), 2^i), the last bin everything above */
+#define AUDIO_HISTOGRAM_BINS 16
+
+typedef struct audio_histogram_t
+{
+    uint32_t bins[AUDIO_HISTOGRAM_BINS];
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+} audio_histogram_t;
+
+typedef struct audio_telemetry_t
+{
+    volatile bool enabled;
+    audio_histogram_t fill;      /* ring fill at each frame, frames */
+    audio_histogram_t produced;  /* frames pushed into the ring per emulated frame */
+    audio_histogram_t consumed;  /* frames played by DMA per emulated frame */
+    audio_histogram_t frame_us;  /* emulated frame period, i.e. producer jitter */
+    audio_histogram_t synth_us;  /* one synthesis call: audio_callback, core1 slice or pAPU batch */
+    audio_histogram_t hsync_us;  /* InfoNES_pAPUHsync on the emulation core */
+    uint32_t last_head;
+    uint32_t last_tail;
+    uint32_t last_frame_us;
+} audio_telemetry_t;
+
+extern audio_telemetry_t audio_telemetry;
+
+void audio_telemetry_reset(void);
+void audio_telemetry_frame(const audio_ring_t *ring);
+
+static inline void audio_histogram_add(audio_histogram_t *h, uint32_t value) {
+    uint32_t bin = value ? 32 - __builtin_clz(value) : 0;
+    if (bin >= AUDIO_HISTOGRAM_BINS) {
+        bin = AUDIO_HISTOGRAM_BINS - 1;
+    }
+    h->bins[bin]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+/**
+ * Timing probe: returns 0 when collection is off, audio_telemetry_stop()
+ * then records nothing.
+ */
+static inline uint32_t audio_telemetry_start(void) {
+    return audio_telemetry.enabled ? time_us_32() : 0;
+}
+
+static inline void audio_telemetry_stop(audio_histogram_t *h, uint32_t start) {
+    if (start && audio_telemetry.enabled) {
+        audio_histogram_add(h, time_us_32() - start);
+    }
+}
@@ -24,6 +24,9 @@
 
 #include "i2s-audio.h"
 
+/* Only one I2S output exists, the DMA IRQ handler needs to find its context */
+static i2s_config_t *i2s_irq_config = NULL;
+
 /**
  * return the default i2s context used to store information about the setup
  * RP2040 的每个 PIO 只能控制自己对应范围的 GPIO。
@@ -39,14 +42,67 @@ i2s_config_t i2s_get_default_config(void) {
 		.pio = pio1,
 		.sm = 1,
         .dma_channel = 0,
-        .dma_trans_count = 0,
-        .dma_buf = (uint16_t*) NULL,
+        .dma_channel_b = 0,
+        .dma_trans_count = 256,
+        .dma_buf = (uint32_t*) NULL,
+        .ring_size = 4096,
+        .ring = {},
+        .underrun_count = 0,
+        .overrun_count = 0,
         .volume = 0,
 	};
 
     return i2s_config;
 }
 
+/**
+ * Copy one DMA block worth of frames from the ring into dst.
+ * Missing frames are replaced by silence and counted as an underrun.
+ */
+static void __not_in_flash_func(i2s_fill_dma_block)(i2s_config_t *i2s_config, uint32_t *dst) {
+    audio_ring_t *ring = &i2s_config->ring;
+    const uint32_t mask = audio_ring_mask(ring);
+    uint32_t tail;
+    uint32_t count = audio_ring_peek(ring, i2s_config->dma_trans_count, &tail);
+
+    if (count < i2s_config->dma_trans_count) {
+        i2s_config->underrun_count++;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        dst[i] = ring->buf[(tail + i) & mask];
+    }
+    for (uint32_t i = count; i < i2s_config->dma_trans_count; i++) {
+        dst[i] = 0;
+    }
+
+    audio_ring_consume(ring, count);
+}
+
+/**
+ * DMA completion handler. The other channel of the pair is already running
+ * (chained), so the finished block is refilled and re-armed for its next turn.
+ */
+static void __isr __not_in_flash_func(i2s_dma_irq_handler)(void) {
+    i2s_config_t *i2s_config = i2s_irq_config;
+    if (i2s_config == NULL) {
+        return;
+    }
+
+    const uint8_t channels[2] = {i2s_config->dma_channel, i2s_config->dma_channel_b};
+    for (uint8_t half = 0; half < 2; half++) {
+        uint8_t channel = channels[half];
+        if (!dma_channel_get_irq1_status(channel)) {
+            continue;
+        }
+        dma_channel_acknowledge_irq1(channel);
+
+        uint32_t *block = i2s_config->dma_buf + half * i2s_config->dma_trans_count;
+        i2s_fill_dma_block(i2s_config, block);
+        dma_channel_set_read_addr(channel, block, false);
+    }
+}
+
 /**
  * Initialize the I2S driver. Must be called before calling i2s_write or i2s_dma_write
  * i2s_config: I2S context obtained by i2s_get_default_config()
@@ -65,36 +121,64 @@ void i2s_init(i2s_config_t *i2s_config) {
     audio_i2s_program_init(i2s_config->pio, i2s_config->sm , offset, i2s_config->data_pin , i2s_config->clock_pin_base);
     
     /* Set PIO clock */
-    uint32_t system_clock_frequency = clock_get_hz(clk_sys);
-    uint32_t divider = system_clock_frequency * 4 / i2s_config->sample_freq; // avoid arithmetic overflow
-    pio_sm_set_clkdiv_int_frac(i2s_config->pio, i2s_config->sm , divider >> 8u, divider & 0xffu);
+    i2s_set_sample_freq(i2s_config, i2s_config->sample_freq);
 
     pio_sm_set_enabled(i2s_config->pio, i2s_config->sm, false);
 
-    /* Allocate memory for the DMA buffer */
-    i2s_config->dma_buf = (uint16_t*) malloc(i2s_config->dma_trans_count*sizeof(uint32_t));
+    /* Allocate memory for the ping-pong DMA buffers and the sample ring */
+    i2s_config->dma_buf = (uint32_t*) calloc(2 * i2s_config->dma_trans_count, sizeof(uint32_t));
+    audio_ring_init(&i2s_config->ring,
+                    (uint32_t*) calloc(i2s_config->ring_size, sizeof(uint32_t)),
+                    i2s_config->ring_size);
+    i2s_config->underrun_count = 0;
+    i2s_config->overrun_count = 0;
 
-    /* Direct Memory Access setup */
+    /* Direct Memory Access setup: two channels chained to each other */
     i2s_config->dma_channel = dma_claim_unused_channel(true);
-    
-    dma_channel_config dma_config = dma_channel_get_default_config(i2s_config->dma_channel);
-    channel_config_set_read_increment(&dma_config, true);
-    channel_config_set_write_increment(&dma_config, false);
-    channel_config_set_dreq(&dma_config, pio_get_dreq(i2s_config->pio, i2s_config->sm, true));
-    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
-
-    channel_config_set_high_priority(&dma_config, true);
-    channel_config_set_sniff_enable(&dma_config, false); // 禁用嗅探
-
-    dma_channel_configure(i2s_config->dma_channel,
-                          &dma_config,
-                          &(i2s_config->pio->txf[i2s_config->sm]),    // Destination pointer
-                          i2s_config->dma_buf,                        // Source pointer
-                          i2s_config->dma_trans_count,                // Number of 32 bits words to transfer
-                          false                                       // Start immediately
-    );
+    i2s_config->dma_channel_b = dma_claim_unused_channel(true);
+
+    const uint8_t channels[2] = {i2s_config->dma_channel, i2s_config->dma_channel_b};
+    for (uint8_t half = 0; half < 2; half++) {
+        dma_channel_config dma_config = dma_channel_get_default_config(channels[half]);
+        channel_config_set_read_increment(&dma_config, true);
+        channel_config_set_write_increment(&dma_config, false);
+        channel_config_set_dreq(&dma_config, pio_get_dreq(i2s_config->pio, i2s_config->sm, true));
+        channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+        channel_config_set_chain_to(&dma_config, channels[half ^ 1]);
+
+        channel_config_set_high_priority(&dma_config, true);
+        channel_config_set_sniff_enable(&dma_config, false); // 禁用嗅探
+
+        dma_channel_configure(channels[half],
+                              &dma_config,
+                              &(i2s_config->pio->txf[i2s_config->sm]),                        // Destination pointer
+                              i2s_config->dma_buf + half * i2s_config->dma_trans_count,       // Source pointer
+                              i2s_config->dma_trans_count,                                    // Number of 32 bits words to transfer
+                              false                                                           // Start immediately
+        );
+        dma_channel_set_irq1_enabled(channels[half], true);
+    }
+
+    i2s_irq_config = i2s_config;
+    irq_add_shared_handler(I2S_DMA_IRQ, i2s_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_enabled(I2S_DMA_IRQ, true);
 
     pio_sm_set_enabled(i2s_config->pio, i2s_config->sm , true);
+
+    /* Both blocks hold silence, start the first one and let the chain run */
+    dma_channel_start(i2s_config->dma_channel);
+}
+
+/**
+ * Change the output rate by reprogramming the PIO clock divider, also while running
+ * i2s_config: I2S context obtained by i2s_get_default_config()
+ * sample_freq: frames per second
+ */
+void i2s_set_sample_freq(i2s_config_t *i2s_config, uint32_t sample_freq) {
+    i2s_config->sample_freq = sample_freq;
+    uint32_t system_clock_frequency = clock_get_hz(clk_sys);
+    uint32_t divider = system_clock_frequency * 4 / sample_freq; // avoid arithmetic overflow
+    pio_sm_set_clkdiv_int_frac(i2s_config->pio, i2s_config->sm , divider >> 8u, divider & 0xffu);
 }
 
 /**
@@ -112,26 +196,55 @@ void i2s_write(const i2s_config_t *i2s_config,const int16_t *samples,const size_
 }
 
 /**
- * Write samples to DMA buffer and initiate DMA transfer (non blocking)
+ * Queue samples for the DMA refill interrupt (non blocking)
+ * Volume scaling is applied here, so the interrupt only copies words.
+ * i2s_config: I2S context obtained by i2s_get_default_config()
+ *     sample: pointer to an array of frames x 2 x 16 bits samples
+ *     frames: number of stereo frames to queue
+ * returns the number of frames queued. Frames that do not fit are dropped
+ * and counted in overrun_count.
+ */
+size_t i2s_ring_write(i2s_config_t *i2s_config,const int16_t *samples,size_t frames) {
+    audio_ring_t *ring = &i2s_config->ring;
+    const uint32_t mask = audio_ring_mask(ring);
+    uint32_t head;
+    uint32_t count = audio_ring_reserve(ring, frames, &head);
+
+    if (count < frames) {
+        i2s_config->overrun_count++;
+    }
+
+    const uint8_t volume = i2s_config->volume;
+    for (uint32_t i = 0; i < count; i++) {
+        ring->buf[(head + i) & mask] =
+            audio_ring_pack(samples[2 * i] >> volume, samples[2 * i + 1] >> volume);
+    }
+
+    audio_ring_commit(ring, count);
+    return count;
+}
+
+/**
+ * Queue one DMA block worth of samples (non blocking)
  * i2s_config: I2S context obtained by i2s_get_default_config()
  *     sample: pointer to an array of dma_trans_count x 32 bits samples
  */
 void i2s_dma_write(i2s_config_t *i2s_config,const int16_t *samples) {
-    /* Wait the completion of the previous DMA transfer */
-    dma_channel_wait_for_finish_blocking(i2s_config->dma_channel);
-    /* Copy samples into the DMA buffer */
-    if(i2s_config->volume==0) {
-        memcpy(i2s_config->dma_buf,samples,i2s_config->dma_trans_count*sizeof(int32_t));
-    } else {
-        for(uint16_t i=0;i<i2s_config->dma_trans_count*2;i++) {
-            i2s_config->dma_buf[i] = samples[i]>>i2s_config->volume;
-        }
-    }
-    
-    /* Initiate the DMA transfer */
-    dma_channel_transfer_from_buffer_now(i2s_config->dma_channel,
-                                         i2s_config->dma_buf,
-                                         i2s_config->dma_trans_count);
+    i2s_ring_write(i2s_config, samples, i2s_config->dma_trans_count);
+}
+
+/**
+ * Number of frames queued and not yet handed to DMA
+ */
+uint32_t i2s_ring_fill(const i2s_config_t *i2s_config) {
+    return audio_ring_fill(&i2s_config->ring);
+}
+
+/**
+ * Number of frames that can be queued without overrun
+ */
+uint32_t i2s_ring_free(const i2s_config_t *i2s_config) {
+    return audio_ring_free(&i2s_config->ring);
 }
 
 #if 0
@@ -29,7 +29,12 @@
 #include <hardware/pio.h>
 #include <hardware/clocks.h>
 #include <hardware/dma.h>
+#include <hardware/irq.h>
 #include "audio_i2s.pio.h"
+#include "audio_ring.h"
+
+/* DMA completion interrupt used to refill the ping-pong buffers */
+#define I2S_DMA_IRQ DMA_IRQ_1
 
 typedef struct i2s_config_t
 {
@@ -39,17 +44,26 @@ typedef struct i2s_config_t
     uint8_t  clock_pin_base;
     PIO	     pio;
     uint8_t  sm; 
-    uint8_t  dma_channel;
-    uint16_t dma_trans_count;
-    uint16_t *dma_buf;
+    uint8_t  dma_channel;       /* first half of the ping-pong pair */
+    uint8_t  dma_channel_b;     /* second half, chained to dma_channel */
+    uint16_t dma_trans_count;   /* 32 bits stereo frames per DMA block */
+    uint32_t *dma_buf;          /* 2 x dma_trans_count frames */
+    uint32_t ring_size;         /* stereo frames in the ring, power of 2 */
+    audio_ring_t ring;          /* producers -> DMA IRQ */
+    uint32_t underrun_count;    /* DMA blocks that found the ring short */
+    uint32_t overrun_count;     /* writes that found the ring full */
     uint8_t volume;
 } i2s_config_t;
 
 
 i2s_config_t i2s_get_default_config(void);
 void i2s_init(i2s_config_t *i2s_config);
+void i2s_set_sample_freq(i2s_config_t *i2s_config, uint32_t sample_freq);
 void i2s_write(const i2s_config_t *i2s_config,const int16_t *samples,const size_t len);
 void i2s_dma_write(i2s_config_t *i2s_config,const int16_t *samples);
+size_t i2s_ring_write(i2s_config_t *i2s_config,const int16_t *samples,size_t frames);
+uint32_t i2s_ring_fill(const i2s_config_t *i2s_config);
+uint32_t i2s_ring_free(const i2s_config_t *i2s_config);
 void i2s_volume(i2s_config_t *i2s_config,uint8_t volume);
 void i2s_increase_volume(i2s_config_t *i2s_config);
 void i2s_decrease_volume(i2s_config_t *i2s_config);
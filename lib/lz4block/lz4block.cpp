@@ -0,0 +1,163 @@
+#include "lz4block.h"
+
+#include <string.h>
+#include <pico/platform.h>
+
+static inline uint32_t lz4block_read32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz4block_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - LZ4BLOCK_HASH_BITS);
+}
+
+/* 15 in the token nibble, the rest as a run of 255 bytes and a final byte */
+static uint8_t *lz4block_put_length(uint8_t *op, uint32_t length) {
+    length -= 15;
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+static uint8_t *lz4block_put_sequence(uint8_t *op, uint8_t *oend, const uint8_t *literals, uint32_t literal_length,
+                                      uint32_t offset, uint32_t match_length) {
+    /* token, length bytes, literals and the offset */
+    if (op + 1 + (literal_length + 240) / 255 + literal_length + 2 + match_length / 255 + 1 > oend) {
+        return NULL;
+    }
+
+    uint8_t *token = op++;
+    uint32_t match_code = match_length ? match_length - LZ4BLOCK_MIN_MATCH : 0;
+    *token = (uint8_t)(((literal_length < 15 ? literal_length : 15) << 4) | (match_code < 15 ? match_code : 15));
+
+    if (literal_length >= 15) {
+        op = lz4block_put_length(op, literal_length);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (match_length) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        if (match_code >= 15) {
+            op = lz4block_put_length(op, match_code);
+        }
+    }
+    return op;
+}
+
+uint32_t lz4block_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap, uint16_t *table) {
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+    uint32_t anchor = 0;
+
+    if (len > 0xFFFF) {
+        return 0;
+    }
+
+    if (len > LZ4BLOCK_MFLIMIT) {
+        const uint32_t limit = len - LZ4BLOCK_MFLIMIT;
+        const uint32_t match_limit = len - LZ4BLOCK_LAST_LITERALS;
+        uint32_t ip = 0;
+
+        memset(table, 0, LZ4BLOCK_HASH_SIZE * sizeof(uint16_t));
+        while (ip < limit) {
+            uint32_t sequence = lz4block_read32(src + ip);
+            uint32_t h = lz4block_hash(sequence);
+            uint32_t ref = table[h];
+            table[h] = (uint16_t)ip;
+
+            if (ref >= ip || lz4block_read32(src + ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            uint32_t match_length = LZ4BLOCK_MIN_MATCH;
+            while (ip + match_length < match_limit && src[ref + match_length] == src[ip + match_length]) {
+                match_length++;
+            }
+
+            op = lz4block_put_sequence(op, oend, src + anchor, ip - anchor, ip - ref, match_length);
+            if (op == NULL) {
+                return 0;
+            }
+            ip += match_length;
+            anchor = ip;
+        }
+    }
+
+    op = lz4block_put_sequence(op, oend, src + anchor, len - anchor, 0, 0);
+    if (op == NULL) {
+        return 0;
+    }
+    return (uint32_t)(op - dst);
+}
+
+int32_t __not_in_flash_func(lz4block_decompress)(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+
+    while (ip < iend) {
+        uint32_t token = *ip++;
+
+        uint32_t literal_length = token >> 4;
+        if (literal_length == 15) {
+            uint32_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                literal_length += b;
+            } while (b == 255);
+        }
+        if (literal_length > (uint32_t)(iend - ip) || literal_length > (uint32_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        /* the last sequence has no match */
+        if (ip >= iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        uint32_t offset = ip[0] | ((uint32_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) {
+            return -1;
+        }
+
+        uint32_t match_length = token & 15;
+        if (match_length == 15) {
+            uint32_t b;
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                match_length += b;
+            } while (b == 255);
+        }
+        match_length += LZ4BLOCK_MIN_MATCH;
+        if (match_length > (uint32_t)(oend - op)) {
+            return -1;
+        }
+
+        /* byte copy, the source may overlap the destination */
+        const uint8_t *match = op - offset;
+        while (match_length--) {
+            *op++ = *match++;
+        }
+    }
+    return (int32_t)(op - dst);
+}
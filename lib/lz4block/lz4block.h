@@ -0,0 +1,32 @@
+/**
+ * LZ4 block format encoder and decoder for ROM banks kept compressed in flash.
+ *
+ * Only the raw block format is handled (no frame header, no checksum), blocks
+ * are at most 64KiB so match offsets always fit. The encoder is a single pass
+ * greedy matcher with a 4096 entries hash table; it runs once while a ROM is
+ * loaded. The decoder runs on every bank switch and lives in RAM.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#define LZ4BLOCK_MIN_MATCH     4
+#define LZ4BLOCK_LAST_LITERALS 5   /* the last 5 bytes are always literals */
+#define LZ4BLOCK_MFLIMIT       12  /* no match starts in the last 12 bytes */
+#define LZ4BLOCK_HASH_BITS     12
+#define LZ4BLOCK_HASH_SIZE     (1u << LZ4BLOCK_HASH_BITS)
+/* worst case output for incompressible input */
+#define LZ4BLOCK_BOUND(len)    ((len) + (len) / 255 + 16)
+
+/**
+ * Compress len bytes (len <= 65535) into dst. table holds LZ4BLOCK_HASH_SIZE
+ * entries of scratch. Returns the compressed size, 0 if it exceeds cap.
+ */
+uint32_t lz4block_compress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap, uint16_t *table);
+
+/**
+ * Decompress a block into at most cap bytes.
+ * Returns the decompressed size, -1 for a malformed block.
+ */
+int32_t lz4block_decompress(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap);
@@ -12,7 +12,6 @@
 #include "minigb_apu.h"
 
 #define DMG_CLOCK_FREQ_U	((unsigned)DMG_CLOCK_FREQ)
-#define AUDIO_NSAMPLES		(AUDIO_SAMPLES * 2u)
 
 #define AUDIO_MEM_SIZE		(0xFF3F - 0xFF10 + 1)
 #define AUDIO_ADDR_COMPENSATION	0xFF10
@@ -24,18 +23,54 @@
 #define VOL_INIT_MIN		(INT16_MIN/8)
 
 /* Handles time keeping for sound generation.
- * FREQ_INC_REF must be equal to, or larger than AUDIO_SAMPLE_RATE in order
+ * FREQ_INC_REF must be equal to, or larger than the sample rate in order
  * to avoid a division by zero error.
  * Using a square of 2 simplifies calculations. */
-#define FREQ_INC_REF		(AUDIO_SAMPLE_RATE * 16)
+#define FREQ_INC_MUL		16
+#define FREQ_INC_REF(rate)	((rate) * FREQ_INC_MUL)
 
 #define MAX_CHAN_VOLUME		15
 
+#define FRAME_CYCLES		((uint32_t)SCREEN_REFRESH_CYCLES)
+
+/* Write log entry: cycle << 14 | register offset << 8 | value */
+#define LOG_CYCLE_SHIFT		14
+#define LOG_CYCLE_MAX		((1ul << (32 - LOG_CYCLE_SHIFT)) - 1)
+
 /**
- * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive.
+ * Memory holding audio registers between 0xFF10 and 0xFF3F inclusive, as
+ * seen by the sound generation.
  */
 static uint8_t audio_mem[AUDIO_MEM_SIZE];
 
+/**
+ * Same registers as seen by the CPU. Queued writes land here immediately.
+ */
+static uint8_t audio_regs[AUDIO_MEM_SIZE];
+
+/**
+ * Two write logs: the CPU appends to write_logs[log_in], rendering reads
+ * write_logs[log_render]. Both are the same log until audio_frame_close()
+ * hands a finished frame to a renderer on the other core.
+ */
+static uint32_t write_logs[2][AUDIO_WRITE_LOG_SIZE];
+static uint_fast16_t write_log_counts[2];
+static uint_fast16_t write_log_read;
+static uint8_t log_in;
+static uint8_t log_render;
+
+/* A closed frame log waits to be rendered. */
+static bool render_pending;
+
+/* Samples already rendered in the current frame. */
+static uint32_t sample_pos;
+
+/* Output rate, samples per frame and the Q16 factor converting a CPU cycle
+ * of the frame to its output sample. */
+static uint32_t sample_rate = AUDIO_SAMPLE_RATE;
+static uint32_t frame_samples = AUDIO_SAMPLES;
+static uint32_t samples_per_cycle_q16;
+
 struct chan_len_ctr {
 	uint8_t load;
 	unsigned enabled : 1;
@@ -75,6 +110,12 @@ static struct chan {
 
 	int_fast16_t val;
 
+#if ENABLE_AUDIO_BLIP
+	uint32_t blip_pos;	/* Q16 samples to the next step, from block start */
+	int32_t blip_l;		/* last level recorded in the delta buffers */
+	int32_t blip_r;
+#endif
+
 	struct chan_len_ctr    len;
 	struct chan_vol_env    env;
 	struct chan_freq_sweep sweep;
@@ -100,7 +141,7 @@ static int32_t vol_l, vol_r;
 static void set_note_freq(struct chan *c, const uint32_t freq)
 {
 	/* Lowest expected value of freq is 64. */
-	c->freq_inc = freq * (uint32_t)(FREQ_INC_REF / AUDIO_SAMPLE_RATE);
+	c->freq_inc = freq * FREQ_INC_MUL;
 }
 
 static void chan_enable(const uint_fast8_t i, const bool enable)
@@ -116,11 +157,12 @@ static void chan_enable(const uint_fast8_t i, const bool enable)
 	//audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] |= 0x80 | ((uint8_t)enable) << i;
 }
 
-static void update_env(struct chan *c)
+template <uint32_t RATE>
+static void update_env(struct chan *c, const uint32_t count)
 {
-	c->env.counter += c->env.inc;
+	c->env.counter += c->env.inc * count;
 
-	while (c->env.counter > FREQ_INC_REF) {
+	while (c->env.counter > FREQ_INC_REF(RATE)) {
 		if (c->env.step) {
 			c->volume += c->env.up ? 1 : -1;
 			if (c->volume == 0 || c->volume == MAX_CHAN_VOLUME) {
@@ -128,29 +170,32 @@ static void update_env(struct chan *c)
 			}
 			c->volume = MAX(0, MIN(MAX_CHAN_VOLUME, c->volume));
 		}
-		c->env.counter -= FREQ_INC_REF;
+		c->env.counter -= FREQ_INC_REF(RATE);
 	}
 }
 
-static void update_len(struct chan *c)
+template <uint32_t RATE>
+static void update_len(struct chan *c, const uint32_t count)
 {
 	if (!c->len.enabled)
 		return;
 
-	c->len.counter += c->len.inc;
-	if (c->len.counter > FREQ_INC_REF) {
+	c->len.counter += c->len.inc * count;
+	if (c->len.counter > FREQ_INC_REF(RATE)) {
 		chan_enable(c - chans, 0);
 		c->len.counter = 0;
 	}
 }
 
+#if !ENABLE_AUDIO_BLIP
+template <uint32_t RATE>
 static bool update_freq(struct chan *c, uint32_t *pos)
 {
 	uint32_t inc = c->freq_inc - *pos;
 	c->freq_counter += inc;
 
-	if (c->freq_counter > FREQ_INC_REF) {
-		*pos		= c->freq_inc - (c->freq_counter - FREQ_INC_REF);
+	if (c->freq_counter > FREQ_INC_REF(RATE)) {
+		*pos		= c->freq_inc - (c->freq_counter - FREQ_INC_REF(RATE));
 		c->freq_counter = 0;
 		return true;
 	} else {
@@ -159,11 +204,25 @@ static bool update_freq(struct chan *c, uint32_t *pos)
 	}
 }
 
-static void update_sweep(struct chan *c)
+/**
+ * Whole periods between two positions returned by update_freq() within one
+ * output sample. Both lie in [0, freq_inc], so the quotient of the
+ * difference by freq_inc is 0 or 1 and a compare gives it without the
+ * per-step division.
+ */
+static inline uint32_t whole_periods(const struct chan *c, const uint32_t pos,
+		const uint32_t prev_pos)
+{
+	return (pos - prev_pos) >= c->freq_inc;
+}
+#endif
+
+template <uint32_t RATE>
+static void update_sweep(struct chan *c, const uint32_t count)
 {
-	c->sweep.counter += c->sweep.inc;
+	c->sweep.counter += c->sweep.inc * count;
 
-	while (c->sweep.counter > FREQ_INC_REF) {
+	while (c->sweep.counter > FREQ_INC_REF(RATE)) {
 		if (c->sweep.shift) {
 			uint16_t inc = (c->sweep.freq >> c->sweep.shift);
 			if (!c->sweep.up)
@@ -180,11 +239,13 @@ static void update_sweep(struct chan *c)
 		} else if (c->sweep.rate) {
 			c->enabled = 0;
 		}
-		c->sweep.counter -= FREQ_INC_REF;
+		c->sweep.counter -= FREQ_INC_REF(RATE);
 	}
 }
 
-static void update_square(int16_t* samples, const bool ch2)
+#if !ENABLE_AUDIO_BLIP
+template <uint32_t RATE>
+static void update_square(int16_t* samples, const uint32_t count, const bool ch2)
 {
 	uint32_t freq;
 	struct chan* c = chans + ch2;
@@ -196,23 +257,23 @@ static void update_square(int16_t* samples, const bool ch2)
 	set_note_freq(c, freq);
 	c->freq_inc *= 8;
 
-	for (uint_fast16_t i = 0; i < AUDIO_NSAMPLES; i += 2) {
-		update_len(c);
+	for (uint_fast16_t i = 0; i < count * 2; i += 2) {
+		update_len<RATE>(c, 1);
 
 		if (!c->enabled)
 			continue;
 
-		update_env(c);
+		update_env<RATE>(c, 1);
 		if (!ch2)
-			update_sweep(c);
+			update_sweep<RATE>(c, 1);
 
 		uint32_t pos = 0;
 		uint32_t prev_pos = 0;
 		int32_t sample = 0;
 
-		while (update_freq(c, &pos)) {
+		while (update_freq<RATE>(c, &pos)) {
 			c->square.duty_counter = (c->square.duty_counter + 1) & 7;
-			sample += ((pos - prev_pos) / c->freq_inc) * c->val;
+			sample += whole_periods(c, pos, prev_pos) * c->val;
 			c->val = (c->square.duty & (1 << c->square.duty_counter)) ?
 				VOL_INIT_MAX / MAX_CHAN_VOLUME :
 				VOL_INIT_MIN / MAX_CHAN_VOLUME;
@@ -230,6 +291,7 @@ static void update_square(int16_t* samples, const bool ch2)
 		samples[i + 1] += sample * c->on_right * vol_r;
 	}
 }
+#endif
 
 static uint8_t wave_sample(const unsigned int pos, const unsigned int volume)
 {
@@ -244,7 +306,9 @@ static uint8_t wave_sample(const unsigned int pos, const unsigned int volume)
 	return volume ? (sample >> (volume - 1)) : 0;
 }
 
-static void update_wave(int16_t *samples)
+#if !ENABLE_AUDIO_BLIP
+template <uint32_t RATE>
+static void update_wave(int16_t *samples, const uint32_t count)
 {
 	uint32_t freq;
 	struct chan *c = chans + 2;
@@ -257,8 +321,8 @@ static void update_wave(int16_t *samples)
 
 	c->freq_inc *= 32;
 
-	for (uint_fast16_t i = 0; i < AUDIO_NSAMPLES; i += 2) {
-		update_len(c);
+	for (uint_fast16_t i = 0; i < count * 2; i += 2) {
+		update_len<RATE>(c, 1);
 
 		if (!c->enabled)
 			continue;
@@ -269,9 +333,9 @@ static void update_wave(int16_t *samples)
 
 		c->wave.sample = wave_sample(c->val, c->volume);
 
-		while (update_freq(c, &pos)) {
+		while (update_freq<RATE>(c, &pos)) {
 			c->val = (c->val + 1) & 31;
-			sample += ((pos - prev_pos) / c->freq_inc) *
+			sample += whole_periods(c, pos, prev_pos) *
 				((int)c->wave.sample - 8) * (INT16_MAX/64);
 			c->wave.sample = wave_sample(c->val, c->volume);
 			prev_pos  = pos;
@@ -298,7 +362,8 @@ static void update_wave(int16_t *samples)
 	}
 }
 
-static void update_noise(int16_t *samples)
+template <uint32_t RATE>
+static void update_noise(int16_t *samples, const uint32_t count)
 {
 	struct chan *c = chans + 3;
 
@@ -318,19 +383,19 @@ static void update_noise(int16_t *samples)
 	if (c->freq >= 14)
 		c->enabled = 0;
 
-	for (uint_fast16_t i = 0; i < AUDIO_NSAMPLES; i += 2) {
-		update_len(c);
+	for (uint_fast16_t i = 0; i < count * 2; i += 2) {
+		update_len<RATE>(c, 1);
 
 		if (!c->enabled)
 			continue;
 
-		update_env(c);
+		update_env<RATE>(c, 1);
 
 		uint32_t pos      = 0;
 		uint32_t prev_pos = 0;
 		int32_t sample    = 0;
 
-		while (update_freq(c, &pos)) {
+		while (update_freq<RATE>(c, &pos)) {
 			c->noise.lfsr_reg = (c->noise.lfsr_reg << 1) |
 				(c->val >= VOL_INIT_MAX/MAX_CHAN_VOLUME);
 
@@ -346,7 +411,7 @@ static void update_noise(int16_t *samples)
 					VOL_INIT_MIN / MAX_CHAN_VOLUME;
 			}
 
-			sample += ((pos - prev_pos) / c->freq_inc) * c->val;
+			sample += whole_periods(c, pos, prev_pos) * c->val;
 			prev_pos = pos;
 		}
 
@@ -361,9 +426,448 @@ static void update_noise(int16_t *samples)
 		samples[i + 1] += sample * c->on_right * vol_r;
 	}
 }
+#endif
+
+#if ENABLE_AUDIO_BLIP
+/**
+ * Band-limited synthesis.
+ * Each channel records the steps of its output level at their fractional
+ * sample time into delta buffers, shaped by a band-limited step kernel.
+ * The buffers are integrated once per block of BLIP_BLOCK samples, which is
+ * also the step of the length, envelope and sweep counters.
+ */
+#define BLIP_BLOCK		32
+#define BLIP_PHASES		16
+#define BLIP_TAPS		8
+/* Taps of every kernel phase sum to exactly 1 << BLIP_UNIT_SHIFT. */
+#define BLIP_UNIT_SHIFT		12
+/* Steps closer than this (Q16 samples) are far above Nyquist, only the
+ * average level of the waveform is output. */
+#define BLIP_MIN_PERIOD		(1ul << 14)
+
+/* Blackman windowed sinc step derivative, cut-off 0.45 fs, one row per
+ * 1/16 sample phase. Step delay is 3 samples. */
+static const int16_t blip_kernel[BLIP_PHASES][BLIP_TAPS] = {
+	{    23,  -130,   312,  3686,   312,  -130,    23,     0 },
+	{    17,   -87,   126,  3663,   523,  -177,    31,     0 },
+	{    11,   -49,   -33,  3597,   758,  -226,    38,     0 },
+	{     7,   -16,  -163,  3485,  1013,  -275,    46,    -1 },
+	{     3,    11,  -266,  3333,  1284,  -321,    53,    -1 },
+	{     1,    32,  -342,  3146,  1565,  -363,    59,    -2 },
+	{    -1,    48,  -393,  2926,  1852,  -397,    63,    -2 },
+	{    -2,    58,  -422,  2681,  2138,  -420,    65,    -2 },
+	{    -2,    63,  -430,  2417,  2417,  -430,    63,    -2 },
+	{    -2,    65,  -420,  2138,  2681,  -422,    58,    -2 },
+	{    -2,    63,  -397,  1852,  2926,  -393,    48,    -1 },
+	{    -2,    59,  -363,  1565,  3146,  -342,    32,     1 },
+	{    -1,    53,  -321,  1284,  3333,  -266,    11,     3 },
+	{    -1,    46,  -275,  1013,  3485,  -163,   -16,     7 },
+	{     0,    38,  -226,   758,  3597,   -33,   -49,    11 },
+	{     0,    31,  -177,   523,  3663,   126,   -87,    17 },
+};
+
+static int32_t blip_buf_l[BLIP_BLOCK + BLIP_TAPS];
+static int32_t blip_buf_r[BLIP_BLOCK + BLIP_TAPS];
+static int32_t blip_acc_l, blip_acc_r;
+
+static void blip_add(int32_t *buf, const uint32_t time, const int32_t delta)
+{
+	const int16_t *kernel = blip_kernel[(time >> 12) & (BLIP_PHASES - 1)];
+
+	buf += time >> 16;
+	for (uint_fast8_t i = 0; i < BLIP_TAPS; i++)
+		buf[i] += delta * kernel[i];
+}
+
+/**
+ * Move the output of channel c to "level" at Q16 sample "time" of the block.
+ */
+static void blip_level(struct chan *c, const uint32_t time, const int32_t level)
+{
+	const int32_t l = level * c->on_left * vol_l;
+	const int32_t r = level * c->on_right * vol_r;
+
+	if (l != c->blip_l) {
+		blip_add(blip_buf_l, time, l - c->blip_l);
+		c->blip_l = l;
+	}
+	if (r != c->blip_r) {
+		blip_add(blip_buf_r, time, r - c->blip_r);
+		c->blip_r = r;
+	}
+}
+
+/**
+ * Number of steps of length "period" until "end", from *pos. *pos is left
+ * at the first step at or after "end".
+ */
+static uint32_t blip_skip(uint32_t *pos, const uint32_t period, const uint32_t end)
+{
+	if (*pos >= end)
+		return 0;
+
+	uint32_t steps = (end - *pos + period - 1) / period;
+	*pos += steps * period;
+	return steps;
+}
+
+template <uint32_t RATE>
+static void blip_square(const uint32_t count, const bool ch2)
+{
+	struct chan *c = chans + ch2;
+	const uint32_t end = count << 16;
+
+	if (!c->powered || !c->enabled) {
+		blip_level(c, 0, 0);
+		return;
+	}
+
+	update_len<RATE>(c, count);
+	if (c->enabled) {
+		update_env<RATE>(c, count);
+		if (!ch2)
+			update_sweep<RATE>(c, count);
+	}
+	if (!c->enabled) {
+		blip_level(c, 0, 0);
+		return;
+	}
+
+	const int32_t hi = VOL_INIT_MAX / MAX_CHAN_VOLUME;
+	const int32_t lo = VOL_INIT_MIN / MAX_CHAN_VOLUME;
+	const uint32_t period = (RATE * (2048ul - c->freq)) >> 4;
+
+	if (period < BLIP_MIN_PERIOD) {
+		uint32_t ones = __builtin_popcount(c->square.duty);
+		uint32_t steps = blip_skip(&c->blip_pos, period, end);
+
+		c->square.duty_counter = (c->square.duty_counter + steps) & 7;
+		c->val = (c->square.duty & (1 << c->square.duty_counter)) ? hi : lo;
+		blip_level(c, 0, c->muted ? 0 :
+			((hi * (int32_t)ones + lo * (8 - (int32_t)ones)) / 8) * c->volume / 4);
+	} else {
+		/* Volume and panning changes take effect at block start. */
+		blip_level(c, 0, c->muted ? 0 : c->val * c->volume / 4);
+
+		while (c->blip_pos < end) {
+			c->square.duty_counter = (c->square.duty_counter + 1) & 7;
+			c->val = (c->square.duty & (1 << c->square.duty_counter)) ? hi : lo;
+			if (!c->muted)
+				blip_level(c, c->blip_pos, c->val * c->volume / 4);
+			c->blip_pos += period;
+		}
+	}
+
+	c->blip_pos -= end;
+}
+
+static int32_t blip_wave_level(const struct chan *c, const int32_t sample)
+{
+	/* First element is unused. */
+	static const int16_t div[] = { INT16_MAX, 1, 2, 4 };
+
+	if (c->volume == 0 || c->muted)
+		return 0;
+
+	return ((sample - 8) * (int32_t)(INT16_MAX/64) / div[c->volume]) / 4;
+}
+
+template <uint32_t RATE>
+static void blip_wave(const uint32_t count)
+{
+	struct chan *c = chans + 2;
+	const uint32_t end = count << 16;
+
+	if (!c->powered || !c->enabled) {
+		blip_level(c, 0, 0);
+		return;
+	}
+
+	update_len<RATE>(c, count);
+	if (!c->enabled) {
+		blip_level(c, 0, 0);
+		return;
+	}
+
+	const uint32_t period = (RATE * (2048ul - c->freq)) >> 5;
+
+	if (period < BLIP_MIN_PERIOD) {
+		int32_t sum = 0;
+		for (uint_fast8_t i = 0; i < 32; i++)
+			sum += wave_sample(i, c->volume);
+
+		c->val = (c->val + blip_skip(&c->blip_pos, period, end)) & 31;
+		c->wave.sample = wave_sample(c->val, c->volume);
+		blip_level(c, 0, blip_wave_level(c, sum / 32));
+	} else {
+		/* Wave RAM and volume changes take effect at block start. */
+		c->wave.sample = wave_sample(c->val, c->volume);
+		blip_level(c, 0, blip_wave_level(c, c->wave.sample));
+
+		while (c->blip_pos < end) {
+			c->val = (c->val + 1) & 31;
+			c->wave.sample = wave_sample(c->val, c->volume);
+			blip_level(c, c->blip_pos, blip_wave_level(c, c->wave.sample));
+			c->blip_pos += period;
+		}
+	}
+
+	c->blip_pos -= end;
+}
+
+static void blip_noise_step(struct chan *c, const uint8_t tap)
+{
+	c->noise.lfsr_reg = (c->noise.lfsr_reg << 1) |
+		(c->val >= VOL_INIT_MAX/MAX_CHAN_VOLUME);
+	c->val = !(((c->noise.lfsr_reg >> (tap + 1)) & 1) ^
+			((c->noise.lfsr_reg >> tap) & 1)) ?
+		VOL_INIT_MAX / MAX_CHAN_VOLUME :
+		VOL_INIT_MIN / MAX_CHAN_VOLUME;
+}
+
+template <uint32_t RATE>
+static void blip_noise(const uint32_t count)
+{
+	static const uint32_t lfsr_div_lut[] = {
+		8, 16, 32, 48, 64, 80, 96, 112
+	};
+	struct chan *c = chans + 3;
+	const uint32_t end = count << 16;
+
+	if (!c->powered) {
+		blip_level(c, 0, 0);
+		return;
+	}
+
+	if (c->freq >= 14)
+		c->enabled = 0;
+
+	if (c->enabled)
+		update_len<RATE>(c, count);
+	if (!c->enabled) {
+		blip_level(c, 0, 0);
+		return;
+	}
+
+	update_env<RATE>(c, count);
+
+	/* Period of one LFSR clock, DMG_CLOCK_FREQ / (div << shift), in Q16 samples. */
+	const uint32_t rate_div = RATE * lfsr_div_lut[c->noise.lfsr_div];
+	const uint32_t period = c->freq >= 6 ?
+		rate_div << (c->freq - 6) : rate_div >> (6 - c->freq);
+	const uint8_t tap = c->noise.lfsr_wide ? 13 : 5;
+
+	if (period < BLIP_MIN_PERIOD) {
+		/* Several LFSR steps per sample: each sample moves to the mean
+		 * level of its steps. A single mean for the block would silence
+		 * the hiss, the noise is not periodic like the other channels. */
+		for (uint32_t t = 0; t < end; t += 1ul << 16) {
+			int32_t sum = 0;
+			int32_t steps = 0;
+
+			for (; c->blip_pos < t + (1ul << 16); c->blip_pos += period) {
+				blip_noise_step(c, tap);
+				sum += c->val;
+				steps++;
+			}
+			if (steps == 0)
+				continue;
+			blip_level(c, t, c->muted ? 0 : (sum / steps) * c->volume / 4);
+		}
+	} else {
+		/* Volume and panning changes take effect at block start. */
+		blip_level(c, 0, c->muted ? 0 : c->val * c->volume / 4);
+
+		while (c->blip_pos < end) {
+			blip_noise_step(c, tap);
+			if (!c->muted)
+				blip_level(c, c->blip_pos, c->val * c->volume / 4);
+			c->blip_pos += period;
+		}
+	}
+
+	c->blip_pos -= end;
+}
+
+static int16_t blip_clamp(const int32_t v)
+{
+	return v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v);
+}
+
+template <uint32_t RATE>
+static void render_blip(int16_t *stream, const uint32_t count)
+{
+	for (uint32_t done = 0; done < count; ) {
+		const uint32_t n = MIN(count - done, (uint32_t)BLIP_BLOCK);
+
+		blip_square<RATE>(n, 0);
+		blip_square<RATE>(n, 1);
+		blip_wave<RATE>(n);
+		blip_noise<RATE>(n);
+
+		for (uint32_t i = 0; i < n; i++) {
+			blip_acc_l += blip_buf_l[i];
+			blip_acc_r += blip_buf_r[i];
+			*stream++ = blip_clamp(blip_acc_l >> BLIP_UNIT_SHIFT);
+			*stream++ = blip_clamp(blip_acc_r >> BLIP_UNIT_SHIFT);
+		}
+
+		/* Keep the kernel tails that spill into the next block. */
+		memmove(blip_buf_l, blip_buf_l + n, BLIP_TAPS * sizeof(int32_t));
+		memmove(blip_buf_r, blip_buf_r + n, BLIP_TAPS * sizeof(int32_t));
+		memset(blip_buf_l + BLIP_TAPS, 0, BLIP_BLOCK * sizeof(int32_t));
+		memset(blip_buf_r + BLIP_TAPS, 0, BLIP_BLOCK * sizeof(int32_t));
+
+		done += n;
+	}
+}
+#endif
+
+/**
+ * Generate "count" stereo samples with the current register state.
+ * The channel loops are instantiated per output rate, so every rate
+ * dependent factor is a constant.
+ */
+template <uint32_t RATE>
+static void render_span_rate(int16_t *stream, const uint32_t count)
+{
+#if ENABLE_AUDIO_BLIP
+	render_blip<RATE>(stream, count);
+#else
+	memset(stream, 0, count * 2 * sizeof(int16_t));
+
+	update_square<RATE>(stream, count, 0);
+	update_square<RATE>(stream, count, 1);
+	update_wave<RATE>(stream, count);
+	update_noise<RATE>(stream, count);
+#endif
+}
+
+static void render_span(int16_t *stream, const uint32_t count)
+{
+	switch (sample_rate) {
+	case 22050:
+		render_span_rate<22050>(stream, count);
+		break;
+	case 32000:
+		render_span_rate<32000>(stream, count);
+		break;
+	default:
+		render_span_rate<44100>(stream, count);
+		break;
+	}
+}
+
+static uint32_t cycle_to_sample(const uint32_t cycle)
+{
+	uint32_t sample = (cycle * samples_per_cycle_q16) >> 16;
+	return sample < frame_samples ? sample : frame_samples;
+}
+
+static void apply_write(const uint16_t addr, const uint8_t val);
+
+static void apply_logged_write(const uint32_t entry)
+{
+	apply_write(AUDIO_ADDR_COMPENSATION + ((entry >> 8) & 0x3F),
+		    entry & 0xFF);
+}
+
+uint32_t audio_render(int16_t *stream, const uint32_t cycle)
+{
+	const uint32_t target = cycle_to_sample(cycle);
+	uint32_t out = 0;
+
+	while (sample_pos < target) {
+		uint32_t end = target;
+
+		/* Apply writes that are due, stop the span at the next one. */
+		while (write_log_read < write_log_counts[log_render]) {
+			uint32_t entry = write_logs[log_render][write_log_read];
+			uint32_t at = cycle_to_sample(entry >> LOG_CYCLE_SHIFT);
+
+			if (at > sample_pos) {
+				end = MIN(end, at);
+				break;
+			}
+
+			apply_logged_write(entry);
+			write_log_read++;
+		}
+
+		render_span(stream + out * 2, end - sample_pos);
+		out += end - sample_pos;
+		sample_pos = end;
+	}
+
+	return out;
+}
+
+uint32_t audio_render_frame(int16_t *stream)
+{
+	uint32_t out = audio_render(stream, FRAME_CYCLES);
+
+	while (write_log_read < write_log_counts[log_render])
+		apply_logged_write(write_logs[log_render][write_log_read++]);
+
+	write_log_read = 0;
+	write_log_counts[log_render] = 0;
+	sample_pos = 0;
+	__atomic_store_n(&render_pending, false, __ATOMIC_RELEASE);
+	return out;
+}
+
+void audio_frame_close(void)
+{
+	/* At most one closed frame in flight, this bounds the latency. */
+	while (__atomic_load_n(&render_pending, __ATOMIC_ACQUIRE))
+		;
+
+	log_render = log_in;
+	log_in ^= 1;
+	write_log_counts[log_in] = 0;
+	write_log_read = 0;
+	__atomic_store_n(&render_pending, true, __ATOMIC_RELEASE);
+}
+
+bool audio_frame_pending(void)
+{
+	return __atomic_load_n(&render_pending, __ATOMIC_ACQUIRE);
+}
+
+void audio_set_sample_rate(const uint32_t rate)
+{
+	/* Not while a closed frame is rendered at the old rate. */
+	while (__atomic_load_n(&render_pending, __ATOMIC_ACQUIRE))
+		;
+
+	switch (rate) {
+	case 22050:
+	case 32000:
+		sample_rate = rate;
+		break;
+	default:
+		sample_rate = AUDIO_SAMPLE_RATE;
+		break;
+	}
+	frame_samples = (uint32_t)(sample_rate / VERTICAL_SYNC);
+	samples_per_cycle_q16 = (uint32_t)((frame_samples * 65536.0) /
+		SCREEN_REFRESH_CYCLES + 0.5);
+	sample_pos = MIN(sample_pos, frame_samples);
+}
+
+uint32_t audio_get_sample_rate(void)
+{
+	return sample_rate;
+}
+
+uint32_t audio_frame_samples(void)
+{
+	return frame_samples;
+}
 
 /**
  * SDL2 style audio callback function.
+ * Renders whatever has not been rendered of the current frame.
  */
 void audio_callback(void *userdata, int16_t *stream, size_t len)
 {
@@ -371,11 +875,7 @@ void audio_callback(void *userdata, int16_t *stream, size_t len)
 	(void)userdata;
 
 	memset(stream, 0, len);
-
-	update_square(stream, 0);
-	update_square(stream, 1);
-	update_wave(stream);
-	update_noise(stream);
+	audio_render_frame(stream);
 }
 
 static void chan_trigger(uint_fast8_t i)
@@ -393,8 +893,8 @@ static void chan_trigger(uint_fast8_t i)
 		c->env.step = val & 0x07;
 		c->env.up   = val & 0x08 ? 1 : 0;
 		c->env.inc  = c->env.step ?
-			(FREQ_INC_REF * 64ul) / ((uint32_t)c->env.step * AUDIO_SAMPLE_RATE) :
-			(8ul * FREQ_INC_REF) / AUDIO_SAMPLE_RATE ;
+			(FREQ_INC_REF(sample_rate) * 64ul) / ((uint32_t)c->env.step * sample_rate) :
+			(8ul * FREQ_INC_REF(sample_rate)) / sample_rate ;
 		c->env.counter = 0;
 	}
 
@@ -407,8 +907,8 @@ static void chan_trigger(uint_fast8_t i)
 		c->sweep.up    = !(val & 0x08);
 		c->sweep.shift = (val & 0x07);
 		c->sweep.inc   = c->sweep.rate ?
-			((128 * FREQ_INC_REF) / (c->sweep.rate * AUDIO_SAMPLE_RATE)) : 0;
-		c->sweep.counter = FREQ_INC_REF;
+			((128 * FREQ_INC_REF(sample_rate)) / (c->sweep.rate * sample_rate)) : 0;
+		c->sweep.counter = FREQ_INC_REF(sample_rate);
 	}
 
 	int len_max = 64;
@@ -421,7 +921,7 @@ static void chan_trigger(uint_fast8_t i)
 		c->val = VOL_INIT_MIN / MAX_CHAN_VOLUME;
 	}
 
-	c->len.inc = (256 * FREQ_INC_REF) / (AUDIO_SAMPLE_RATE * (len_max - c->len.load));
+	c->len.inc = (256 * FREQ_INC_REF(sample_rate)) / (sample_rate * (len_max - c->len.load));
 	c->len.counter = 0;
 }
 
@@ -444,8 +944,33 @@ uint8_t audio_read(const uint16_t addr)
 		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 	};
 
-	return audio_mem[addr - AUDIO_ADDR_COMPENSATION] |
-		ortab[addr - AUDIO_ADDR_COMPENSATION];
+	uint8_t val = audio_regs[addr - AUDIO_ADDR_COMPENSATION];
+
+	/* Channel status bits come from the sound generation. */
+	if (addr == 0xFF26)
+		val = (val & 0x80) | (audio_mem[0xFF26 - AUDIO_ADDR_COMPENSATION] & 0x0F);
+
+	return val | ortab[addr - AUDIO_ADDR_COMPENSATION];
+}
+
+/**
+ * Update the CPU visible copy of the registers.
+ * \return	false if the write is ignored because the APU is powered off.
+ */
+static bool regs_write(const uint16_t addr, const uint8_t val)
+{
+	if (addr == 0xFF26) {
+		audio_regs[addr - AUDIO_ADDR_COMPENSATION] = val & 0x80;
+		if ((val & 0x80) == 0)
+			memset(audio_regs, 0x00, 0xFF26 - AUDIO_ADDR_COMPENSATION);
+		return true;
+	}
+
+	if (audio_regs[0xFF26 - AUDIO_ADDR_COMPENSATION] == 0x00)
+		return false;
+
+	audio_regs[addr - AUDIO_ADDR_COMPENSATION] = val;
+	return true;
 }
 
 /**
@@ -455,6 +980,50 @@ uint8_t audio_read(const uint16_t addr)
  * \param val	Byte to write at address.
  */
 void audio_write(const uint16_t addr, const uint8_t val)
+{
+	if (regs_write(addr, val))
+		apply_write(addr, val);
+}
+
+/**
+ * Queue an audio register write.
+ * \param addr	Address of audio register. Must be 0xFF10 <= addr <= 0xFF3F.
+ *				This is not checked in this function.
+ * \param val	Byte to write at address.
+ * \param cycle	CPU cycle of the write within the current frame.
+ */
+void audio_write_at(const uint16_t addr, const uint8_t val, const uint32_t cycle)
+{
+	if (!regs_write(addr, val))
+		return;
+
+	uint32_t *log = write_logs[log_in];
+
+	/* Log full: apply the pending writes now, only their timing is lost.
+	 * A closed frame still being rendered elsewhere goes first. */
+	if (write_log_counts[log_in] == AUDIO_WRITE_LOG_SIZE) {
+		uint_fast16_t read = 0;
+
+		while (__atomic_load_n(&render_pending, __ATOMIC_ACQUIRE))
+			;
+		if (log_in == log_render)
+			read = write_log_read;
+		while (read < AUDIO_WRITE_LOG_SIZE)
+			apply_logged_write(log[read++]);
+		if (log_in == log_render)
+			write_log_read = 0;
+		write_log_counts[log_in] = 0;
+	}
+
+	log[write_log_counts[log_in]++] =
+		(MIN(cycle, LOG_CYCLE_MAX) << LOG_CYCLE_SHIFT) |
+		((uint32_t)(addr - AUDIO_ADDR_COMPENSATION) << 8) | val;
+}
+
+/**
+ * Apply a register write to the sound generation.
+ */
+static void apply_write(const uint16_t addr, const uint8_t val)
 {
 	/* Find sound channel corresponding to register address. */
 	uint_fast8_t i;
@@ -578,6 +1147,21 @@ void audio_init(void)
 	memset(chans, 0, sizeof(chans));
 	chans[0].val = chans[1].val = -1;
 
+	memset(audio_mem, 0, sizeof(audio_mem));
+	memset(audio_regs, 0, sizeof(audio_regs));
+	write_log_counts[0] = write_log_counts[1] = 0;
+	write_log_read = 0;
+	log_in = log_render = 0;
+	render_pending = false;
+	sample_pos = 0;
+	audio_set_sample_rate(sample_rate);
+
+#if ENABLE_AUDIO_BLIP
+	memset(blip_buf_l, 0, sizeof(blip_buf_l));
+	memset(blip_buf_r, 0, sizeof(blip_buf_r));
+	blip_acc_l = blip_acc_r = 0;
+#endif
+
 	/* Initialise IO registers. */
 	{
 		const uint8_t regs_init[] = { 0x80, 0xBF, 0xF3, 0xFF, 0x3F,
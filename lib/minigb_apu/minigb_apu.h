@@ -9,8 +9,19 @@
 
 #include <stdint.h>
 
+/* Highest output rate, sizes the buffers. 22050 and 32000 are also
+ * supported, see audio_set_sample_rate(). */
 #define AUDIO_SAMPLE_RATE	44100
 
+/**
+ * Band-limited synthesis: channel transitions are recorded as amplitude
+ * steps at their exact time and integrated once per block, instead of
+ * averaging every output sample. Cleaner at high pitches and cheaper.
+ */
+#ifndef ENABLE_AUDIO_BLIP
+# define ENABLE_AUDIO_BLIP	0
+#endif
+
 #define DMG_CLOCK_FREQ		4194304.0
 #define SCREEN_REFRESH_CYCLES	70224.0
 #define VERTICAL_SYNC		(DMG_CLOCK_FREQ/SCREEN_REFRESH_CYCLES)
@@ -18,22 +29,75 @@
 #define AUDIO_SAMPLES		((unsigned)(AUDIO_SAMPLE_RATE / VERTICAL_SYNC))
 #define AUDIO_BUFFER_SIZE_BYTES (AUDIO_SAMPLES*4)
 
+/* Register writes queued per frame by audio_write_at(). */
+#define AUDIO_WRITE_LOG_SIZE	1024
+
 /**
  * Fill allocated buffer "data" with "len" number of 32-bit floating point
  * samples (native endian order) in stereo interleaved format.
  */
 void audio_callback(void *ptr, int16_t *data, size_t len);
 
+/**
+ * Render the samples of the current frame up to CPU cycle "cycle" (counted
+ * from the start of the frame) into "data", applying queued register writes
+ * at their own sample. May be called several times per frame, e.g. once per
+ * scanline. Returns the number of stereo samples written.
+ */
+uint32_t audio_render(int16_t *data, const uint32_t cycle);
+
+/**
+ * Render the rest of the current frame into "data", apply any remaining
+ * queued writes and start a new frame. Returns the number of stereo samples
+ * written, audio_frame_samples() when nothing was rendered before in this
+ * frame.
+ */
+uint32_t audio_render_frame(int16_t *data);
+
+/**
+ * Hand the writes queued so far to the renderer and start logging the next
+ * frame into the other log, for rendering on another core: the emulation
+ * core calls this at the end of each frame, the audio core then calls
+ * audio_render() / audio_render_frame() while audio_frame_pending().
+ * Waits while the previous frame is still being rendered.
+ */
+void audio_frame_close(void);
+
+/**
+ * True between audio_frame_close() and the end of audio_render_frame().
+ */
+bool audio_frame_pending(void);
+
+/**
+ * Select the output rate, 22050, 32000 or 44100 Hz. Other values select
+ * AUDIO_SAMPLE_RATE. Call between frames.
+ */
+void audio_set_sample_rate(const uint32_t rate);
+uint32_t audio_get_sample_rate(void);
+
+/**
+ * Samples per frame at the current rate, at most AUDIO_SAMPLES.
+ */
+uint32_t audio_frame_samples(void);
+
 /**
  * Read audio register at given address "addr".
  */
 uint8_t audio_read(const uint16_t addr);
 
 /**
- * Write "val" to audio register at given address "addr".
+ * Write "val" to audio register at given address "addr", applied immediately.
+ * Only valid when rendering runs on the calling core.
  */
 void audio_write(const uint16_t addr, const uint8_t val);
 
+/**
+ * Queue a write of "val" to audio register "addr" at CPU cycle "cycle" of the
+ * current frame. audio_read() sees the value at once, the sound generation
+ * when rendering reaches that cycle.
+ */
+void audio_write_at(const uint16_t addr, const uint8_t val, const uint32_t cycle);
+
 /**
  * Initialise audio driver.
  */
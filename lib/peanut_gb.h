@@ -77,8 +77,10 @@
 /** Definitions for compile-time setting of features. **/
 /**
  * Sound support must be provided by an external library. When audio_read() and
- * audio_write() functions are provided, define ENABLE_SOUND to a non-zero value
- * before including peanut_gb.h in order for these functions to be used.
+ * audio_write_at() functions are provided, define ENABLE_SOUND to a non-zero
+ * value before including peanut_gb.h in order for these functions to be used.
+ * audio_write_at() receives the CPU cycle within the current frame, counted
+ * from the start of VBlank, so that writes can be rendered sample accurately.
  */
 #ifndef ENABLE_SOUND
 # define ENABLE_SOUND 0
@@ -983,6 +985,21 @@ uint8_t __gb_read(struct gb_s *gb, uint16_t addr)
 	PGB_UNREACHABLE();
 }
 
+#if ENABLE_SOUND
+/**
+ * Internal function returning the CPU cycle within the current frame.
+ * A frame starts when gb_frame is set, i.e. at the beginning of VBlank.
+ */
+static inline uint_fast32_t __gb_frame_cycle(const struct gb_s *gb)
+{
+	if(!(gb->hram_io[IO_LCDC] & LCDC_ENABLE))
+		return gb->counter.lcd_off_count;
+
+	return ((gb->hram_io[IO_LY] + LCD_VERT_LINES - LCD_HEIGHT) % LCD_VERT_LINES)
+		* LCD_LINE_CYCLES + gb->counter.lcd_count;
+}
+#endif
+
 /**
  * Internal function used to write bytes.
  */
@@ -1169,7 +1186,7 @@ void __gb_write(struct gb_s *gb, uint_fast16_t addr, uint8_t val)
 		if((addr >= 0xFF10) && (addr <= 0xFF3F))
 		{
 #if ENABLE_SOUND
-			audio_write(addr, val);
+			audio_write_at(addr, val, __gb_frame_cycle(gb));
 #else
 			gb->hram_io[addr - IO_ADDR] = val;
 #endif
@@ -57,12 +57,18 @@
 
 extern uint8_t _FS_start;
 extern uint8_t _FS_end;
-#define MAX_ROM_SIZE (&_FS_end - &_FS_start)
-#define MAX_ROM_SIZE_MB 1024*1024*1.5
+// the last sector of the region holds the ROM library allocation table (see romlibrary.h)
+#define ROM_LIBRARY_TABLE_SIZE 4096
+#define MAX_ROM_SIZE (&_FS_end - &_FS_start - ROM_LIBRARY_TABLE_SIZE)
+#define MAX_ROM_SIZE_MB (1536 * 1024)
+// ext PSRAM: the first ROM_FLASH_SPLIT bytes of a ROM (sector aligned) stay in flash, the rest goes to PSRAM
+#define ROM_FLASH_SPLIT \
+  (((uint32_t)MAX_ROM_SIZE < (uint32_t)MAX_ROM_SIZE_MB ? (uint32_t)MAX_ROM_SIZE : (uint32_t)MAX_ROM_SIZE_MB) & ~(uint32_t)(4096 - 1))
 #endif
 
 #if ENABLE_EXT_PSRAM
 #define PSRAM_SPI SPI1
+#define PSRAM_SPI_HW spi1
 #define PSRAM_CS_PIN   0
 #define PSRAM_SCK_PIN  14
 #define PSRAM_MOSI_PIN 15
@@ -9,6 +9,9 @@
 #if ENABLE_EXT_PSRAM
 #include "psram.h"
 #endif
+#if ENABLE_ROM_PAGING
+#include "rompager.h"
+#endif
 
 struct gb_s gb;
 palette_t palette; // Colour palette
@@ -29,6 +32,11 @@ const uint8_t *RS_rom = GAME_DATA;
 uint8_t* psram_rom = nullptr; 
 #endif
 
+#if ENABLE_EXT_PSRAM
+// same split as load_cart_rom_file_to_rom_and_PSRAM(), computed once instead of per read
+static const uint32_t rom_psram_base = ROM_FLASH_SPLIT;
+#endif
+
 /** Definition of ROM data
  * We're going to erase and reprogram the region defines as "Filesystem" in platformio.ini (see board_build.filesystem_size).
  * This is available from _FS_start (i.e. XIP_BASE + program size) to _FS_end. Note that the last sector is reserved for EEPROM.
@@ -58,9 +66,16 @@ static uint8_t gb_rom_read(struct gb_s* gb, const uint_fast32_t addr) {
 #endif
 
 #if ENABLE_EXT_PSRAM
-  // If PSRAM is enabled and rom was loaded into PSRAM, read from PSRAM
-  if (addr >= MAX_ROM_SIZE_MB) {
-    return psram_read8(addr);
+  // If PSRAM is enabled and rom was loaded into PSRAM, read from PSRAM through the line cache
+  if (addr >= rom_psram_base) {
+    return psram_cached_read8(addr);
+  }
+#endif
+
+#if ENABLE_ROM_PAGING
+  // banks above the flash copy are paged in from the SD card
+  if (addr >= rom_pager.base) {
+    return rom_pager_read(addr);
   }
 #endif
   return RS_rom[addr];
@@ -1,9 +1,47 @@
 #include "gbinput.h"
 
 #include "lcd_core.h"
+#if ENABLE_ROM_PAGING
+#include "rompager.h"
+#endif
 
 #define PALETTE_COUNT 15
 
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+// 每帧的合成拆成若干片, core1 每片之间检查 LCD 命令, 行绘制最多被延迟一片
+#define AUDIO_CORE1_SLICES 8
+
+/**
+ * core1 audio job: render the frame closed by audio_frame_close() slice by
+ * slice, then resample it into the I2S ring.
+ */
+static bool __not_in_flash_func(gbAudioJob)() {
+  static int16_t buf[AUDIO_SAMPLES * 2];
+  static uint32_t slice = 0;
+  static uint32_t rendered = 0;
+
+  if (!audio_frame_pending()) {
+    return false;
+  }
+#if ENABLE_AUDIO_TELEMETRY
+  uint32_t telemetry = audio_telemetry_start();
+#endif
+  if (++slice < AUDIO_CORE1_SLICES) {
+    uint32_t cycle = (uint32_t)SCREEN_REFRESH_CYCLES * slice / AUDIO_CORE1_SLICES;
+    rendered += audio_render(buf + rendered * 2, cycle);
+  } else {
+    rendered += audio_render_frame(buf + rendered * 2);
+    srv.soundService.pushFrames(buf, rendered);
+    slice = 0;
+    rendered = 0;
+  }
+#if ENABLE_AUDIO_TELEMETRY
+  audio_telemetry_stop(&audio_telemetry.synth_us, telemetry);
+#endif
+  return true;
+}
+#endif
+
 GBInput::GBInput() {
 }
 void GBInput::afterHandleJoypadCallback() {
@@ -80,6 +118,10 @@ void GBInput::startEmulator() {
   Serial.println("Starting audio ...");
   audio_init();
   srv.soundService.setAudioCallback(audio_callback);
+  srv.soundService.setSampleRateCallback(audio_set_sample_rate);
+#if ENABLE_AUDIO_CORE1
+  srv.soundService.setCore1Job(gbAudioJob);
+#endif
 #endif
 
 #if ENABLE_SDCARD
@@ -103,6 +145,16 @@ void GBInput::mainLoop() {
     handleJoypad();
     handleSerial();
 
+#if !ENABLE_SOUND
+    // without the audio clock there is no waiting time, one step per frame
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+    srv.sdIoService.poll();
+#endif
+#if ENABLE_ROM_PAGING
+    rom_pager_idle();
+#endif
+#endif
+
 #if ENABLE_SOUND
     srv.soundService.handleSoundLoop();
 #endif
@@ -0,0 +1,327 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_BankCache.cpp : SRAM cache of PRG/CHR ROM banks          */
+/*                                                                   */
+/*===================================================================*/
+
+/*-------------------------------------------------------------------*/
+/*  Include files                                                    */
+/*-------------------------------------------------------------------*/
+
+#include "InfoNES_BankCache.h"
+
+#if ENABLE_NES_BANK_CACHE
+#include "InfoNES.h"
+#include <Arduino.h>
+#include <pico.h>
+#include <stdlib.h>
+#include <string.h>
+#if ENABLE_ROM_PAGING
+#include "rompager.h"
+#endif
+
+static_assert(NES_BANK_CACHE_PRG_SLOTS <= NES_BANK_CACHE_CHR_SLOTS, "slot arrays are sized for CHR");
+
+nes_bank_pool_t nes_prg_cache;
+nes_bank_pool_t nes_chr_cache;
+
+static uint32_t bank_cache_stamp;
+
+/* 能分配多少槽就用多少, 不够最小数量时不缓存 */
+static void alloc_pool(nes_bank_pool_t *pool, const BYTE *source, uint32_t bank_size,
+                       uint32_t max_slots, uint32_t min_slots, const char *name)
+{
+  pool->source = source;
+  pool->bank_size = bank_size;
+  pool->slot_count = 0;
+#if ENABLE_ROM_PAGING
+  pool->next_bank = nullptr;
+  pool->fill_slot = -1;
+  pool->prefetch_bank = NES_BANK_CACHE_NONE;
+  pool->last_bank = NES_BANK_CACHE_NONE;
+#endif
+  if (source == nullptr)
+    return;
+
+  while (pool->slot_count < max_slots)
+  {
+    BYTE *slot = (BYTE *)malloc(bank_size);
+    if (slot == nullptr)
+      break;
+    pool->slots[pool->slot_count] = slot;
+    pool->slot_bank[pool->slot_count] = NES_BANK_CACHE_NONE;
+    pool->slot_used[pool->slot_count] = 0;
+    pool->slot_count++;
+  }
+
+  if (pool->slot_count < min_slots)
+  {
+    Serial.printf("I NES bank cache: not enough RAM for %s banks, reading from ROM\r\n", name);
+    while (pool->slot_count)
+      free(pool->slots[--pool->slot_count]);
+    return;
+  }
+  Serial.printf("I NES bank cache: %lu %s slots of %lu bytes\r\n", pool->slot_count, name, bank_size);
+}
+
+static void free_pool(nes_bank_pool_t *pool)
+{
+  while (pool->slot_count)
+    free(pool->slots[--pool->slot_count]);
+  pool->source = nullptr;
+#if ENABLE_ROM_PAGING
+  free(pool->next_bank);
+  pool->next_bank = nullptr;
+  pool->fill_slot = -1;
+#endif
+}
+
+void nes_bank_cache_reset_stats()
+{
+  nes_prg_cache.hits = 0;
+  nes_prg_cache.misses = 0;
+  nes_chr_cache.hits = 0;
+  nes_chr_cache.misses = 0;
+#if ENABLE_ROM_PAGING
+  nes_prg_cache.prefetches = 0;
+  nes_chr_cache.prefetches = 0;
+#endif
+}
+
+void nes_bank_cache_open(const BYTE *rom, const BYTE *vrom)
+{
+  nes_bank_cache_close();
+  bank_cache_stamp = 0;
+  alloc_pool(&nes_prg_cache, rom, NES_BANK_CACHE_PRG_SIZE,
+             NES_BANK_CACHE_PRG_SLOTS, NES_BANK_CACHE_PRG_MIN_SLOTS, "PRG");
+  alloc_pool(&nes_chr_cache, vrom, NES_BANK_CACHE_CHR_SIZE,
+             NES_BANK_CACHE_CHR_SLOTS, NES_BANK_CACHE_CHR_MIN_SLOTS, "CHR");
+  nes_bank_cache_reset_stats();
+}
+
+void nes_bank_cache_close()
+{
+  free_pool(&nes_prg_cache);
+  free_pool(&nes_chr_cache);
+}
+
+/* A slot stays while the CPU or PPU can still read it through a bank pointer */
+static bool slot_pinned(const nes_bank_pool_t *pool, const BYTE *slot)
+{
+  const BYTE *end = slot + pool->bank_size;
+  if (pool == &nes_prg_cache)
+  {
+    for (int i = 0; i < 4; i++)
+      if (ROMBANK[i] >= slot && ROMBANK[i] < end)
+        return true;
+    return SRAMBANK >= slot && SRAMBANK < end;
+  }
+  for (int i = 0; i < 16; i++)
+    if (PPUBANK[i] >= slot && PPUBANK[i] < end)
+      return true;
+  return false;
+}
+
+static int find_slot(const nes_bank_pool_t *pool, uint32_t bank)
+{
+  for (uint32_t i = 0; i < pool->slot_count; i++)
+    if (pool->slot_bank[i] == bank)
+      return i;
+  return -1;
+}
+
+/* Least recently selected slot that no bank pointer uses, -1 if none */
+static int pick_victim(const nes_bank_pool_t *pool)
+{
+  int victim = -1;
+  for (uint32_t i = 0; i < pool->slot_count; i++)
+  {
+#if ENABLE_ROM_PAGING
+    if ((int32_t)i == pool->fill_slot)
+      continue;
+#endif
+    if (slot_pinned(pool, pool->slots[i]))
+      continue;
+    if (victim < 0 || pool->slot_used[i] < pool->slot_used[victim])
+      victim = i;
+  }
+  return victim;
+}
+
+#if ENABLE_ROM_PAGING
+static inline bool bank_paged(const nes_bank_pool_t *pool, uint32_t bank)
+{
+  return pool->next_bank != nullptr && bank >= pool->paged_from;
+}
+
+/* 记录切换顺序, 下一次大概率还是同样的顺序 */
+static void record_switch(nes_bank_pool_t *pool, uint32_t bank)
+{
+  if (pool->next_bank == nullptr || bank >= pool->bank_count)
+    return;
+  if (pool->last_bank != NES_BANK_CACHE_NONE && pool->last_bank != bank)
+    pool->next_bank[pool->last_bank] = bank;
+  pool->last_bank = bank;
+
+  uint16_t next = pool->next_bank[bank];
+  if (next != NES_BANK_CACHE_NONE && bank_paged(pool, next) && find_slot(pool, next) < 0)
+    pool->prefetch_bank = next;
+}
+#endif
+
+/* Copy or read bank into slot */
+static void fill_slot(nes_bank_pool_t *pool, int slot, uint32_t bank)
+{
+#if ENABLE_ROM_PAGING
+  if (bank_paged(pool, bank))
+  {
+    rom_pager_read_file(pool->offset + bank * pool->bank_size, pool->slots[slot], pool->bank_size);
+  }
+  else
+#endif
+  {
+    memcpy(pool->slots[slot], pool->source + bank * pool->bank_size, pool->bank_size);
+  }
+  pool->slot_bank[slot] = bank;
+  pool->slot_used[slot] = ++bank_cache_stamp;
+}
+
+/*
+ * ROMPAGE()/VROMPAGE(): called when a mapper switches a bank, the
+ * returned pointer replaces the direct ROM address.
+ */
+BYTE *__not_in_flash_func(nes_bank_cache_select)(nes_bank_pool_t *pool, uint32_t bank)
+{
+  BYTE *direct = (BYTE *)pool->source + bank * pool->bank_size;
+  if (pool->slot_count == 0)
+    return direct;
+
+#if ENABLE_ROM_PAGING
+  record_switch(pool, bank);
+#endif
+  int slot = find_slot(pool, bank);
+  if (slot >= 0)
+  {
+    pool->hits++;
+    pool->slot_used[slot] = ++bank_cache_stamp;
+    return pool->slots[slot];
+  }
+
+  pool->misses++;
+#if ENABLE_ROM_PAGING
+  if (pool->fill_slot >= 0 && pool->fill_bank == bank)
+  {
+    /* 正在预取这个 bank: 读完剩下的部分 */
+    slot = pool->fill_slot;
+    pool->fill_slot = -1;
+    rom_pager_read_file(pool->offset + bank * pool->bank_size + pool->fill_done,
+                        pool->slots[slot] + pool->fill_done, pool->bank_size - pool->fill_done);
+    pool->slot_bank[slot] = bank;
+    pool->slot_used[slot] = ++bank_cache_stamp;
+    return pool->slots[slot];
+  }
+#endif
+
+  slot = pick_victim(pool);
+#if ENABLE_ROM_PAGING
+  if (slot < 0 && bank_paged(pool, bank))
+  {
+    /* 不在 flash 里的 bank 必须放进槽, 放弃预取 */
+    slot = pool->fill_slot;
+    pool->fill_slot = -1;
+  }
+#endif
+  if (slot < 0)
+  {
+    /* 所有槽都在使用中 (mapper 同时映射了太多 bank) */
+    return direct;
+  }
+
+  fill_slot(pool, slot, bank);
+  return pool->slots[slot];
+}
+
+#if ENABLE_ROM_PAGING
+static bool page_pool(nes_bank_pool_t *pool, const BYTE *image, uint32_t flash_size, uint32_t bank_count)
+{
+  if (pool->source == nullptr)
+    return true;
+
+  pool->bank_count = bank_count;
+  pool->offset = pool->source - image;
+  pool->paged_from = flash_size > pool->offset ? (flash_size - pool->offset) / pool->bank_size : 0;
+  if (pool->paged_from >= bank_count)
+    return true;
+
+  /* 分配槽之后再分配历史表, 槽优先 */
+  if (pool->slot_count > 0)
+    pool->next_bank = (uint16_t *)malloc(bank_count * sizeof(uint16_t));
+  if (pool->next_bank == nullptr)
+    return false;
+  for (uint32_t i = 0; i < bank_count; i++)
+    pool->next_bank[i] = NES_BANK_CACHE_NONE;
+  return true;
+}
+
+bool nes_bank_cache_page(const BYTE *image, uint32_t flash_size, uint32_t prg_banks, uint32_t chr_banks)
+{
+  if (!page_pool(&nes_prg_cache, image, flash_size, prg_banks) ||
+      !page_pool(&nes_chr_cache, image, flash_size, chr_banks))
+  {
+    Serial.printf("E NES bank cache: not enough RAM to page the ROM from SD\r\n");
+    return false;
+  }
+  Serial.printf("I NES bank cache: PRG banks from %lu, CHR banks from %lu read from SD\r\n",
+                nes_prg_cache.next_bank ? nes_prg_cache.paged_from : prg_banks,
+                nes_chr_cache.next_bank ? nes_chr_cache.paged_from : chr_banks);
+  return true;
+}
+
+/*
+ * Start reading ahead the predicted bank of pool or continue it with one
+ * NES_BANK_CACHE_PREFETCH_STEP read. The slot only gets its bank number
+ * once it is complete.
+ */
+static bool pool_idle(nes_bank_pool_t *pool)
+{
+  if (pool->next_bank == nullptr)
+    return false;
+
+  if (pool->fill_slot < 0)
+  {
+    const uint16_t bank = pool->prefetch_bank;
+    pool->prefetch_bank = NES_BANK_CACHE_NONE;
+    if (bank == NES_BANK_CACHE_NONE || find_slot(pool, bank) >= 0)
+      return false;
+    const int slot = pick_victim(pool);
+    if (slot < 0)
+      return false;
+    pool->slot_bank[slot] = NES_BANK_CACHE_NONE;
+    pool->fill_slot = slot;
+    pool->fill_bank = bank;
+    pool->fill_done = 0;
+  }
+
+  const uint32_t n = pool->bank_size - pool->fill_done < NES_BANK_CACHE_PREFETCH_STEP
+                         ? pool->bank_size - pool->fill_done
+                         : NES_BANK_CACHE_PREFETCH_STEP;
+  rom_pager_read_file(pool->offset + pool->fill_bank * pool->bank_size + pool->fill_done,
+                      pool->slots[pool->fill_slot] + pool->fill_done, n);
+  pool->fill_done += n;
+  if (pool->fill_done == pool->bank_size)
+  {
+    pool->slot_bank[pool->fill_slot] = pool->fill_bank;
+    pool->slot_used[pool->fill_slot] = ++bank_cache_stamp;
+    pool->fill_slot = -1;
+    pool->prefetches++;
+  }
+  return true;
+}
+
+bool nes_bank_cache_idle()
+{
+  return pool_idle(&nes_prg_cache) || pool_idle(&nes_chr_cache);
+}
+#endif
+
+#endif /* ENABLE_NES_BANK_CACHE */
@@ -0,0 +1,98 @@
+/*===================================================================*/
+/*                                                                   */
+/*  InfoNES_BankCache.h : SRAM cache of PRG/CHR ROM banks            */
+/*                                                                   */
+/*===================================================================*/
+
+#ifndef InfoNES_BANKCACHE_H_INCLUDED
+#define InfoNES_BANKCACHE_H_INCLUDED
+
+/*-------------------------------------------------------------------*/
+/*  Include files                                                    */
+/*-------------------------------------------------------------------*/
+
+#include "InfoNES_Types.h"
+#include <stdint.h>
+
+#if ENABLE_NES_BANK_CACHE
+
+/*-------------------------------------------------------------------*/
+/*  Constants                                                        */
+/*-------------------------------------------------------------------*/
+
+/*
+ * The ROM image sits in XIP flash (or PSRAM), every opcode fetch and
+ * pattern read that misses the XIP cache stalls the CPU. ROMPAGE() and
+ * VROMPAGE() hand out copies of the banks in SRAM instead, so mappers
+ * keep working unchanged. Banks still referenced by ROMBANK, SRAMBANK or
+ * PPUBANK are pinned, the least recently selected other slot is reused.
+ * Without enough RAM for the minimum pool the pointers go to ROM as before.
+ *
+ * With ENABLE_ROM_PAGING only the start of an oversized ROM is in flash.
+ * Banks not completely below the flash copy are read from the SD file
+ * into a slot when selected. Every bank remembers the bank selected after
+ * it last time, that one is read ahead from the frame slack time with
+ * nes_bank_cache_idle().
+ */
+#define NES_BANK_CACHE_PRG_SIZE 0x2000
+#define NES_BANK_CACHE_CHR_SIZE 0x400
+#define NES_BANK_CACHE_PRG_SLOTS 8
+#define NES_BANK_CACHE_CHR_SLOTS 24
+/* ROMBANK[4] + SRAMBANK, PPUBANK[16] pinned plus one free slot */
+#define NES_BANK_CACHE_PRG_MIN_SLOTS 6
+#define NES_BANK_CACHE_CHR_MIN_SLOTS 17
+#define NES_BANK_CACHE_NONE 0xFFFF
+/* read ahead step, one card transfer per nes_bank_cache_idle() call */
+#define NES_BANK_CACHE_PREFETCH_STEP 4096
+
+/*-------------------------------------------------------------------*/
+/*  Types                                                            */
+/*-------------------------------------------------------------------*/
+
+typedef struct nes_bank_pool_t
+{
+  const BYTE *source;                     /* ROM or VROM */
+  uint32_t bank_size;
+  uint32_t slot_count;                    /* 0: pointers go to source */
+  BYTE *slots[NES_BANK_CACHE_CHR_SLOTS];
+  uint16_t slot_bank[NES_BANK_CACHE_CHR_SLOTS];
+  uint32_t slot_used[NES_BANK_CACHE_CHR_SLOTS]; /* LRU stamp */
+  uint32_t hits;
+  uint32_t misses;
+#if ENABLE_ROM_PAGING
+  uint32_t bank_count;
+  uint32_t paged_from;                    /* first bank not completely in flash */
+  uint32_t offset;                        /* ROM data offset of bank 0 */
+  uint16_t *next_bank;                    /* bank selected after this one, null when not paged */
+  uint16_t last_bank;
+  uint16_t prefetch_bank;                 /* predicted bank, not started yet */
+  int32_t fill_slot;                      /* slot being read ahead, -1 when none */
+  uint16_t fill_bank;
+  uint32_t fill_done;
+  uint32_t prefetches;
+#endif
+} nes_bank_pool_t;
+
+extern nes_bank_pool_t nes_prg_cache;
+extern nes_bank_pool_t nes_chr_cache;
+
+/*-------------------------------------------------------------------*/
+/*  Function prototypes                                              */
+/*-------------------------------------------------------------------*/
+
+/* Allocate the pools for the banks of ROM and VROM (vrom may be null) */
+void nes_bank_cache_open(const BYTE *rom, const BYTE *vrom);
+void nes_bank_cache_close();
+BYTE *nes_bank_cache_select(nes_bank_pool_t *pool, uint32_t bank);
+void nes_bank_cache_reset_stats();
+#if ENABLE_ROM_PAGING
+/* Only flash_size bytes of the ROM data at image are in flash, the rest
+   is read through rom_pager_read_file(). False without RAM for the slots */
+bool nes_bank_cache_page(const BYTE *image, uint32_t flash_size, uint32_t prg_banks, uint32_t chr_banks);
+/* One step of reading ahead a predicted bank, false when there was nothing to do */
+bool nes_bank_cache_idle();
+#endif
+
+#endif /* ENABLE_NES_BANK_CACHE */
+
+#endif /* !InfoNES_BANKCACHE_H_INCLUDED */
@@ -14,6 +14,7 @@
 /*-------------------------------------------------------------------*/
 
 #include "InfoNES_Types.h"
+#include "InfoNES_BankCache.h"
 
 /*-------------------------------------------------------------------*/
 /*  Constants                                                        */
@@ -32,12 +33,21 @@ extern BYTE DRAM[];
 /*  Macros                                                           */
 /*-------------------------------------------------------------------*/
 
+#if ENABLE_NES_BANK_CACHE
+/* The address of 8Kbytes unit of the ROM, copied to SRAM */
+#define ROMPAGE(a) nes_bank_cache_select(&nes_prg_cache, (a))
+/* From behind the ROM, the address of 8kbytes unit */
+#define ROMLASTPAGE(a) nes_bank_cache_select(&nes_prg_cache, NesHeader.byRomSize * 2 - ((a) + 1))
+/* The address of 1Kbytes unit of the VROM, copied to SRAM */
+#define VROMPAGE(a) nes_bank_cache_select(&nes_chr_cache, (a))
+#else
 /* The address of 8Kbytes unit of the ROM */
 #define ROMPAGE(a) &ROM[(a)*0x2000]
 /* From behind the ROM, the address of 8kbytes unit */
 #define ROMLASTPAGE(a) &ROM[NesHeader.byRomSize * 0x4000 - ((a) + 1) * 0x2000]
 /* The address of 1Kbytes unit of the VROM */
 #define VROMPAGE(a) &VROM[(a)*0x400]
+#endif
 /* The address of 1Kbytes unit of the CRAM */
 #define CRAMPAGE(a) &PPURAM[0x0000 + ((a)&0x1F) * 0x400]
 /* The address of 1Kbytes unit of the VRAM */
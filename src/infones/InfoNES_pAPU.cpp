@@ -15,6 +15,9 @@
 #include "InfoNES_pAPU.h"
 #include <algorithm>
 #include <string.h>
+#if ENABLE_SOUND && ENABLE_AUDIO_TELEMETRY
+#include "audio_telemetry.h"
+#endif
 
 /*-------------------------------------------------------------------*/
 /*   APU Event resources                                             */
@@ -24,6 +27,17 @@ struct ApuEvent_t ApuEventQueue[APU_EVENT_MAX];
 int cur_event;
 WORD entertime;
 
+/* Output sample of every queued event, computed when a batch is rendered */
+static short ApuEventSample[APU_EVENT_MAX];
+
+/* Events of the batch being rendered, ApuEventQueue or a core1 job copy */
+static const struct ApuEvent_t *ApuRenderEvents = ApuEventQueue;
+static int ApuRenderEventCount;
+
+static void ApuFlush(bool vsync);
+static void ApuVsyncUpdate();
+static void ApuStatusWrite(BYTE type, BYTE data);
+
 /*-------------------------------------------------------------------*/
 /*   APU Register Write Functions                                    */
 /*-------------------------------------------------------------------*/
@@ -31,6 +45,11 @@ WORD entertime;
 #define APU_WRITEFUNC(name, evtype)                                \
   void ApuWrite##name(WORD addr, BYTE value)                       \
   {                                                                \
+    ApuStatusWrite(APUET_W_##evtype, value);                       \
+    if (cur_event >= APU_EVENT_MAX)                                \
+    {                                                              \
+      ApuFlush(false);                                             \
+    }                                                              \
     ApuEventQueue[cur_event].time = getPassedClocks() - entertime; \
     ApuEventQueue[cur_event].type = APUET_W_##evtype;              \
     ApuEventQueue[cur_event].data = value;                         \
@@ -64,7 +83,7 @@ APU_WRITEFUNC(C5b, C5B);
 APU_WRITEFUNC(C5c, C5C);
 APU_WRITEFUNC(C5d, C5D);
 
-APU_WRITEFUNC(Control, CTRL);
+APU_WRITEFUNC(CtrlEvent, CTRL);
 
 ApuWritefunc pAPUSoundRegs[20] =
     {
@@ -94,7 +113,13 @@ ApuWritefunc pAPUSoundRegs[20] =
 /*   APU resources                                                   */
 /*-------------------------------------------------------------------*/
 
-BYTE wave_buffers[5][735]; /* 44100 / 60 = 735 samples per sync */
+/* DAC levels: pulse, triangle and noise 0-15, DPCM 0-127 */
+BYTE wave_buffers[5][APU_WAVE_BUFFER_SIZE];
+
+/* Nonlinear mixer, 16 bits output: */
+/* ApuPulseTable[pulse1 + pulse2] + ApuTndTable[3 * triangle + 2 * noise + dpcm] */
+short ApuPulseTable[31];
+short ApuTndTable[203];
 
 BYTE ApuCtrl;
 BYTE ApuCtrlNew;
@@ -103,12 +128,13 @@ BYTE ApuCtrlNew;
 /*   APU Quality resources                                           */
 /*-------------------------------------------------------------------*/
 
-int ApuQuality;
+int ApuQuality = pAPU_QUALITY - 1;
 
 DWORD ApuPulseMagic;
 DWORD ApuTriangleMagic;
 DWORD ApuNoiseMagic;
 unsigned int ApuSamplesPerSync16;
+unsigned int ApuSamplesPerCycle16;
 unsigned int ApuCyclesPerSample;
 unsigned int ApuSampleRate;
 DWORD ApuCycleRate;
@@ -126,8 +152,9 @@ struct ApuQualityData_t
     // {0xa2567000, 0xa2567000, 0xa2567000, 183, 164, 11025, 1062658},
     // {0x512b3800, 0x512b3800, 0x512b3800, 367, 82, 22050, 531329},
     // {0x289d9c00, 0x289d9c00, 0x289d9c00, 735, 41, 44100, 265664},
-    {0xa2567000, 0xa2567000, 0xa2567000, 45963, 164, 11025, 664935},
-    {0x512b3800, 0x512b3800, 0x512b3800, 91926, 82, 22050, 1329870},
+    {0xa2767000, 0xa2767000, 0xa2767000, 46101, 162, 11025, 10638963},
+    {0x513b3800, 0x513b3800, 0x513b3800, 92201, 81, 22050, 5319481},
+    {0x37f93496, 0x37f93496, 0x37f93496, 133807, 56, 32000, 3665455},
     {0x289d9c00, 0x289d9c00, 0x289d9c00, 184402, 41, 44100, 2659741},
 };
 
@@ -138,6 +165,8 @@ struct ApuQualityData_t
 // cycle_rate
 // 1789773 / 44100 * 65536 = 2659740.665034014
 
+// magic scales with 1 / sample_rate: 0x289d9c00 * 44100 / sample_rate
+
 /*-------------------------------------------------------------------*/
 /*  Rectangle Wave #1 resources                                      */
 /*-------------------------------------------------------------------*/
@@ -198,28 +227,25 @@ int32_t ApuC4EnvPhase;
 /*-------------------------------------------------------------------*/
 BYTE ApuC5Reg[4];
 BYTE ApuC5Enable;
-BYTE ApuC5Looping;
 BYTE ApuC5CurByte;
+BYTE ApuC5Bits; /* bits of ApuC5CurByte still to play */
 BYTE ApuC5DpcmValue;
 
 int ApuC5Freq;
 int ApuC5Phaseacc;
 
-WORD ApuC5Address, ApuC5CacheAddr;
-int ApuC5DmaLength, ApuC5CacheDmaLength;
-
 /*-------------------------------------------------------------------*/
 /*  Wave Data                                                        */
 /*-------------------------------------------------------------------*/
 BYTE __not_in_flash_func(pulse_25)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -247,22 +273,22 @@ BYTE __not_in_flash_func(pulse_25)[0x20] = {
 };
 
 BYTE __not_in_flash_func(pulse_50)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -282,30 +308,30 @@ BYTE __not_in_flash_func(pulse_50)[0x20] = {
 };
 
 BYTE __not_in_flash_func(pulse_75)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -317,34 +343,34 @@ BYTE __not_in_flash_func(pulse_75)[0x20] = {
 };
 
 BYTE __not_in_flash_func(pulse_87)[0x20] = {
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
-    0x11,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
+    0x01,
     0x00,
     0x00,
     0x00,
@@ -353,37 +379,37 @@ BYTE __not_in_flash_func(pulse_87)[0x20] = {
 
 BYTE __not_in_flash_func(triangle_50)[0x20] = {
     0x00,
-    0x10,
-    0x20,
-    0x30,
-    0x40,
-    0x50,
-    0x60,
-    0x70,
-    0x80,
-    0x90,
-    0xa0,
-    0xb0,
-    0xc0,
-    0xd0,
-    0xe0,
-    0xf0,
-    0xff,
-    0xef,
-    0xdf,
-    0xcf,
-    0xbf,
-    0xaf,
-    0x9f,
-    0x8f,
-    0x7f,
-    0x6f,
-    0x5f,
-    0x4f,
-    0x3f,
-    0x2f,
-    0x1f,
+    0x01,
+    0x02,
+    0x03,
+    0x04,
+    0x05,
+    0x06,
+    0x07,
+    0x08,
+    0x09,
+    0x0a,
+    0x0b,
+    0x0c,
+    0x0d,
+    0x0e,
+    0x0f,
     0x0f,
+    0x0e,
+    0x0d,
+    0x0c,
+    0x0b,
+    0x0a,
+    0x09,
+    0x08,
+    0x07,
+    0x06,
+    0x05,
+    0x04,
+    0x03,
+    0x02,
+    0x01,
+    0x00,
 };
 
 BYTE *__not_in_flash_func(pulse_waves)[4] = {
@@ -457,7 +483,7 @@ DWORD __not_in_flash_func(ApuDpcmCycles)[16] =
 
 /*===================================================================*/
 /*                                                                   */
-/*      ApuRenderingWave1() : Rendering Rectangular Wave #1          */
+/*      ApuRenderSpan1() : Rendering Rectangular Wave #1             */
 /*                                                                   */
 /*===================================================================*/
 
@@ -465,26 +491,26 @@ DWORD __not_in_flash_func(ApuDpcmCycles)[16] =
 /* Write registers of rectangular wave #1                            */
 /*-------------------------------------------------------------------*/
 
-int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
+int __not_in_flash_func(ApuWriteWave1)(int sample, int event)
 {
   /* APU Reg Write Event */
-  while ((event < cur_event) && (ApuEventQueue[event].time < cycles))
+  while ((event < ApuRenderEventCount) && (ApuEventSample[event] <= sample))
   {
-    if ((ApuEventQueue[event].type & APUET_MASK) == APUET_C1)
+    if ((ApuRenderEvents[event].type & APUET_MASK) == APUET_C1)
     {
-      switch (ApuEventQueue[event].type & 0x03)
+      switch (ApuRenderEvents[event].type & 0x03)
       {
       case 0:
-        ApuC1a = ApuEventQueue[event].data;
+        ApuC1a = ApuRenderEvents[event].data;
         ApuC1Wave = pulse_waves[ApuC1DutyCycle >> 6];
         break;
 
       case 1:
-        ApuC1b = ApuEventQueue[event].data;
+        ApuC1b = ApuRenderEvents[event].data;
         break;
 
       case 2:
-        ApuC1c = ApuEventQueue[event].data;
+        ApuC1c = ApuRenderEvents[event].data;
         ApuC1Freq = ((((WORD)ApuC1d & 0x07) << 8) + ApuC1c);
         ApuC1Atl = ApuAtl[(ApuC1d & 0xf8) >> 3];
 
@@ -499,7 +525,7 @@ int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
         break;
 
       case 3:
-        ApuC1d = ApuEventQueue[event].data;
+        ApuC1d = ApuRenderEvents[event].data;
         ApuC1Freq = ((((WORD)ApuC1d & 0x07) << 8) + ApuC1c);
         ApuC1Atl = ApuAtl[(ApuC1d & 0xf8) >> 3];
 
@@ -516,11 +542,11 @@ int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
         break;
       }
     }
-    else if (ApuEventQueue[event].type == APUET_W_CTRL)
+    else if (ApuRenderEvents[event].type == APUET_W_CTRL)
     {
-      ApuCtrlNew = ApuEventQueue[event].data;
+      ApuCtrlNew = ApuRenderEvents[event].data;
 
-      if (!(ApuEventQueue[event].data & (1 << 0)))
+      if (!(ApuRenderEvents[event].data & (1 << 0)))
       {
         ApuC1Atl = 0;
       }
@@ -534,10 +560,8 @@ int __not_in_flash_func(ApuWriteWave1)(int cycles, int event)
 /* Rendering rectangular wave #1                                     */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave1)(int n)
+static void __not_in_flash_func(ApuRenderSpan1)(BYTE *wave, int n)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave1(ApuCyclesPerSample * (n + 1), 0);
 
   if ((ApuCtrlNew & 0x01) && (ApuC1Atl || ApuC1Hold) &&
       !(ApuC1Freq < 8 || (!ApuC1SweepIncDec && ApuC1Freq > ApuC1FreqLimit)))
@@ -548,18 +572,18 @@ void __not_in_flash_func(ApuRenderingWave1)(int n)
       /* Wave Rendering */
       ApuC1Index += ApuC1Skip;
       ApuC1Index &= 0x1fffffff;
-      wave_buffers[0][i] = ApuC1Wave[ApuC1Index >> 24] * vol;
+      wave[i] = ApuC1Wave[ApuC1Index >> 24] * vol;
     }
   }
   else
   {
-    memset(wave_buffers[0], 0, 2 * n);
+    memset(wave, 0, n);
   }
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*      ApuRenderingWave2() : Rendering Rectangular Wave #2          */
+/*      ApuRenderSpan2() : Rendering Rectangular Wave #2             */
 /*                                                                   */
 /*===================================================================*/
 
@@ -567,26 +591,26 @@ void __not_in_flash_func(ApuRenderingWave1)(int n)
 /* Write registers of rectangular wave #2                           */
 /*-------------------------------------------------------------------*/
 
-int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
+int __not_in_flash_func(ApuWriteWave2)(int sample, int event)
 {
   /* APU Reg Write Event */
-  while ((event < cur_event) && (ApuEventQueue[event].time < cycles))
+  while ((event < ApuRenderEventCount) && (ApuEventSample[event] <= sample))
   {
-    if ((ApuEventQueue[event].type & APUET_MASK) == APUET_C2)
+    if ((ApuRenderEvents[event].type & APUET_MASK) == APUET_C2)
     {
-      switch (ApuEventQueue[event].type & 0x03)
+      switch (ApuRenderEvents[event].type & 0x03)
       {
       case 0:
-        ApuC2a = ApuEventQueue[event].data;
+        ApuC2a = ApuRenderEvents[event].data;
         ApuC2Wave = pulse_waves[ApuC2DutyCycle >> 6];
         break;
 
       case 1:
-        ApuC2b = ApuEventQueue[event].data;
+        ApuC2b = ApuRenderEvents[event].data;
         break;
 
       case 2:
-        ApuC2c = ApuEventQueue[event].data;
+        ApuC2c = ApuRenderEvents[event].data;
         ApuC2Freq = ((((WORD)ApuC2d & 0x07) << 8) + ApuC2c);
         ApuC2Atl = ApuAtl[(ApuC2d & 0xf8) >> 3];
 
@@ -601,7 +625,7 @@ int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
         break;
 
       case 3:
-        ApuC2d = ApuEventQueue[event].data;
+        ApuC2d = ApuRenderEvents[event].data;
         ApuC2Freq = ((((WORD)ApuC2d & 0x07) << 8) + ApuC2c);
         ApuC2Atl = ApuAtl[(ApuC2d & 0xf8) >> 3];
 
@@ -617,11 +641,11 @@ int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
         break;
       }
     }
-    else if (ApuEventQueue[event].type == APUET_W_CTRL)
+    else if (ApuRenderEvents[event].type == APUET_W_CTRL)
     {
-      ApuCtrlNew = ApuEventQueue[event].data;
+      ApuCtrlNew = ApuRenderEvents[event].data;
 
-      if (!(ApuEventQueue[event].data & (1 << 1)))
+      if (!(ApuRenderEvents[event].data & (1 << 1)))
       {
         ApuC2Atl = 0;
       }
@@ -635,10 +659,8 @@ int __not_in_flash_func(ApuWriteWave2)(int cycles, int event)
 /* Rendering rectangular wave #2                                     */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave2)(int n)
+static void __not_in_flash_func(ApuRenderSpan2)(BYTE *wave, int n)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave2(ApuCyclesPerSample * (n + 1), 0);
 
   if ((ApuCtrlNew & 0x02) && (ApuC2Atl || ApuC2Hold) &&
       !(ApuC2Freq < 8 || (!ApuC2SweepIncDec && ApuC2Freq > ApuC2FreqLimit)))
@@ -649,18 +671,18 @@ void __not_in_flash_func(ApuRenderingWave2)(int n)
       /* Wave Rendering */
       ApuC2Index += ApuC2Skip;
       ApuC2Index &= 0x1fffffff;
-      wave_buffers[1][i] = ApuC2Wave[ApuC2Index >> 24] * vol;
+      wave[i] = ApuC2Wave[ApuC2Index >> 24] * vol;
     }
   }
   else
   {
-    memset(wave_buffers[1], 0, 2 * n);
+    memset(wave, 0, n);
   }
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*      ApuRenderingWave3() : Rendering Triangle Wave                */
+/*      ApuRenderSpan3() : Rendering Triangle Wave                   */
 /*                                                                   */
 /*===================================================================*/
 
@@ -668,25 +690,25 @@ void __not_in_flash_func(ApuRenderingWave2)(int n)
 /* Write registers of triangle wave #3                              */
 /*-------------------------------------------------------------------*/
 
-int __not_in_flash_func(ApuWriteWave3)(int cycles, int event)
+int __not_in_flash_func(ApuWriteWave3)(int sample, int event)
 {
   /* APU Reg Write Event */
-  while ((event < cur_event) && (ApuEventQueue[event].time < cycles))
+  while ((event < ApuRenderEventCount) && (ApuEventSample[event] <= sample))
   {
-    if ((ApuEventQueue[event].type & APUET_MASK) == APUET_C3)
+    if ((ApuRenderEvents[event].type & APUET_MASK) == APUET_C3)
     {
-      switch (ApuEventQueue[event].type & 3)
+      switch (ApuRenderEvents[event].type & 3)
       {
       case 0:
-        ApuC3a = ApuEventQueue[event].data;
+        ApuC3a = ApuRenderEvents[event].data;
         break;
 
       case 1:
-        ApuC3b = ApuEventQueue[event].data;
+        ApuC3b = ApuRenderEvents[event].data;
         break;
 
       case 2:
-        ApuC3c = ApuEventQueue[event].data;
+        ApuC3c = ApuRenderEvents[event].data;
         if (ApuC3Freq)
         {
           ApuC3Skip = ApuTriangleMagic / ApuC3Freq;
@@ -698,7 +720,7 @@ int __not_in_flash_func(ApuWriteWave3)(int cycles, int event)
         break;
 
       case 3:
-        ApuC3d = ApuEventQueue[event].data;
+        ApuC3d = ApuRenderEvents[event].data;
         ApuC3Atl = ApuC3LengthCounter;
         ApuC3ReloadFlag = true;
         if (ApuC3Freq)
@@ -711,11 +733,11 @@ int __not_in_flash_func(ApuWriteWave3)(int cycles, int event)
         }
       }
     }
-    else if (ApuEventQueue[event].type == APUET_W_CTRL)
+    else if (ApuRenderEvents[event].type == APUET_W_CTRL)
     {
-      ApuCtrlNew = ApuEventQueue[event].data;
+      ApuCtrlNew = ApuRenderEvents[event].data;
 
-      if (!(ApuEventQueue[event].data & (1 << 2)))
+      if (!(ApuRenderEvents[event].data & (1 << 2)))
       {
         ApuC3Atl = 0;
         ApuC3Llc = 0;
@@ -730,10 +752,8 @@ int __not_in_flash_func(ApuWriteWave3)(int cycles, int event)
 /* Rendering triangle wave #3                                        */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave3)(int n)
+static void __not_in_flash_func(ApuRenderSpan3)(BYTE *wave, int n)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave3(ApuCyclesPerSample * (n + 1), 0);
 
   if ((ApuCtrlNew & 0x04) && ApuC3Atl > 0 && ApuC3Llc > 0 && ApuC3Freq >= 8)
   {
@@ -742,18 +762,18 @@ void __not_in_flash_func(ApuRenderingWave3)(int n)
       /* Wave Rendering */
       ApuC3Index += ApuC3Skip;
       ApuC3Index &= 0x1fffffff;
-      wave_buffers[2][i] = triangle_50[ApuC3Index >> 24];
+      wave[i] = triangle_50[ApuC3Index >> 24];
     }
   }
   else
   {
-    memset(wave_buffers[2], 0, 2 * n);
+    memset(wave, 0, n);
   }
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*      ApuRenderingWave4() : Rendering Noise                        */
+/*      ApuRenderSpan4() : Rendering Noise                           */
 /*                                                                   */
 /*===================================================================*/
 
@@ -761,25 +781,25 @@ void __not_in_flash_func(ApuRenderingWave3)(int n)
 /* Write registers of noise channel #4                              */
 /*-------------------------------------------------------------------*/
 
-int __not_in_flash_func(ApuWriteWave4)(int cycles, int event)
+int __not_in_flash_func(ApuWriteWave4)(int sample, int event)
 {
   /* APU Reg Write Event */
-  while ((event < cur_event) && (ApuEventQueue[event].time < cycles))
+  while ((event < ApuRenderEventCount) && (ApuEventSample[event] <= sample))
   {
-    if ((ApuEventQueue[event].type & APUET_MASK) == APUET_C4)
+    if ((ApuRenderEvents[event].type & APUET_MASK) == APUET_C4)
     {
-      switch (ApuEventQueue[event].type & 3)
+      switch (ApuRenderEvents[event].type & 3)
       {
       case 0:
-        ApuC4a = ApuEventQueue[event].data;
+        ApuC4a = ApuRenderEvents[event].data;
         break;
 
       case 1:
-        ApuC4b = ApuEventQueue[event].data;
+        ApuC4b = ApuRenderEvents[event].data;
         break;
 
       case 2:
-        ApuC4c = ApuEventQueue[event].data;
+        ApuC4c = ApuRenderEvents[event].data;
 
         // if (ApuC4Small)
         // {
@@ -803,7 +823,7 @@ int __not_in_flash_func(ApuWriteWave4)(int cycles, int event)
         break;
 
       case 3:
-        ApuC4d = ApuEventQueue[event].data;
+        ApuC4d = ApuRenderEvents[event].data;
 
         /* Frequency */
         if (ApuC4Freq)
@@ -818,11 +838,11 @@ int __not_in_flash_func(ApuWriteWave4)(int cycles, int event)
         ApuC4EnvVol = 15;
       }
     }
-    else if (ApuEventQueue[event].type == APUET_W_CTRL)
+    else if (ApuRenderEvents[event].type == APUET_W_CTRL)
     {
-      ApuCtrlNew = ApuEventQueue[event].data;
+      ApuCtrlNew = ApuRenderEvents[event].data;
 
-      if (!(ApuEventQueue[event].data & (1 << 3)))
+      if (!(ApuRenderEvents[event].data & (1 << 3)))
       {
         ApuC4Atl = 0;
       }
@@ -836,10 +856,8 @@ int __not_in_flash_func(ApuWriteWave4)(int cycles, int event)
 /* Rendering noise channel #4                                        */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave4)(int n)
+static void __not_in_flash_func(ApuRenderSpan4)(BYTE *wave, int n)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave4(ApuCyclesPerSample * (n + 1), 0);
 
   if ((ApuCtrlNew & 0x08) && ApuC4Atl)
   {
@@ -860,78 +878,98 @@ void __not_in_flash_func(ApuRenderingWave4)(int n)
       {
         if (ApuC4Env)
         {
-          wave_buffers[3][i] = ApuC4Vol;
+          wave[i] = ApuC4Vol;
         }
         else
         {
-          wave_buffers[3][i] = ApuC4EnvVol;
+          wave[i] = ApuC4EnvVol;
         }
       }
       else
       {
-        wave_buffers[3][i] = 0;
+        wave[i] = 0;
       }
     }
   }
   else
   {
-    memset(wave_buffers[3], 0, n << 1);
+    memset(wave, 0, n);
   }
 }
 
 /*===================================================================*/
 /*                                                                   */
-/*      ApuRenderingWave5() : Rendering DPCM channel #5              */
+/*      ApuRenderSpan5() : Rendering DPCM channel #5                 */
 /*                                                                   */
 /*===================================================================*/
 
+/*-------------------------------------------------------------------*/
+/* Play the next bit of the fetched byte, LSB first                  */
+/*-------------------------------------------------------------------*/
+
+static inline void ApuC5Step()
+{
+  if (ApuC5CurByte & (1 << (8 - ApuC5Bits)))
+  {
+    // positive delta
+    if (ApuC5DpcmValue < 0x3F)
+      ApuC5DpcmValue += 1;
+  }
+  else
+  {
+    // negative delta
+    if (ApuC5DpcmValue > 1)
+      ApuC5DpcmValue -= 1;
+  }
+  ApuC5Bits--;
+}
+
 /*-------------------------------------------------------------------*/
 /* Write registers of DPCM channel #5                               */
 /*-------------------------------------------------------------------*/
 
-int __not_in_flash_func(ApuWriteWave5)(int cycles, int event)
+int __not_in_flash_func(ApuWriteWave5)(int sample, int event)
 {
   /* APU Reg Write Event */
-  while ((event < cur_event) && (ApuEventQueue[event].time < cycles))
+  while ((event < ApuRenderEventCount) && (ApuEventSample[event] <= sample))
   {
-    if ((ApuEventQueue[event].type & APUET_MASK) == APUET_C5)
+    if ((ApuRenderEvents[event].type & APUET_MASK) == APUET_C5)
     {
-      ApuC5Reg[ApuEventQueue[event].type & 3] = ApuEventQueue[event].data;
+      ApuC5Reg[ApuRenderEvents[event].type & 3] = ApuRenderEvents[event].data;
 
-      switch (ApuEventQueue[event].type & 3)
+      switch (ApuRenderEvents[event].type & 3)
       {
       case 0:
-        ApuC5Freq = ApuDpcmCycles[(ApuEventQueue[event].data & 0x0F)] << 16;
-        ApuC5Looping = ApuEventQueue[event].data & 0x40;
+        ApuC5Freq = ApuDpcmCycles[(ApuRenderEvents[event].data & 0x0F)] << 16;
         break;
       case 1:
-        ApuC5DpcmValue = (ApuEventQueue[event].data & 0x7F) >> 1;
-        break;
-      case 2:
-        ApuC5CacheAddr = 0xC000 + (WORD)(ApuEventQueue[event].data << 6);
-        break;
-      case 3:
-        ApuC5CacheDmaLength = ((ApuEventQueue[event].data << 4) + 1) << 3;
+        ApuC5DpcmValue = (ApuRenderEvents[event].data & 0x7F) >> 1;
         break;
       }
     }
-    else if (ApuEventQueue[event].type == APUET_W_CTRL)
+    else if (ApuRenderEvents[event].type == APUET_C5_FETCH)
     {
-      ApuCtrlNew = ApuEventQueue[event].data;
+      /* Bits the sample rate rounding left over are played at once */
+      while (ApuC5Bits)
+      {
+        ApuC5Step();
+      }
+      ApuC5CurByte = ApuRenderEvents[event].data;
+      ApuC5Bits = 8;
+      ApuC5Phaseacc = ApuC5Freq;
+    }
+    else if (ApuRenderEvents[event].type == APUET_W_CTRL)
+    {
+      ApuCtrlNew = ApuRenderEvents[event].data;
 
-      if (!(ApuEventQueue[event].data & (1 << 4)))
+      if (!(ApuRenderEvents[event].data & (1 << 4)))
       {
         ApuC5Enable = 0;
-        ApuC5DmaLength = 0;
+        ApuC5Bits = 0;
       }
       else
       {
         ApuC5Enable = 0xFF;
-        if (!ApuC5DmaLength)
-        {
-          ApuC5Address = ApuC5CacheAddr;
-          ApuC5DmaLength = ApuC5CacheDmaLength;
-        }
       }
     }
     event++;
@@ -943,67 +981,347 @@ int __not_in_flash_func(ApuWriteWave5)(int cycles, int event)
 /* Rendering DPCM channel #5                                         */
 /*-------------------------------------------------------------------*/
 
-void __not_in_flash_func(ApuRenderingWave5)(int n)
+static void __not_in_flash_func(ApuRenderSpan5)(BYTE *wave, int n)
 {
-  ApuCtrlNew = ApuCtrl;
-  ApuWriteWave5(ApuCyclesPerSample * (n + 1), 0);
 
   if (ApuCtrlNew & 0x10)
   {
     for (unsigned int i = 0; i < n; i++)
     {
-      if (ApuC5DmaLength)
+      if (ApuC5Bits)
       {
         ApuC5Phaseacc -= ApuCycleRate;
 
-        while (ApuC5Phaseacc < 0)
+        while (ApuC5Phaseacc < 0 && ApuC5Bits)
         {
           ApuC5Phaseacc += ApuC5Freq;
-          if (!(ApuC5DmaLength & 7))
-          {
-            ApuC5CurByte = K6502_Read(ApuC5Address);
-            if (0xFFFF == ApuC5Address)
-              ApuC5Address = 0x8000;
-            else
-              ApuC5Address++;
-          }
-          if (!(--ApuC5DmaLength))
-          {
-            if (ApuC5Looping)
-            {
-              ApuC5Address = ApuC5CacheAddr;
-              ApuC5DmaLength = ApuC5CacheDmaLength;
-            }
-            else
-            {
-              ApuC5Enable = 0;
-              break;
-            }
-          }
-
-          // positive delta
-          if (ApuC5CurByte & (1 << ((ApuC5DmaLength & 7) ^ 7)))
-          {
-            if (ApuC5DpcmValue < 0x3F)
-              ApuC5DpcmValue += 1;
-          }
-          else
-          {
-            // negative delta
-            if (ApuC5DpcmValue > 1)
-              ApuC5DpcmValue -= 1;
-          }
+          ApuC5Step();
         }
       }
 
       /* Wave Rendering */
-      wave_buffers[4][i] = ApuC5DpcmValue;
+      wave[i] = ApuC5DpcmValue << 1;
+    }
+  }
+  else
+  {
+    memset(wave, 0, n);
+  }
+}
+
+/*-------------------------------------------------------------------*/
+/*  DPCM fetch resources                                             */
+/*-------------------------------------------------------------------*/
+/* The sample bytes are read by the CPU side at the scanline that    */
+/* fetches them and queued as events. The renderer may run on core1  */
+/* a batch later, when the mapper has switched the bank away.        */
+static WORD ApuC5FetchAddr;
+static int ApuC5FetchLength; /* bytes left */
+static WORD ApuC5FetchClock; /* getPassedClocks() of the next fetch */
+
+static void __not_in_flash_func(ApuC5Fetch)(WORD now)
+{
+  while (ApuC5FetchLength && (short)(ApuC5FetchClock - now) <= 0)
+  {
+    if (cur_event >= APU_EVENT_MAX)
+    {
+      ApuFlush(false);
+    }
+    /* A flush of a full queue moves entertime to the end of this line */
+    ApuEventQueue[cur_event].time = std::max<short>(ApuC5FetchClock - entertime, 0);
+    ApuEventQueue[cur_event].type = APUET_C5_FETCH;
+    ApuEventQueue[cur_event].data = K6502_Read(ApuC5FetchAddr);
+    cur_event++;
+
+    ApuC5FetchAddr = (0xFFFF == ApuC5FetchAddr) ? 0x8000 : ApuC5FetchAddr + 1;
+    if (!--ApuC5FetchLength && (APU_Reg[0x10] & 0x40))
+    {
+      ApuC5FetchAddr = 0xC000 + (WORD)(APU_Reg[0x12] << 6);
+      ApuC5FetchLength = (APU_Reg[0x13] << 4) + 1;
+    }
+    /* One byte is 8 output bits */
+    ApuC5FetchClock += ApuDpcmCycles[APU_Reg[0x10] & 0x0F] << 3;
+  }
+}
+
+void ApuWriteControl(WORD addr, BYTE value)
+{
+  ApuWriteCtrlEvent(addr, value);
+
+  if (!(value & 0x10))
+  {
+    ApuC5FetchLength = 0;
+  }
+  else if (!ApuC5FetchLength)
+  {
+    /* $4010-$4013 are already in APU_Reg, $4015 is stored after this */
+    ApuC5FetchAddr = 0xC000 + (WORD)(APU_Reg[0x12] << 6);
+    ApuC5FetchLength = (APU_Reg[0x13] << 4) + 1;
+    ApuC5FetchClock = getPassedClocks();
+  }
+}
+
+/*-------------------------------------------------------------------*/
+/*  $4015 status resources                                           */
+/*-------------------------------------------------------------------*/
+/* The length counters as the CPU sees them. They follow the same    */
+/* rules as the renderer's copies, but at the register writes and    */
+/* the Vsync of the CPU side, the renderer lags up to two batches.   */
+static BYTE ApuStatC1Atl;
+static BYTE ApuStatC2Atl;
+static BYTE ApuStatC3Atl;
+static DWORD ApuStatC3Llc;
+static bool ApuStatC3Reload;
+static BYTE ApuStatC4Atl;
+
+static void __not_in_flash_func(ApuStatusWrite)(BYTE type, BYTE data)
+{
+  /* APU_Reg holds the registers written before this one */
+  switch (type)
+  {
+  case APUET_W_C1C:
+    ApuStatC1Atl = ApuAtl[APU_Reg[0x03] >> 3];
+    break;
+  case APUET_W_C1D:
+    ApuStatC1Atl = ApuAtl[data >> 3];
+    break;
+  case APUET_W_C2C:
+    ApuStatC2Atl = ApuAtl[APU_Reg[0x07] >> 3];
+    break;
+  case APUET_W_C2D:
+    ApuStatC2Atl = ApuAtl[data >> 3];
+    break;
+  case APUET_W_C3D:
+    ApuStatC3Atl = ApuAtl[data >> 3];
+    ApuStatC3Reload = true;
+    break;
+  case APUET_W_C4C:
+    ApuStatC4Atl = ApuAtl[APU_Reg[0x0f] >> 3] << 1;
+    break;
+  case APUET_W_C4D:
+    ApuStatC4Atl = ApuAtl[data >> 3] << 1;
+    break;
+  case APUET_W_CTRL:
+    if (!(data & (1 << 0)))
+      ApuStatC1Atl = 0;
+    if (!(data & (1 << 1)))
+      ApuStatC2Atl = 0;
+    if (!(data & (1 << 2)))
+    {
+      ApuStatC3Atl = 0;
+      ApuStatC3Llc = 0;
     }
+    if (!(data & (1 << 3)))
+      ApuStatC4Atl = 0;
+    break;
+  }
+}
+
+/* The counter part of ApuVsyncUpdate */
+static void ApuStatusVsync()
+{
+  const bool c3_holdnote = APU_Reg[0x08] & 0x80;
+
+  if (ApuStatC1Atl)
+    ApuStatC1Atl--;
+  if (ApuStatC2Atl)
+    ApuStatC2Atl--;
+
+  if (ApuStatC3Reload)
+  {
+    ApuStatC3Llc = ((WORD)APU_Reg[0x08] & 0x7f) << 6;
+  }
+  else if (ApuStatC3Llc > 0)
+  {
+    ApuStatC3Llc = std::max<int>(0, (int)ApuStatC3Llc - 4 * 64);
+  }
+  if (!c3_holdnote)
+  {
+    ApuStatC3Reload = false;
+    if (ApuStatC3Atl > 0)
+      ApuStatC3Atl--;
+  }
+
+  if (ApuStatC4Atl && !(APU_Reg[0x0c] & 0x20))
+    ApuStatC4Atl--;
+}
+
+BYTE __not_in_flash_func(InfoNES_pAPUReadStatus)()
+{
+  BYTE status = 0;
+  if (ApuStatC1Atl > 0)
+    status |= (1 << 0);
+  if (ApuStatC2Atl > 0)
+    status |= (1 << 1);
+  if (!(APU_Reg[0x08] & 0x80))
+  {
+    if (ApuStatC3Atl > 0)
+      status |= (1 << 2);
   }
   else
   {
-    memset(wave_buffers[4], 0, n << 1);
+    if (ApuStatC3Llc > 0)
+      status |= (1 << 2);
   }
+  if (ApuStatC4Atl > 0)
+    status |= (1 << 3);
+  return status;
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*      ApuRenderBatch() : Render a channel over a whole batch       */
+/*                                                                   */
+/*===================================================================*/
+/*-------------------------------------------------------------------*/
+/* The batch is cut into spans at the register writes queued for the */
+/* channel, each span is rendered with constant register values.     */
+/*-------------------------------------------------------------------*/
+typedef int (*ApuWriteWaveFunc)(int sample, int event);
+typedef void (*ApuRenderSpanFunc)(BYTE *wave, int n);
+
+static void __not_in_flash_func(ApuRenderBatch)(ApuWriteWaveFunc write, ApuRenderSpanFunc render, BYTE *wave, int n)
+{
+  ApuCtrlNew = ApuCtrl;
+  int event = 0;
+  int i = 0;
+  while (i < n)
+  {
+    event = write(i, event);
+    int end = event < ApuRenderEventCount ? std::min<int>(n, ApuEventSample[event]) : n;
+    render(wave + i, end - i);
+    i = end;
+  }
+  /* Writes at the very end of the batch */
+  write(n, event);
+}
+
+/*-------------------------------------------------------------------*/
+/* Render the samples of all lines since the last flush and send     */
+/* them to the output. The event queue starts over afterwards.       */
+/*-------------------------------------------------------------------*/
+static unsigned int ApuBatchSamples = 0;
+static unsigned int ApuBatchLines = 0;
+static bool ApuEnabled = true;
+static WORD ApuLineTime;
+
+static void __not_in_flash_func(ApuRenderJob)(const struct ApuEvent_t *events, int count,
+                                              unsigned int samples, bool enabled, bool vsync)
+{
+#if ENABLE_SOUND && ENABLE_AUDIO_TELEMETRY
+  uint32_t telemetry = audio_telemetry_start();
+#endif
+  int n = std::min<int>(samples, APU_WAVE_BUFFER_SIZE);
+  n = std::min<int>(InfoNES_GetSoundBufferSize(), n);
+
+  ApuRenderEvents = events;
+  ApuRenderEventCount = count;
+
+  if (enabled)
+  {
+    for (int event = 0; event < count; event++)
+    {
+      unsigned int at = ((WORD)events[event].time * ApuSamplesPerCycle16) >> 16;
+      ApuEventSample[event] = std::min<int>(at, n);
+    }
+
+    ApuRenderBatch(ApuWriteWave1, ApuRenderSpan1, wave_buffers[0], n);
+    ApuRenderBatch(ApuWriteWave2, ApuRenderSpan2, wave_buffers[1], n);
+    ApuRenderBatch(ApuWriteWave3, ApuRenderSpan3, wave_buffers[2], n);
+    ApuRenderBatch(ApuWriteWave4, ApuRenderSpan4, wave_buffers[3], n);
+    ApuRenderBatch(ApuWriteWave5, ApuRenderSpan5, wave_buffers[4], n);
+    ApuCtrl = ApuCtrlNew;
+  }
+  else
+  {
+    memset(&wave_buffers[0][0], 0, n);
+    memset(&wave_buffers[1][0], 0, n);
+    memset(&wave_buffers[2][0], 0, n);
+    memset(&wave_buffers[3][0], 0, n);
+    memset(&wave_buffers[4][0], 0, n);
+  }
+
+  if (n > 0)
+  {
+    InfoNES_SoundOutput(n,
+                        wave_buffers[0], wave_buffers[1], wave_buffers[2],
+                        wave_buffers[3], wave_buffers[4]);
+  }
+#if ENABLE_SOUND && ENABLE_AUDIO_TELEMETRY
+  audio_telemetry_stop(&audio_telemetry.synth_us, telemetry);
+#endif
+
+  /* Lines so far are rendered with the envelopes of the ending frame */
+  if (vsync)
+  {
+    ApuVsyncUpdate();
+  }
+}
+
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+/*-------------------------------------------------------------------*/
+/* Batches handed to core1. Two slots: core0 fills one while core1   */
+/* renders the other, and waits when both are queued, so the sound   */
+/* never lags more than two batches behind the emulation.            */
+/*-------------------------------------------------------------------*/
+#define APU_JOB_SLOTS 2
+
+struct ApuJob_t
+{
+  struct ApuEvent_t events[APU_EVENT_MAX];
+  int count;
+  unsigned int samples;
+  bool enabled;
+  bool vsync;
+};
+
+static struct ApuJob_t ApuJobs[APU_JOB_SLOTS];
+static unsigned int ApuJobHead; /* written by core0 only */
+static unsigned int ApuJobTail; /* written by core1 only */
+
+static void ApuJobDrain()
+{
+  while (__atomic_load_n(&ApuJobTail, __ATOMIC_ACQUIRE) != ApuJobHead)
+    ;
+}
+
+bool __not_in_flash_func(InfoNES_pAPURunJob)()
+{
+  unsigned int tail = ApuJobTail;
+  if (tail == __atomic_load_n(&ApuJobHead, __ATOMIC_ACQUIRE))
+  {
+    return false;
+  }
+
+  struct ApuJob_t *job = &ApuJobs[tail % APU_JOB_SLOTS];
+  ApuRenderJob(job->events, job->count, job->samples, job->enabled, job->vsync);
+  __atomic_store_n(&ApuJobTail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+#endif
+
+static void __not_in_flash_func(ApuFlush)(bool vsync)
+{
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+  unsigned int head = ApuJobHead;
+  while (head - __atomic_load_n(&ApuJobTail, __ATOMIC_ACQUIRE) >= APU_JOB_SLOTS)
+    ;
+
+  struct ApuJob_t *job = &ApuJobs[head % APU_JOB_SLOTS];
+  memcpy(job->events, ApuEventQueue, cur_event * sizeof(struct ApuEvent_t));
+  job->count = cur_event;
+  job->samples = ApuBatchSamples;
+  job->enabled = ApuEnabled;
+  job->vsync = vsync;
+  __atomic_store_n(&ApuJobHead, head + 1, __ATOMIC_RELEASE);
+#else
+  ApuRenderJob(ApuEventQueue, cur_event, ApuBatchSamples, ApuEnabled, vsync);
+#endif
+
+  ApuBatchSamples = 0;
+  ApuBatchLines = 0;
+  entertime = ApuLineTime;
+  cur_event = 0;
 }
 
 /*===================================================================*/
@@ -1013,6 +1331,14 @@ void __not_in_flash_func(ApuRenderingWave5)(int n)
 /*===================================================================*/
 
 void InfoNES_pAPUVsync()
+{
+  ApuStatusVsync();
+  ApuFlush(true);
+}
+
+/* Length counters, envelopes and sweeps, run by the renderer after  */
+/* the last batch of the frame                                       */
+static void __not_in_flash_func(ApuVsyncUpdate)()
 {
   if (ApuC1Atl)
   {
@@ -1146,9 +1472,9 @@ void InfoNES_pAPUVsync()
   }
   // printf("C2: %02x %02x %02x %02x: %d %d\n", ApuC2a, ApuC2b, ApuC2c, ApuC2d, ApuC2Atl, ApuC2EnvVol);
   // printf("C4: %02x  %02x %02x: %d %d\n", ApuC4a, ApuC4c, ApuC4d, ApuC4Atl, ApuC4EnvVol);
-  // printf("C5: %02x %02x %02x %02x, lp%d, v%02x, %04x, %d\n",
+  // printf("C5: %02x %02x %02x %02x, b%d, v%02x, %04x, %d\n",
   //        ApuC5Reg[0], ApuC5Reg[1], ApuC5Reg[2], ApuC5Reg[3],
-  //        ApuC5Looping, ApuC5DpcmValue, ApuC5Address, ApuC5DmaLength);
+  //        ApuC5Bits, ApuC5DpcmValue, ApuC5FetchAddr, ApuC5FetchLength);
 }
 
 /*===================================================================*/
@@ -1158,40 +1484,86 @@ void InfoNES_pAPUVsync()
 /*===================================================================*/
 
 uint32_t leftSamples16 = 0;
-
 void __not_in_flash_func(InfoNES_pAPUHsync)(bool enabled)
 {
+#if ENABLE_SOUND && ENABLE_AUDIO_TELEMETRY
+  uint32_t telemetry = audio_telemetry_start();
+#endif
   auto n16 = ApuSamplesPerSync16 + leftSamples16;
   auto n = n16 >> 16;
   leftSamples16 = n16 - (n << 16);
 
-  int bufferLeft = InfoNES_GetSoundBufferSize();
-  n = std::min<int>(bufferLeft, n);
+  ApuBatchSamples += n;
+  ApuEnabled = enabled;
+  ApuLineTime = getPassedClocks();
+  ApuC5Fetch(ApuLineTime);
 
-  if (enabled)
+  if (++ApuBatchLines >= APU_BATCH_LINES)
   {
-    ApuRenderingWave1(n);
-    ApuRenderingWave2(n);
-    ApuRenderingWave3(n);
-    ApuRenderingWave4(n);
-    ApuRenderingWave5(n);
-    ApuCtrl = ApuCtrlNew;
+    ApuFlush(false);
   }
-  else
+#if ENABLE_SOUND && ENABLE_AUDIO_TELEMETRY
+  audio_telemetry_stop(&audio_telemetry.hsync_us, telemetry);
+#endif
+}
+
+/*===================================================================*/
+/*                                                                   */
+/*       InfoNES_pAPUSetSampleRate() : Change the output rate        */
+/*                                                                   */
+/*===================================================================*/
+
+static void ApuApplyQuality()
+{
+  ApuPulseMagic = ApuQual[ApuQuality].pulse_magic;
+  ApuTriangleMagic = ApuQual[ApuQuality].triangle_magic;
+  ApuNoiseMagic = ApuQual[ApuQuality].noise_magic;
+  ApuSamplesPerSync16 = ApuQual[ApuQuality].samples_per_sync_16;
+  ApuSamplesPerCycle16 = (unsigned int)((1ull << 32) / ApuQual[ApuQuality].cycle_rate);
+  ApuCyclesPerSample = ApuQual[ApuQuality].cycles_per_sample;
+  ApuSampleRate = ApuQual[ApuQuality].sample_rate;
+  ApuCycleRate = ApuQual[ApuQuality].cycle_rate;
+}
+
+/*-------------------------------------------------------------------*/
+/* Called between frames. Lines queued so far are rendered at the    */
+/* old rate, the running notes are rescaled to keep their pitch.     */
+/*-------------------------------------------------------------------*/
+void InfoNES_pAPUSetSampleRate(unsigned int rate)
+{
+  int quality = pAPU_QUALITY - 1;
+  for (int i = 0; i < (int)(sizeof(ApuQual) / sizeof(ApuQual[0])); i++)
   {
-    memset(&wave_buffers[0][0], 0, n);
-    memset(&wave_buffers[1][0], 0, n);
-    memset(&wave_buffers[2][0], 0, n);
-    memset(&wave_buffers[3][0], 0, n);
-    memset(&wave_buffers[4][0], 0, n);
+    if (ApuQual[i].sample_rate == rate)
+    {
+      quality = i;
+    }
+  }
+  if (quality == ApuQuality)
+  {
+    return;
   }
 
-  InfoNES_SoundOutput(n,
-                      wave_buffers[0], wave_buffers[1], wave_buffers[2],
-                      wave_buffers[3], wave_buffers[4]);
+  ApuFlush(false);
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+  ApuJobDrain();
+#endif
 
-  entertime = getPassedClocks();
-  cur_event = 0;
+  DWORD pulse = ApuPulseMagic;
+  DWORD triangle = ApuTriangleMagic;
+  DWORD noise = ApuNoiseMagic;
+
+  ApuQuality = quality;
+  ApuApplyQuality();
+
+  /* Before InfoNES_pAPUInit there is nothing to rescale */
+  if (pulse && triangle && noise)
+  {
+    ApuC1Skip = (DWORD)((uint64_t)ApuC1Skip * ApuPulseMagic / pulse);
+    ApuC2Skip = (DWORD)((uint64_t)ApuC2Skip * ApuPulseMagic / pulse);
+    ApuC3Skip = (DWORD)((uint64_t)ApuC3Skip * ApuTriangleMagic / triangle);
+    ApuC4Skip = (DWORD)((uint64_t)ApuC4Skip * ApuNoiseMagic / noise);
+  }
 }
 
 /*===================================================================*/
@@ -1202,18 +1574,16 @@ void __not_in_flash_func(InfoNES_pAPUHsync)(bool enabled)
 
 void InfoNES_pAPUInit(void)
 {
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+  /* core1 must be done with the previous state before it is reset */
+  ApuJobDrain();
+#endif
+
   /* Sound Hardware Init */
   InfoNES_SoundInit();
 
-  ApuQuality = pAPU_QUALITY - 1; // 1: 22050, 2: 44100 [samples/sec]
-
-  ApuPulseMagic = ApuQual[ApuQuality].pulse_magic;
-  ApuTriangleMagic = ApuQual[ApuQuality].triangle_magic;
-  ApuNoiseMagic = ApuQual[ApuQuality].noise_magic;
-  ApuSamplesPerSync16 = ApuQual[ApuQuality].samples_per_sync_16;
-  ApuCyclesPerSample = ApuQual[ApuQuality].cycles_per_sample;
-  ApuSampleRate = ApuQual[ApuQuality].sample_rate;
-  ApuCycleRate = ApuQual[ApuQuality].cycle_rate;
+  /* ApuQuality keeps the rate selected by InfoNES_pAPUSetSampleRate */
+  ApuApplyQuality();
 
   InfoNES_SoundOpen((ApuSamplesPerSync16 + 65535) >> 16, ApuSampleRate);
 
@@ -1251,21 +1621,46 @@ void InfoNES_pAPUInit(void)
   /*   Initialize DPCM's Regs                                          */
   /*-------------------------------------------------------------------*/
   ApuC5Reg[0] = ApuC5Reg[1] = ApuC5Reg[2] = ApuC5Reg[3] = 0;
-  ApuC5Enable = ApuC5Looping = ApuC5CurByte = ApuC5DpcmValue = 0;
-  ApuC5Freq = ApuC5Phaseacc;
-  ApuC5Address = ApuC5CacheAddr = 0;
-  ApuC5DmaLength = ApuC5CacheDmaLength = 0;
+  ApuC5Enable = ApuC5CurByte = ApuC5Bits = ApuC5DpcmValue = 0;
+  ApuC5Freq = ApuDpcmCycles[0] << 16;
+  ApuC5Phaseacc = 0;
+  ApuC5FetchAddr = 0;
+  ApuC5FetchLength = 0;
+
+  ApuStatC1Atl = ApuStatC2Atl = ApuStatC3Atl = ApuStatC4Atl = 0;
+  ApuStatC3Llc = 0;
+  ApuStatC3Reload = false;
 
   /*-------------------------------------------------------------------*/
   /*   Initialize Wave Buffers                                         */
   /*-------------------------------------------------------------------*/
-  InfoNES_MemorySet((void *)wave_buffers[0], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[1], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[2], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[3], 0, 735);
-  InfoNES_MemorySet((void *)wave_buffers[4], 0, 735);
+  InfoNES_MemorySet((void *)wave_buffers[0], 0, APU_WAVE_BUFFER_SIZE);
+  InfoNES_MemorySet((void *)wave_buffers[1], 0, APU_WAVE_BUFFER_SIZE);
+  InfoNES_MemorySet((void *)wave_buffers[2], 0, APU_WAVE_BUFFER_SIZE);
+  InfoNES_MemorySet((void *)wave_buffers[3], 0, APU_WAVE_BUFFER_SIZE);
+  InfoNES_MemorySet((void *)wave_buffers[4], 0, APU_WAVE_BUFFER_SIZE);
+
+
+  /*-------------------------------------------------------------------*/
+  /*   Nonlinear mixer tables, scaled to 32000 at all channels maximum */
+  /*-------------------------------------------------------------------*/
+  const float mix_max = 95.52f / (8128.0f / 30 + 100) + 163.67f / (24329.0f / 202 + 100);
+  const float scale = 32000.0f / mix_max;
+  ApuPulseTable[0] = 0;
+  for (int i = 1; i < 31; i++)
+  {
+    ApuPulseTable[i] = (short)(scale * 95.52f / (8128.0f / i + 100) + 0.5f);
+  }
+  ApuTndTable[0] = 0;
+  for (int i = 1; i < 203; i++)
+  {
+    ApuTndTable[i] = (short)(scale * 163.67f / (24329.0f / i + 100) + 0.5f);
+  }
 
-  entertime = getPassedClocks();
+  ApuBatchSamples = 0;
+  ApuBatchLines = 0;
+  ApuLineTime = getPassedClocks();
+  entertime = ApuLineTime;
   cur_event = 0;
 }
 
@@ -101,7 +101,11 @@
 /*-------------------------------------------------------------------*/
 
 //#define APU_EVENT_MAX 15000
-#define APU_EVENT_MAX 100
+#define APU_EVENT_MAX 512
+
+/* Scanlines rendered per batch, a full queue and Vsync flush earlier */
+#define APU_BATCH_LINES 64
+#define APU_WAVE_BUFFER_SIZE 735
 
 struct ApuEvent_t
 {
@@ -136,6 +140,7 @@ struct ApuEvent_t
 #define APUET_W_C5B 0x11
 #define APUET_W_C5C 0x12
 #define APUET_W_C5D 0x13
+#define APUET_C5_FETCH 0x14 /* sample byte read by the CPU side */
 #define APUET_W_CTRL 0x20
 #define APUET_SYNC 0x40
 
@@ -155,6 +160,17 @@ void InfoNES_pAPUInit(void);
 void InfoNES_pAPUDone(void);
 void InfoNES_pAPUVsync(void);
 void InfoNES_pAPUHsync(bool enabled);
+void InfoNES_pAPUSetSampleRate(unsigned int rate);
+/* $4015 length counter bits as of the current CPU cycle */
+BYTE InfoNES_pAPUReadStatus(void);
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+/* Render one queued batch on core1, false when there is none */
+bool InfoNES_pAPURunJob(void);
+#endif
+
+/* Nonlinear mixer lookup tables, built by InfoNES_pAPUInit */
+extern short ApuPulseTable[31];
+extern short ApuTndTable[203];
 
 /*-------------------------------------------------------------------*/
 /*  pAPU Quality resources                                           */
@@ -164,39 +180,14 @@ void InfoNES_pAPUHsync(bool enabled);
 /* ApuQuality is used to control the sound playback rate.            */
 /* 1 is 11015 Hz.                                                    */
 /* 2 is 22050 Hz.                                                    */
-/* 3 is 44100 Hz.                                                    */
+/* 3 is 32000 Hz.                                                    */
+/* 4 is 44100 Hz.                                                    */
 /* these values subject to change without notice.                    */
 /*-------------------------------------------------------------------*/
 extern int ApuQuality;
-#define pAPU_QUALITY 3 // 44,100 Hz
+#define pAPU_QUALITY 4 // 44,100 Hz
 #define SAMPLE_INTERVAL 22
 
-/*-------------------------------------------------------------------*/
-/*  Rectangle Wave #1 resources                                      */
-/*-------------------------------------------------------------------*/
-
-extern BYTE ApuC1Atl;
-
-/*-------------------------------------------------------------------*/
-/*  Rectangle Wave #2 resources                                      */
-/*-------------------------------------------------------------------*/
-
-extern BYTE ApuC2Atl;
-
-/*-------------------------------------------------------------------*/
-/*  Triangle Wave resources                                          */
-/*-------------------------------------------------------------------*/
-
-extern BYTE ApuC3a;
-extern BYTE ApuC3Atl;
-extern DWORD ApuC3Llc; /* Linear Length Counter */
-
-/*-------------------------------------------------------------------*/
-/*  Noise resources                                                  */
-/*-------------------------------------------------------------------*/
-
-extern BYTE ApuC4Atl;
-
 #endif /* InfoNES_PAPU_H_INCLUDED */
 
 /*
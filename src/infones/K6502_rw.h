@@ -125,23 +125,7 @@ static inline BYTE __not_in_flash_func(K6502_Read)(WORD wAddr)
     if (wAddr == 0x4015)
     {
       // APU control
-      byRet = APU_Reg[0x15];
-      if (ApuC1Atl > 0)
-        byRet |= (1 << 0);
-      if (ApuC2Atl > 0)
-        byRet |= (1 << 1);
-      if (!ApuC3Holdnote)
-      {
-        if (ApuC3Atl > 0)
-          byRet |= (1 << 2);
-      }
-      else
-      {
-        if (ApuC3Llc > 0)
-          byRet |= (1 << 2);
-      }
-      if (ApuC4Atl > 0)
-        byRet |= (1 << 3);
+      byRet = APU_Reg[0x15] | InfoNES_pAPUReadStatus();
 
       // FrameIRQ
       APU_Reg[0x15] &= ~0x40;
@@ -13,6 +13,9 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 #include "lcd_core.h"
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+#include "allservices.h"
+#endif
 TFT_eSPI tft = TFT_eSPI();
 
 uint_fast16_t max_lcd_width = LCD_WIDTH;
@@ -250,6 +253,15 @@ void core1_lcd_draw_line(const uint_fast8_t line) {
 void core1DispatchLoop() {
   union core_cmd cmd;
 
+#if ENABLE_SOUND && ENABLE_AUDIO_CORE1
+  // Synthesise audio while no LCD command is waiting
+  while (!multicore_fifo_rvalid()) {
+    if (!srv.soundService.runCore1Job()) {
+      tight_loop_contents();
+    }
+  }
+#endif
+
   // Handle commands coming from core0
   cmd.full = multicore_fifo_pop_blocking();
   switch (cmd.cmd) {
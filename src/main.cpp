@@ -27,11 +27,9 @@
 
 
 
-#if ENABLE_SDCARD
-#ifdef ENABLE_USB_STORAGE_DEVICE
+#if ENABLE_SDCARD && ENABLE_USB_STORAGE_DEVICE
 #include "msc.h"
 #endif
-#endif
 
 #include "allmenus.h"
 #include "allservices.h"
@@ -59,6 +57,9 @@ void reset(uint32_t sleepMs) {
 
   sleep_ms(sleepMs);
 
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+  srv.sdIoService.waitIdle();
+#endif
   rp2040.reboot();
 }
 
@@ -85,17 +86,18 @@ void setup() {
   // delay(2000);
   Serial.println("I Serial OK.");
 
-#if ENABLE_SDCARD
-#if ENABLE_USB_STORAGE_DEVICE
-  initUsbStorageDevice();
-#endif
-#endif
-  
   srv.initAll();
 
   //check select button press to dfu mode
   checkUpdate();
 
+#if ENABLE_SDCARD && ENABLE_USB_STORAGE_DEVICE
+  // hold start while powering on: copy ROMs over USB
+  if (srv.inputService.readJoypad(ButtonID::BTN_START) == 0) {
+    runUsbStorageDevice();
+  }
+#endif
+
 #if ENABLE_LCD
 #if ENABLE_SDCARD
   Serial.println("Starting ROM file selector ...");
@@ -25,8 +25,13 @@ void FileListMenu::setOnSelectKeyPressedCallback(std::function<void()> onSelectK
   _onSelectKeyPressedCallback = onSelectKeyPressedCallback;
 }
 
+void FileListMenu::setOnSearchCallback(std::function<int32_t(char*, int8_t)> onSearchCallback) {
+  _onSearchCallback = onSearchCallback;
+}
+
 void FileListMenu::openMenu() {
   menuActive = true;
+  _searching = false;
   _currentPage = 1;
   makeTitle();
   tft.fillScreen(TFT_BLACK);
@@ -42,16 +47,83 @@ void FileListMenu::onCloseMenu() {
   _onPrevPageCallback = nullptr;
   _afterFileSelectedCallback = nullptr;
   _onSelectKeyPressedCallback = nullptr;
+  _onSearchCallback = nullptr;
   Menu::onCloseMenu();
 }
 
 void FileListMenu::makeTitle() {
   char title_text[40];
-  snprintf(title_text, sizeof(title_text), "%sGAME PAGE %d  Press Select", _gameType == GameType_GB ? "GB " : "NES ", _currentPage);
+  if (_searching) {
+    snprintf(title_text, sizeof(title_text), "FIND: %s_  Press B", _searchPrefix);
+  } else {
+    snprintf(title_text, sizeof(title_text), "%sGAME PAGE %d  Press Select", _gameType == GameType_GB ? "GB " : "NES ", _currentPage);
+  }
   setTitle(title_text);
 }
 
+bool FileListMenu::search(int8_t step) {
+  int32_t pos = _onSearchCallback(_searchPrefix, step);
+  if (pos < 0) {
+    return false;
+  }
+  _currentPage = pos / FILES_PER_PAGE + 1;
+  currentMenuSelection = pos % FILES_PER_PAGE;
+  makeTitle();
+  drawMenuBackground();
+  drawMenuItems();
+  return true;
+}
+
+/**
+ * Start: search by name prefix, the list follows every key press.
+ * Up/Down: previous/next character some ROM continues the prefix with, on the
+ * first character this jumps from letter to letter.
+ * Right: take the next character of the selected name. Left: drop one.
+ * B or Start leaves the search at the selected ROM, A starts it.
+ */
+bool FileListMenu::onSearchKeyDown() {
+  const uint8_t length = strlen(_searchPrefix);
+  if (PRESSED_KEY(ButtonID::BTN_UP) || PRESSED_KEY(ButtonID::BTN_DOWN)) {
+    search(PRESSED_KEY(ButtonID::BTN_UP) ? -1 : 1);
+  }
+  if (PRESSED_KEY(ButtonID::BTN_RIGHT)) {
+    const char* selected = getSelectedText();
+    if (length < ROM_SEARCH_MAX_PREFIX && selected != nullptr && selected[length] != 0) {
+      _searchPrefix[length] = tolower((uint8_t)selected[length]);
+      _searchPrefix[length + 1] = 0;
+      search(0);
+    }
+  }
+  if (PRESSED_KEY(ButtonID::BTN_LEFT)) {
+    if (length > 1) {
+      _searchPrefix[length - 1] = 0;
+      search(0);
+    }
+  }
+  if (PRESSED_KEY(ButtonID::BTN_B) || PRESSED_KEY(ButtonID::BTN_START)) {
+    _searching = false;
+    makeTitle();
+    drawMenuBackground();
+    drawMenuItems();
+  }
+  return false;
+}
+
 bool FileListMenu::onKeyDown() {
+  if (_searching && !PRESSED_KEY(ButtonID::BTN_A)) {
+    return onSearchKeyDown();
+  }
+  if (PRESSED_KEY(ButtonID::BTN_START) && _onSearchCallback && getSelectedText() != nullptr) {
+    // 从当前选中的首字母开始
+    _searchPrefix[0] = tolower((uint8_t)getSelectedText()[0]);
+    _searchPrefix[1] = 0;
+    _searching = true;
+    if (search(0)) {
+      return false;
+    }
+    // no name index, e.g. not enough RAM
+    _searching = false;
+  }
   if (PRESSED_KEY(ButtonID::BTN_SELECT)) {
     if (_onSelectKeyPressedCallback) {
       _onSelectKeyPressedCallback();
@@ -97,6 +169,12 @@ bool FileListMenu::onKeyDown() {
     }
   }
   if (PRESSED_KEY(ButtonID::BTN_A) || PRESSED_KEY(ButtonID::BTN_B)) {
+    if (isItemDisabled(currentMenuSelection)) {
+      // 索引里记录的头信息表明这个 ROM 不能运行
+      Serial.printf("I %s is not supported\r\n", getSelectedText());
+      return false;
+    }
+    _searching = false;
     if (_afterFileSelectedCallback) {
       _afterFileSelectedCallback();
     }
@@ -10,6 +10,11 @@ public:
   void setOnPrevPageCallback(std::function<bool()> onPrevPageCallback);
   void setAfterFileSelectedCallback(std::function<void()> afterFileSelectedCallback);
   void setOnSelectKeyPressedCallback(std::function<void()> onSelectKeyPressedCallback);
+  /**
+   * search(prefix, step): step the last character of prefix (-1/+1, 0 keeps it),
+   * show the page of the first match and return its position, -1 when nothing matches
+   */
+  void setOnSearchCallback(std::function<int32_t(char*, int8_t)> onSearchCallback);
   /**
    * true: break loop
    */
@@ -23,9 +28,14 @@ private:
   std::function<bool()> _onPrevPageCallback;
   std::function<void()> _afterFileSelectedCallback;
   std::function<void()> _onSelectKeyPressedCallback;
+  std::function<int32_t(char*, int8_t)> _onSearchCallback;
   void makeTitle();
+  bool onSearchKeyDown();
+  bool search(int8_t step);
 
 protected:
   uint8_t _currentPage = 1;
   GameType _gameType = GameType_GB;
+  bool _searching = false;
+  char _searchPrefix[ROM_SEARCH_MAX_PREFIX + 1] = {};
 };
\ No newline at end of file
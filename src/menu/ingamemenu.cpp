@@ -12,6 +12,7 @@ GameMenu::GameMenu() : Menu() {
 // 菜单项枚举
 enum MenuItem {
   MENU_VOLUME = 0,
+  MENU_SAMPLE_RATE,
   MENU_SAVE,
   MENU_LOAD,
   MENU_SAVERAM,
@@ -35,6 +36,13 @@ void GameMenu::setVolumeItem() {
   setTextAtIndex(vol_text, MENU_VOLUME);
 }
 
+// 显示采样率
+void GameMenu::setSampleRateItem() {
+  char rate_text[24];
+  snprintf(rate_text, sizeof(rate_text), " Sample Rate: %lu ", srv.soundService.getSampleRate());
+  setTextAtIndex(rate_text, MENU_SAMPLE_RATE);
+}
+
 // 应用配色方案
 void GameMenu::applyColorScheme() {
   if (_applyColorSchemeCallback) {
@@ -161,6 +169,10 @@ void GameMenu::restartGame() {
 
 // 系统重启（需要您实现具体逻辑）
 void GameMenu::rebootSystem() {
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+  // 排队中的存档先写完
+  srv.sdIoService.waitIdle();
+#endif
   rp2040.reboot();
 }
 
@@ -173,6 +185,7 @@ void GameMenu::openMenu() {
   menuActive = true;
   setTitle("IN GAME MENU");
   setVolumeItem();
+  setSampleRateItem();
   setTextAtIndex(" Save Realtime Game ", MENU_SAVE);
   setTextAtIndex(" Load Realtime Game ", MENU_LOAD);
   setTextAtIndex(" Save RAM ", MENU_SAVERAM);
@@ -203,6 +216,11 @@ bool GameMenu::onKeyDown() {
       setVolumeItem();
       drawMenuItem(_lines[MENU_VOLUME], MENU_VOLUME);
     }
+    if (currentMenuSelection == MENU_SAMPLE_RATE) {
+      srv.soundService.prevSampleRate();
+      setSampleRateItem();
+      drawMenuItem(_lines[MENU_SAMPLE_RATE], MENU_SAMPLE_RATE);
+    }
   }
   if (PRESSED_KEY(ButtonID::BTN_RIGHT)) {
     if (currentMenuSelection == MENU_VOLUME) {
@@ -210,6 +228,11 @@ bool GameMenu::onKeyDown() {
       setVolumeItem();
       drawMenuItem(_lines[MENU_VOLUME], MENU_VOLUME);
     }
+    if (currentMenuSelection == MENU_SAMPLE_RATE) {
+      srv.soundService.nextSampleRate();
+      setSampleRateItem();
+      drawMenuItem(_lines[MENU_SAMPLE_RATE], MENU_SAMPLE_RATE);
+    }
   }
   if (PRESSED_KEY(ButtonID::BTN_A)) {
     handleMenuSelection();
@@ -29,6 +29,7 @@ private:
   void loadRam();
   void restartGame();
   void setVolumeItem();
+  void setSampleRateItem();
   void returnToMainMenu();
   void rebootSystem();
 
@@ -103,8 +103,13 @@ void Menu::drawMenuItem(const char* text, uint8_t index) {
   bool selected = currentMenuSelection == index;
   uint16_t y_pos = _menuY + 30 + index * FONT_HEIGHT;
 
-  tft.setTextColor(selected ? TFT_BLACK : TFT_WHITE,
-      selected ? TFT_RED : TFT_DARKGREY, true);
+  if (isItemDisabled(index)) {
+    tft.setTextColor(selected ? TFT_BLACK : TFT_RED,
+        selected ? TFT_LIGHTGREY : TFT_DARKGREY, true);
+  } else {
+    tft.setTextColor(selected ? TFT_BLACK : TFT_WHITE,
+        selected ? TFT_RED : TFT_DARKGREY, true);
+  }
   tft.drawString(text, _menuX + 10, y_pos, FONT_ID);
 }
 
@@ -112,8 +117,20 @@ void Menu::setMenuCount(uint8_t count) {
   _menuCount = count;
 }
 
+void Menu::setItemDisabled(uint8_t index, bool disabled) {
+  if (index >= sizeof(_disabledMask) * 8) {
+    return;
+  }
+  if (disabled) {
+    _disabledMask |= 1 << index;
+  } else {
+    _disabledMask &= ~(1 << index);
+  }
+}
+
 void Menu::clearMenu() {
   _menuCount = 0;
+  _disabledMask = 0;
 }
 
 void Menu::drawMenuBackground() {
@@ -17,6 +17,9 @@ public:
   void setTextAtIndex(const char* text, uint8_t index);
   void drawMenuItem(const char* text, uint8_t index);
   void setMenuCount(uint8_t count);
+  // disabled items are drawn greyed out and cannot be chosen
+  void setItemDisabled(uint8_t index, bool disabled);
+  bool isItemDisabled(uint8_t index) const { return (_disabledMask >> index) & 1; }
   void clearMenu();
   uint8_t getMenuCount() const { return _menuCount; };
   void drawMenuItems();
@@ -25,6 +28,8 @@ public:
    */
   virtual bool onKeyDown();
   virtual void openMenu();
+  // leave the input loop of an open menu from outside a key handler
+  void closeMenu() { _shouldBreakLoopInput = true; }
   virtual void handleMenuSelection();
   virtual void drawMenuBackground();
   virtual void onCloseMenu();
@@ -49,4 +54,5 @@ protected:
   uint8_t _menuCount = 0;
   char* _title;
   char* _lines[14];
+  uint16_t _disabledMask = 0;
 };
\ No newline at end of file
@@ -1,43 +1,236 @@
-#if ENABLE_USB_STORAGE_DEVICE
+#if ENABLE_SDCARD && ENABLE_USB_STORAGE_DEVICE
 
 #include <Adafruit_TinyUSB.h>
 
-#include "card_loader.h"
+#include "allservices.h"
+#include "msc.h"
+
+#define MSC_SECTOR_SIZE 512
+// 写入合并和顺序预读共用的缓存, 内存不够时减半
+#define MSC_CACHE_SECTORS 64
+#define MSC_CACHE_MIN_SECTORS 8
+#define MSC_REPORT_INTERVAL_MS 1000
 
 static Adafruit_USBD_MSC usb_msc;
 
+/**
+ * TinyUSB hands over one endpoint buffer per callback, a few hundred bytes.
+ * Passing each on to the card costs a full command and busy wait per
+ * sector, so the callbacks go through one RAM cache of whole sectors:
+ * consecutive writes collect in it and reach the card as one multi-sector
+ * write, a sequential read fills it with the sectors that follow.
+ * The cache is written back when a WRITE10 completed. TinyUSB reports that
+ * after the status went to the host, so a failed write-back is latched and
+ * the next READ10/WRITE10 fails with a MEDIUM ERROR / write error sense.
+ */
+static struct {
+  SdCard* card;
+  uint8_t* buf;
+  uint32_t sectors;     // capacity
+  uint32_t lba;         // first sector held
+  uint32_t count;       // sectors held
+  bool dirty;           // held sectors are writes not on the card yet
+  uint32_t nextRead;    // sector after the last read, detects sequential reads
+  uint32_t cardSectors;
+  bool writeFailed;     // a write-back after the status failed, not reported yet
+  volatile uint32_t bytesRead;
+  volatile uint32_t bytesWritten;
+  volatile bool ejected;
+} msc;
+
+static bool msc_cache_flush() {
+  bool ok = true;
+  if (msc.dirty && msc.count > 0) {
+    ok = msc.card->writeSectors(msc.lba, msc.buf, msc.count);
+  }
+  msc.dirty = false;
+  msc.count = 0;
+  return ok;
+}
+
+// fail the command with the latched write-back error, once
+static bool msc_report_write_error() {
+  if (!msc.writeFailed) {
+    return false;
+  }
+  msc.writeFailed = false;
+  tud_msc_set_sense(0, SCSI_SENSE_MEDIUM_ERROR, 0x0C, 0x00);
+  return true;
+}
+
+// write back after the host already got the status of the WRITE10
+static void msc_write_back() {
+  if (!msc_cache_flush() || !msc.card->syncDevice()) {
+    Serial.printf("E USB storage: write back failed @ %lu\r\n", msc.lba);
+    msc.writeFailed = true;
+  }
+}
+
+static bool msc_cache_holds(uint32_t lba, uint32_t n) {
+  return msc.count > 0 && lba >= msc.lba && lba + n <= msc.lba + msc.count;
+}
+
 // Callback invoked when received READ10 command.
-static int32_t msc_read_cb (uint32_t lba, void* buffer, uint32_t bufsize) {
-  bool rc = sd.card()->readSectors(lba, (uint8_t*) buffer, bufsize/512);
-  return rc ? bufsize : -1;
+static int32_t msc_read_cb(uint32_t lba, void* buffer, uint32_t bufsize) {
+  const uint32_t n = bufsize / MSC_SECTOR_SIZE;
+  const bool sequential = lba == msc.nextRead;
+  msc.nextRead = lba + n;
+  msc.bytesRead += bufsize;
+  if (msc_report_write_error()) {
+    return -1;
+  }
+
+  if (msc_cache_holds(lba, n)) {
+    memcpy(buffer, msc.buf + (lba - msc.lba) * MSC_SECTOR_SIZE, bufsize);
+    return bufsize;
+  }
+  if (!msc_cache_flush()) {
+    return -1;
+  }
+  if (!sequential || n >= msc.sectors) {
+    // FAT 和目录这类零散读取不预读
+    return msc.card->readSectors(lba, (uint8_t*)buffer, n) ? bufsize : -1;
+  }
+
+  uint32_t ahead = min(msc.sectors, msc.cardSectors - lba);
+  if (!msc.card->readSectors(lba, msc.buf, ahead)) {
+    return -1;
+  }
+  msc.lba = lba;
+  msc.count = ahead;
+  memcpy(buffer, msc.buf, bufsize);
+  return bufsize;
 }
 
 // Callback invoked when received WRITE10 command.
-static int32_t msc_write_cb (uint32_t lba, uint8_t* buffer, uint32_t bufsize) {
-  bool rc = sd.card()->writeSectors(lba, buffer, bufsize/512);
-  return rc ? bufsize : -1;
+static int32_t msc_write_cb(uint32_t lba, uint8_t* buffer, uint32_t bufsize) {
+  const uint32_t n = bufsize / MSC_SECTOR_SIZE;
+  msc.bytesWritten += bufsize;
+  msc.nextRead = 0xFFFFFFFF;
+  if (msc_report_write_error()) {
+    return -1;
+  }
+
+  if (!msc.dirty) {
+    // read-ahead data may be stale after this write
+    msc.count = 0;
+  } else if (lba != msc.lba + msc.count || msc.count + n > msc.sectors) {
+    if (!msc_cache_flush()) {
+      return -1;
+    }
+  }
+  if (n > msc.sectors) {
+    return msc.card->writeSectors(lba, buffer, n) ? bufsize : -1;
+  }
+
+  if (msc.count == 0) {
+    msc.lba = lba;
+  }
+  memcpy(msc.buf + msc.count * MSC_SECTOR_SIZE, buffer, bufsize);
+  msc.count += n;
+  msc.dirty = true;
+  return bufsize;
 }
 
 // Callback invoked when WRITE10 command is completed (status received and accepted by host).
-static void msc_flush_cb (void) {
-  sd.card()->syncDevice();
+static void msc_flush_cb(void) {
+  msc_write_back();
 }
 
-void initUsbStorageDevice() {
-  usb_msc.setID("GB", "SD Card", "1.0");
+// Callback invoked on START STOP UNIT, the host ejects with load_eject and !start.
+static bool msc_start_stop_cb(uint8_t power_condition, bool start, bool load_eject) {
+  (void)power_condition;
+  if (load_eject && !start) {
+    msc_write_back();
+    if (msc_report_write_error()) {
+      return false;
+    }
+    msc.ejected = true;
+  }
+  return true;
+}
+
+static void drawStatus(const char* line1, const char* line2) {
+  tft.fillRect(0, ERROR_TEXT_OFFSET, DISPLAY_WIDTH, 2 * FONT_HEIGHT, TFT_BLACK);
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.drawString(line1, 0, ERROR_TEXT_OFFSET, FONT_ID);
+  tft.drawString(line2, 0, ERROR_TEXT_OFFSET + FONT_HEIGHT, FONT_ID);
+}
+
+/**
+ * Expose the SD card to the host until it ejects it or B is pressed, then
+ * reboot so the firmware mounts the changed volume again.
+ */
+void runUsbStorageDevice() {
+  msc.card = srv.cardService.card();
+  msc.cardSectors = msc.card->sectorCount();
+  for (msc.sectors = MSC_CACHE_SECTORS; msc.sectors >= MSC_CACHE_MIN_SECTORS; msc.sectors /= 2) {
+    msc.buf = (uint8_t*)malloc(msc.sectors * MSC_SECTOR_SIZE);
+    if (msc.buf != nullptr) {
+      break;
+    }
+  }
+  if (msc.buf == nullptr) {
+    error("USB storage: out of memory");
+  }
+  msc.nextRead = 0xFFFFFFFF;
+  Serial.printf("I USB storage: %lu sectors, %lu sector cache\r\n", msc.cardSectors, msc.sectors);
+
+  usb_msc.setID("Pico-GB", "SD Card", "1.0");
   usb_msc.setReadWriteCallback(msc_read_cb, msc_write_cb, msc_flush_cb);
-  usb_msc.setUnitReady(false);
+  usb_msc.setStartStopCallback(msc_start_stop_cb);
+  usb_msc.setCapacity(msc.cardSectors, MSC_SECTOR_SIZE);
+  usb_msc.setUnitReady(true);
   usb_msc.begin();
 
+  // 已经枚举过 (串口), 重新连接让主机看到新的接口
   if (TinyUSBDevice.mounted()) {
     TinyUSBDevice.detach();
     delay(10);
     TinyUSBDevice.attach();
   }
 
-  uint32_t block_count = sd.card()->sectorCount();
-  usb_msc.setCapacity(block_count, 512);
-  usb_msc.setUnitReady(true);
+  tft.fillScreen(TFT_BLACK);
+  tft.setTextColor(TFT_YELLOW, TFT_BLACK);
+  tft.drawString("USB STORAGE  Press B to leave", 0, 0, FONT_ID);
+  drawStatus("waiting for host", "");
+
+  uint32_t lastReport = millis();
+  uint32_t lastRead = 0;
+  uint32_t lastWritten = 0;
+  while (!msc.ejected && srv.inputService.readJoypad(ButtonID::BTN_B) != 0) {
+    uint32_t now = millis();
+    if (now - lastReport < MSC_REPORT_INTERVAL_MS) {
+      delay(10);
+      continue;
+    }
+    const uint32_t elapsed = now - lastReport;
+    const uint32_t readRate = (msc.bytesRead - lastRead) / elapsed;          // bytes/ms = KB/s
+    const uint32_t writeRate = (msc.bytesWritten - lastWritten) / elapsed;
+    lastReport = now;
+    lastRead = msc.bytesRead;
+    lastWritten = msc.bytesWritten;
+    if (readRate == 0 && writeRate == 0) {
+      continue;
+    }
+
+    char line1[40];
+    char line2[40];
+    snprintf(line1, sizeof(line1), "read  %5lu KB/s  %6lu KB", readRate, lastRead / 1024);
+    snprintf(line2, sizeof(line2), "write %5lu KB/s  %6lu KB", writeRate, lastWritten / 1024);
+    drawStatus(line1, line2);
+    Serial.printf("I USB storage: read %lu KB/s, write %lu KB/s\r\n", readRate, writeRate);
+  }
+
+  // the host gets "not ready" from now on, let a running command finish
+  usb_msc.setUnitReady(false);
+  delay(200);
+  // a WRITE10 cut short by B never completes
+  msc_write_back();
+  Serial.printf("I USB storage: %s, %lu KB read, %lu KB written\r\n", msc.ejected ? "ejected" : "left",
+      msc.bytesRead / 1024, msc.bytesWritten / 1024);
+  Serial.flush();
+  rp2040.reboot();
 }
 
 #endif
@@ -1,3 +1,4 @@
 #pragma once
 
-void initUsbStorageDevice();
+// 把 SD 卡作为 USB 大容量存储设备, 直到主机弹出或按 B, 然后重启
+void runUsbStorageDevice();
@@ -3,17 +3,13 @@
 #include "allservices.h"
 #include "hardware/divider.h"
 #include "lcd_core.h"
+#include "rompager.h"
 
 #include <hardware/vreg.h>
 static auto frame = 0;
 static uint32_t start_tick_us = 0;
 static uint32_t fps = 0;
 
-#define AUDIO_BUF_SIZE 2048
-static int16_t snd_buf[AUDIO_BUF_SIZE] = {0};
-int buf_residue_size = AUDIO_BUF_SIZE;
-volatile bool SoundOutputBuilding = true;
-
 // micomenu
 bool micromenu;
 
@@ -47,6 +43,9 @@ MemoryRegion nes_save_regions[] = {
   };
 
 void InfoNES_ReleaseRom() {
+#if ENABLE_NES_BANK_CACHE
+  nes_bank_cache_close();
+#endif
   ROM = nullptr;
   VROM = nullptr;
 }
@@ -62,50 +61,36 @@ void InfoNES_SoundClose() {
 }
 
 int InfoNES_GetSoundBufferSize() {
-  return buf_residue_size;
+#if ENABLE_SOUND
+  return audio_ring_free(srv.soundService.getRing());
+#else
+  return 0;
+#endif
 }
 
 /*
- *  call from InfoNES_pAPUHsync
+ *  call from the pAPU once per rendered batch
+ *  Producer: mix the five channels through the nonlinear tables and push them through the resampler
  */
 void __not_in_flash_func(InfoNES_SoundOutput)(int samples, BYTE* wave1, BYTE* wave2, BYTE* wave3, BYTE* wave4, BYTE* wave5) {
-  // Producer: write 8-bit mixed samples into circular buffer
-  static int test_i = 0;
-
-  SoundOutputBuilding = true;
-
-  while (samples) {
-    // auto &ring = dvi_->getAudioRingBuffer();
-    // auto n = std::min<int>(samples, ring.getWritableSize());
-    auto n = std::min<int>(samples, buf_residue_size);
-    // auto n = samples;
-    if (!n) {
-      return;
-    }
-    // auto p = ring.getWritePointer();
-    auto p = &snd_buf[AUDIO_BUF_SIZE - buf_residue_size];
-    // auto p = snd_buf;
-
-    int ct = n;
-    while (ct--) {
-      uint8_t w1 = *wave1++;
-      uint8_t w2 = *wave2++;
-      uint8_t w3 = *wave3++; // triangle
-      uint8_t w4 = *wave4++; // noise
-      uint8_t w5 = *wave5++; // DPCM
-      *p++ = (((w1 * 2 + w2 * 2) / 2) + w3 * 1 + w4 * 1 * 4 + w5 * 2 * 1) / 4;
+#if ENABLE_SOUND
+  static int16_t mixed[2 * 64];
+
+  while (samples > 0) {
+    int n = std::min<int>(samples, 64);
+    for (int i = 0; i < n; i++) {
+      // DAC levels: pulse/triangle/noise 0..15, DPCM 0..127
+      int16_t s = ApuPulseTable[*wave1++ + *wave2++] +
+                  ApuTndTable[3 * *wave3++ + 2 * *wave4++ + *wave5++];
+      mixed[2 * i] = s;
+      mixed[2 * i + 1] = s;
     }
-
-    // ring.advanceWritePointer(n);
+    srv.soundService.pushFrames(mixed, n);
     samples -= n;
-    buf_residue_size -= n;
-    // snd_buf should not be full, just for case
-    if (buf_residue_size <= 0)
-      buf_residue_size = AUDIO_BUF_SIZE;
   }
-  SoundOutputBuilding = false;
-  // if(samples)
+#endif
 }
+
 static void __not_in_flash_func(speed_control)(void) {
   static uint64_t last_blink = 0;
 
@@ -114,6 +99,12 @@ static void __not_in_flash_func(speed_control)(void) {
   uint64_t diff_time = cur_time - last_blink;
   // 1/60 = 16666 us
   while (last_blink + (16666) > cur_time) {
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+    srv.sdIoService.poll();
+#endif
+#if ENABLE_ROM_PAGING
+    nes_bank_cache_idle();
+#endif
     cur_time = time_us_64();
   }
 
@@ -121,10 +112,12 @@ static void __not_in_flash_func(speed_control)(void) {
 }
 
 int InfoNES_LoadFrame() {
-  // speed_control();
-  if (!SoundOutputBuilding) {
-    srv.soundService.handleSoundLoop();
-  }
+#if ENABLE_SOUND
+  // paced by the audio produced, the resampler keeps the latency constant
+  srv.soundService.paceFrame();
+#else
+  speed_control();
+#endif
   auto count = frame++;
 #ifdef LED_ENABLED
   auto onOff = hw_divider_s32_quotient_inlined(count, 60) & 1;
@@ -199,6 +192,29 @@ bool parseROM(const uint8_t* nesFile) {
 
   return true;
 }
+#if ENABLE_SDCARD
+/**
+ * ROM from a container: header, trainer and the PRG/CHR split come from the
+ * container header, the data in flash is only PRG followed by CHR.
+ */
+bool loadContainer(const uint8_t* romData, const rom_container_t* header) {
+  memcpy(&NesHeader, header->ines, sizeof(NesHeader));
+  if (!checkNESMagic(NesHeader.byID)) {
+    return false;
+  }
+
+  memset(SRAM, 0, SRAM_SIZE);
+  if (NesHeader.byInfo1 & 4) {
+    memcpy(&SRAM[0x1000], header->trainer, 512);
+  }
+
+  ROM = (BYTE*)romData;
+  if (header->chr_size > 0) {
+    VROM = (BYTE*)romData + header->prg_size;
+  }
+  return true;
+}
+#endif
 int InfoNES_Menu() {
   return 0;
 }
@@ -238,11 +254,14 @@ void NESInput::startEmulator() {
 #endif
 
 #if ENABLE_SOUND
-  // Initialize audio emulation
+  // pAPU pushes its samples into the I2S ring from InfoNES_SoundOutput, no pull callback
   Serial.println("Starting audio ...");
-  srv.soundService.setAudioCallback(std::bind(
-      &NESInput::nesAudioCallback, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3));
-
+  srv.soundService.setAudioCallback(nullptr);
+  srv.soundService.setSampleRateCallback(InfoNES_pAPUSetSampleRate);
+#if ENABLE_AUDIO_CORE1
+  // pAPU batches are rendered by core1 between LCD lines
+  srv.soundService.setCore1Job(InfoNES_pAPURunJob);
+#endif
 #endif
 
   Serial.printf("Start program\n");
@@ -300,10 +319,30 @@ void NESInput::loadAndReset() {
   romPtr = RS_rom;
 #endif
 
-  if (!parseROM(romPtr)) {
+  bool parsed;
+#if ENABLE_SDCARD
+  const rom_container_t* container = srv.cardService.loadedContainer();
+  if (container) {
+    parsed = loadContainer(romPtr, container);
+  } else
+#endif
+  {
+    parsed = parseROM(romPtr);
+  }
+  if (!parsed) {
     Serial.printf("NES file parse error.\n");
     Serial.flush();
   }
+#if ENABLE_NES_BANK_CACHE
+  nes_bank_cache_open(ROM, NesHeader.byVRomSize > 0 ? VROM : nullptr);
+#endif
+#if ENABLE_ROM_PAGING
+  // 只有 rom_pager.base 之前的部分在 flash 里, 其余的 bank 从 SD 读取
+  if (rom_pager.base != 0xFFFFFFFF &&
+      !nes_bank_cache_page(romPtr, rom_pager.base, NesHeader.byRomSize * 2, NesHeader.byVRomSize * 8)) {
+    error("ROM too large for the bank cache");
+  }
+#endif
 
   if (InfoNES_Reset() < 0) {
     Serial.printf("NES reset error.\n");
@@ -384,40 +423,6 @@ void InfoNES_PadState(DWORD* pdwPad1, DWORD* pdwPad2, DWORD* pdwSystem) {
   *pdwSystem = reset ? PAD_SYS_QUIT : 0;
 }
 
-void NESInput::nesAudioCallback(void* userdata, int16_t* stream, size_t len) {
-  // Zero output buffer first
-  memset(stream, 0, len);
-
-  // How many 8-bit samples are available in snd_buf
-  int available_bytes = AUDIO_BUF_SIZE - buf_residue_size;
-  if (available_bytes <= 0) {
-    return;
-  }
-
-  // Stream expects 16-bit stereo interleaved samples (2 channels), len is bytes.
-  // Each input byte will be expanded to two int16_t (left/right), consuming 4 bytes in stream.
-  int max_output_samples = len / 4; // number of input bytes we can convert
-  int samples_to_copy = (int)std::min<int>(available_bytes, max_output_samples);
-
-  for (int i = 0; i < samples_to_copy; ++i) {
-    int16_t in = snd_buf[i];
-    // Convert unsigned 8-bit [0..255] -> signed 16-bit roughly centered: [-32768..32767]
-    int16_t s = (in - 128) << 8;
-    // write stereo interleaved
-    stream[2 * i] = s;
-    stream[2 * i + 2] = s;
-  }
-
-  // Remove consumed bytes from snd_buf by memmoving remaining data to start
-  int remaining = available_bytes - samples_to_copy;
-  if (remaining > 0) {
-    memmove(snd_buf, &snd_buf[samples_to_copy], remaining);
-  }
-
-  // update buffer residue: we've freed samples_to_copy bytes
-  buf_residue_size += samples_to_copy;
-}
-
 NESInput::NESInput() {
 }
 void NESInput::overclock252MHz() {
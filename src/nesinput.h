@@ -22,7 +22,6 @@ public:
   void shutdown() override;
   void startEmulator() override;
   void mainLoop() override;
-  void nesAudioCallback(void* userdata, int16_t* stream, size_t len);
 
 private:
   void saveRealtimeGameCallback() override;
@@ -1,5 +1,10 @@
 #include "psram.h"
 
+#if ENABLE_EXT_PSRAM
+#include <hardware/dma.h>
+#include <hardware/spi.h>
+#endif
+
 #if ENABLE_EXT_PSRAM
 
 // Opcodes
@@ -16,96 +21,271 @@ uint32_t psram_size_bytes() {
   return DEFAULT_PSRAM_SIZE;
 }
 
+static int psram_dma_tx = -1;
+static int psram_dma_rx = -1;
+static uint8_t psram_dma_zero = 0;
+static uint8_t psram_dma_sink;
+
 static inline void ensure_cs_pins() {
   pinMode(PSRAM_CS_PIN, OUTPUT);
   digitalWrite(PSRAM_CS_PIN, HIGH);
 #if ENABLE_SDCARD
+  // SdFat releases its CS after each command, deselecting it once is enough
   pinMode(SD_CS_PIN, OUTPUT);
   digitalWrite(SD_CS_PIN, HIGH);
 #endif
 }
 
-bool psram_init() {
-  ensure_cs_pins();
-  return true;
+static void claim_dma() {
+  if (psram_dma_tx < 0) {
+    ensure_cs_pins();
+    psram_dma_tx = dma_claim_unused_channel(true);
+    psram_dma_rx = dma_claim_unused_channel(true);
+  }
 }
 
-static inline void deselect_sd_if_needed() {
-#if ENABLE_SDCARD
-  digitalWrite(SD_CS_PIN, HIGH);
-#endif
+// Called before a ROM is loaded, the cache starts out empty
+bool psram_init() {
+  claim_dma();
+  psram_cache_invalidate();
+  return true;
 }
 
-bool psram_read(uint32_t addr, void* buf, size_t len) {
-  if (!buf) return false;
-  if (addr + len > psram_size_bytes()) return false;
-
-  uint8_t *p = (uint8_t*)buf;
-  size_t remaining = len;
+/**
+ * Transfer in flight. The payload of each chunk is moved by two DMA channels:
+ * TX feeds the SPI data register (from the buffer or a constant zero byte),
+ * RX drains it (into the buffer or a scratch byte), so RX completion means
+ * every byte has been clocked and CS can be released.
+ */
+typedef struct psram_xfer_t {
+  uint8_t *dst;           // read destination, NULL for writes
+  const uint8_t *src;     // write source, NULL for reads
+  uint32_t addr;
+  size_t remaining;       // bytes after the current chunk
+  size_t cur;             // bytes of the current chunk
+  bool active;
+} psram_xfer_t;
 
-  while (remaining) {
-    size_t cur = remaining > TRANSFER_CHUNK ? TRANSFER_CHUNK : remaining;
+static psram_xfer_t psram_xfer = {};
 
-    deselect_sd_if_needed();
+/**
+ * Select the chip, send the command header with plain SPI transfers and
+ * let DMA run the payload of the current chunk.
+ */
+static void psram_start_chunk() {
+  psram_xfer_t *x = &psram_xfer;
+  const bool writing = x->src != NULL;
+  x->cur = x->remaining > TRANSFER_CHUNK ? TRANSFER_CHUNK : x->remaining;
+  x->remaining -= x->cur;
 
-    PSRAM_SPI.beginTransaction(psramSPISettings);
-    digitalWrite(PSRAM_CS_PIN, LOW);
+  PSRAM_SPI.beginTransaction(psramSPISettings);
+  digitalWrite(PSRAM_CS_PIN, LOW);
 
+  if (writing) {
+    PSRAM_SPI.transfer(PSRAM_CMD_WRITE);
+  } else {
     // Use fast-read (0x0B) with a single dummy byte; many PSRAM chips accept it.
     PSRAM_SPI.transfer(PSRAM_CMD_FAST_READ);
-    PSRAM_SPI.transfer((addr >> 16) & 0xFF);
-    PSRAM_SPI.transfer((addr >> 8) & 0xFF);
-    PSRAM_SPI.transfer((addr) & 0xFF);
+  }
+  PSRAM_SPI.transfer((x->addr >> 16) & 0xFF);
+  PSRAM_SPI.transfer((x->addr >> 8) & 0xFF);
+  PSRAM_SPI.transfer((x->addr) & 0xFF);
+  if (!writing) {
     // dummy
     PSRAM_SPI.transfer(0x00);
+  }
 
-    for (size_t i = 0; i < cur; ++i) {
-      p[i] = PSRAM_SPI.transfer(0x00);
-    }
+  spi_hw_t *hw = spi_get_hw(PSRAM_SPI_HW);
 
-    digitalWrite(PSRAM_CS_PIN, HIGH);
-    PSRAM_SPI.endTransaction();
+  dma_channel_config tx = dma_channel_get_default_config(psram_dma_tx);
+  channel_config_set_transfer_data_size(&tx, DMA_SIZE_8);
+  channel_config_set_dreq(&tx, spi_get_dreq(PSRAM_SPI_HW, true));
+  channel_config_set_read_increment(&tx, writing);
+  channel_config_set_write_increment(&tx, false);
+  dma_channel_configure(psram_dma_tx, &tx, &hw->dr,
+                        writing ? x->src : &psram_dma_zero, x->cur, false);
 
-    addr += cur;
-    p += cur;
-    remaining -= cur;
-  }
+  dma_channel_config rx = dma_channel_get_default_config(psram_dma_rx);
+  channel_config_set_transfer_data_size(&rx, DMA_SIZE_8);
+  channel_config_set_dreq(&rx, spi_get_dreq(PSRAM_SPI_HW, false));
+  channel_config_set_read_increment(&rx, false);
+  channel_config_set_write_increment(&rx, !writing);
+  dma_channel_configure(psram_dma_rx, &rx, writing ? &psram_dma_sink : x->dst,
+                        &hw->dr, x->cur, false);
+
+  dma_start_channel_mask((1u << psram_dma_tx) | (1u << psram_dma_rx));
+}
 
+static bool psram_start(uint32_t addr, uint8_t *dst, const uint8_t *src, size_t len) {
+  if (addr + len > psram_size_bytes()) return false;
+
+  psram_wait();
+  claim_dma();
+  if (len == 0) return true;
+
+  psram_xfer.dst = dst;
+  psram_xfer.src = src;
+  psram_xfer.addr = addr;
+  psram_xfer.remaining = len;
+  psram_xfer.active = true;
+  psram_start_chunk();
   return true;
 }
 
-bool psram_write(uint32_t addr, const void* buf, size_t len) {
+bool psram_read_async(uint32_t addr, void* buf, size_t len) {
   if (!buf) return false;
-  if (addr + len > psram_size_bytes()) return false;
+  return psram_start(addr, (uint8_t*)buf, NULL, len);
+}
+
+bool psram_busy() {
+  psram_xfer_t *x = &psram_xfer;
+  if (!x->active) {
+    return false;
+  }
+  if (dma_channel_is_busy(psram_dma_rx)) {
+    return true;
+  }
+
+  digitalWrite(PSRAM_CS_PIN, HIGH);
+  PSRAM_SPI.endTransaction();
+
+  x->addr += x->cur;
+  if (x->dst) x->dst += x->cur;
+  if (x->src) x->src += x->cur;
+  if (x->remaining) {
+    psram_start_chunk();
+    return true;
+  }
+  x->active = false;
+  return false;
+}
 
-  const uint8_t *p = (const uint8_t*)buf;
-  size_t remaining = len;
+void psram_wait() {
+  while (psram_busy()) {
+    tight_loop_contents();
+  }
+}
 
-  while (remaining) {
-    size_t cur = remaining > TRANSFER_CHUNK ? TRANSFER_CHUNK : remaining;
+bool psram_read(uint32_t addr, void* buf, size_t len) {
+  if (!psram_read_async(addr, buf, len)) return false;
+  psram_wait();
+  return true;
+}
 
-    deselect_sd_if_needed();
+psram_cache_t psram_cache;
 
-    PSRAM_SPI.beginTransaction(psramSPISettings);
-    digitalWrite(PSRAM_CS_PIN, LOW);
+// Line read ahead by psram_cache_miss, its tag stays invalid until it has arrived
+static struct {
+  uint32_t line;
+  uint8_t way;
+  bool active;
+} psram_prefetch;
 
-    PSRAM_SPI.transfer(PSRAM_CMD_WRITE);
-    PSRAM_SPI.transfer((addr >> 16) & 0xFF);
-    PSRAM_SPI.transfer((addr >> 8) & 0xFF);
-    PSRAM_SPI.transfer((addr) & 0xFF);
+static void psram_cache_finish_prefetch() {
+  if (!psram_prefetch.active) {
+    return;
+  }
+  psram_wait();
+  const uint32_t set = psram_prefetch.line % PSRAM_CACHE_SETS;
+  psram_cache.tag[set][psram_prefetch.way] = psram_prefetch.line;
+  psram_cache.victim[set] = psram_prefetch.way ^ 1;
+  psram_prefetch.active = false;
+}
 
-    for (size_t i = 0; i < cur; ++i) {
-      PSRAM_SPI.transfer(p[i]);
+void psram_cache_invalidate() {
+  psram_cache_finish_prefetch();
+  for (uint32_t set = 0; set < PSRAM_CACHE_SETS; ++set) {
+    for (uint32_t way = 0; way < PSRAM_CACHE_WAYS; ++way) {
+      psram_cache.tag[set][way] = PSRAM_CACHE_INVALID;
     }
+    psram_cache.victim[set] = 0;
+  }
+}
 
-    digitalWrite(PSRAM_CS_PIN, HIGH);
-    PSRAM_SPI.endTransaction();
+void psram_cache_reset_stats() {
+  psram_cache.hits = 0;
+  psram_cache.misses = 0;
+  psram_cache.prefetched = 0;
+}
 
-    addr += cur;
-    p += cur;
-    remaining -= cur;
+/**
+ * Start reading the line after a miss into the least recently used way of its
+ * set. ROM code and data are mostly read upwards, the DMA runs while the
+ * emulator works on the line just filled.
+ */
+static void psram_cache_prefetch(uint32_t line) {
+  const uint32_t set = line % PSRAM_CACHE_SETS;
+  if (psram_cache.tag[set][0] == line || psram_cache.tag[set][1] == line) {
+    return;
+  }
+  const uint32_t way = psram_cache.victim[set];
+  psram_cache.tag[set][way] = PSRAM_CACHE_INVALID;
+  if (psram_read_async(line * PSRAM_CACHE_LINE_SIZE, psram_cache.data[set][way], PSRAM_CACHE_LINE_SIZE)) {
+    psram_prefetch.line = line;
+    psram_prefetch.way = way;
+    psram_prefetch.active = true;
   }
+}
+
+/**
+ * Fill the least recently used way of the set holding addr and return the byte.
+ * A failed read leaves the way invalid, so the next access retries.
+ */
+uint8_t psram_cache_miss(uint32_t addr) {
+  const uint32_t line = addr / PSRAM_CACHE_LINE_SIZE;
+  const uint32_t set = line % PSRAM_CACHE_SETS;
 
+  psram_cache_finish_prefetch();
+  for (uint32_t way = 0; way < PSRAM_CACHE_WAYS; ++way) {
+    if (psram_cache.tag[set][way] == line) {
+      psram_cache.prefetched++;
+      psram_cache_prefetch(line + 1);
+      return psram_cache.data[set][way][addr % PSRAM_CACHE_LINE_SIZE];
+    }
+  }
+
+  const uint32_t way = psram_cache.victim[set];
+  uint8_t *data = psram_cache.data[set][way];
+
+  psram_cache.misses++;
+  psram_cache.tag[set][way] = PSRAM_CACHE_INVALID;
+  if (!psram_read(line * PSRAM_CACHE_LINE_SIZE, data, PSRAM_CACHE_LINE_SIZE)) {
+    return 0;
+  }
+  psram_cache.tag[set][way] = line;
+  psram_cache.victim[set] = way ^ 1;
+  psram_cache_prefetch(line + 1);
+
+  return data[addr % PSRAM_CACHE_LINE_SIZE];
+}
+
+// Drop the cached lines overlapping a write
+static void psram_cache_invalidate_range(uint32_t addr, size_t len) {
+  const uint32_t first = addr / PSRAM_CACHE_LINE_SIZE;
+  const uint32_t last = (addr + len - 1) / PSRAM_CACHE_LINE_SIZE;
+  psram_cache_finish_prefetch();
+  for (uint32_t set = 0; set < PSRAM_CACHE_SETS; ++set) {
+    for (uint32_t way = 0; way < PSRAM_CACHE_WAYS; ++way) {
+      uint32_t tag = psram_cache.tag[set][way];
+      if (tag != PSRAM_CACHE_INVALID && tag >= first && tag <= last) {
+        psram_cache.tag[set][way] = PSRAM_CACHE_INVALID;
+      }
+    }
+  }
+}
+
+bool psram_write_async(uint32_t addr, const void* buf, size_t len) {
+  if (!buf) return false;
+  if (addr + len > psram_size_bytes()) return false;
+  if (len == 0) return true;
+
+  psram_cache_invalidate_range(addr, len);
+  return psram_start(addr, NULL, (const uint8_t*)buf, len);
+}
+
+bool psram_write(uint32_t addr, const void* buf, size_t len) {
+  if (!psram_write_async(addr, buf, len)) return false;
+  psram_wait();
   return true;
 }
 #else
@@ -114,6 +294,14 @@ bool psram_write(uint32_t addr, const void* buf, size_t len) {
 bool psram_init() { return false; }
 bool psram_read(uint32_t addr, void* buf, size_t len) { (void)addr; (void)buf; (void)len; return false; }
 bool psram_write(uint32_t addr, const void* buf, size_t len) { (void)addr; (void)buf; (void)len; return false; }
+bool psram_read_async(uint32_t addr, void* buf, size_t len) { (void)addr; (void)buf; (void)len; return false; }
+bool psram_write_async(uint32_t addr, const void* buf, size_t len) { (void)addr; (void)buf; (void)len; return false; }
+bool psram_busy() { return false; }
+void psram_wait() {}
 uint32_t psram_size_bytes() { return 0; }
 
+uint8_t psram_cache_miss(uint32_t addr) { (void)addr; return 0; }
+void psram_cache_invalidate() {}
+void psram_cache_reset_stats() {}
+
 #endif
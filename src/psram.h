@@ -8,6 +8,15 @@ bool psram_init();
 bool psram_read(uint32_t addr, void* buf, size_t len);
 bool psram_write(uint32_t addr, const void* buf, size_t len);
 
+// Asynchronous variants: start a DMA transfer and return, the buffer must stay valid until
+// psram_busy() returns false. The bus is shared with the SD card, call psram_wait() before using it.
+// Starting a transfer, or calling the blocking variants, first completes the one in flight.
+bool psram_read_async(uint32_t addr, void* buf, size_t len);
+bool psram_write_async(uint32_t addr, const void* buf, size_t len);
+// Advance the transfer in flight, returns false once it has completed
+bool psram_busy();
+void psram_wait();
+
 // Return the maximum addressable size of PSRAM in bytes - caller may use to validate ROM sizes
 uint32_t psram_size_bytes();
 
@@ -17,3 +26,49 @@ inline uint8_t psram_read8(uint32_t addr) {
   psram_read(addr, &v, 1);
   return v;
 }
+
+/**
+ * SRAM read cache in front of the PSRAM, used by the ROM banks that do not fit in flash.
+ * 2-way set associative, a miss fills a whole line with one psram_read burst
+ * instead of paying the SPI command overhead for every byte, and starts reading
+ * the next line in the background.
+ */
+#ifndef PSRAM_CACHE_LINE_SIZE
+#define PSRAM_CACHE_LINE_SIZE 512
+#endif
+#ifndef PSRAM_CACHE_SETS
+#define PSRAM_CACHE_SETS 16
+#endif
+#define PSRAM_CACHE_WAYS 2
+#define PSRAM_CACHE_INVALID 0xFFFFFFFFu
+
+typedef struct psram_cache_t {
+  uint32_t tag[PSRAM_CACHE_SETS][PSRAM_CACHE_WAYS];  // line number (addr / line size), PSRAM_CACHE_INVALID if empty
+  uint8_t victim[PSRAM_CACHE_SETS];                   // least recently used way, refilled on the next miss
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t prefetched;                                // misses that found their line being read ahead
+  uint8_t data[PSRAM_CACHE_SETS][PSRAM_CACHE_WAYS][PSRAM_CACHE_LINE_SIZE];
+} psram_cache_t;
+
+extern psram_cache_t psram_cache;
+
+uint8_t psram_cache_miss(uint32_t addr);
+void psram_cache_invalidate();
+void psram_cache_reset_stats();
+
+// Read a single byte through the line cache
+inline uint8_t psram_cached_read8(uint32_t addr) {
+  const uint32_t line = addr / PSRAM_CACHE_LINE_SIZE;
+  const uint32_t set = line % PSRAM_CACHE_SETS;
+  const uint32_t offset = addr % PSRAM_CACHE_LINE_SIZE;
+
+  for (uint32_t way = 0; way < PSRAM_CACHE_WAYS; ++way) {
+    if (psram_cache.tag[set][way] == line) {
+      psram_cache.hits++;
+      psram_cache.victim[set] = way ^ 1;
+      return psram_cache.data[set][way][offset];
+    }
+  }
+  return psram_cache_miss(addr);
+}
@@ -0,0 +1,305 @@
+#include "rompager.h"
+
+#if ENABLE_ROM_PAGING
+#include "SdFat.h"
+#if ENABLE_ROM_COMPRESSION
+#include "lz4block.h"
+#endif
+
+rom_pager_t rom_pager = {.base = 0xFFFFFFFF, .image = nullptr, .current_bank = ROM_PAGER_NONE};
+
+static FsFile pager_file;
+static uint32_t pager_data_offset;
+
+void rom_pager_reset_stats() {
+  rom_pager.hits = 0;
+  rom_pager.misses = 0;
+  rom_pager.prefetches = 0;
+}
+
+// 能分配多少页就用多少页, 至少两页
+static bool alloc_pages() {
+  rom_pager.page_count = 0;
+  while (rom_pager.page_count < ROM_PAGER_MAX_PAGES) {
+    uint8_t* page = (uint8_t*)malloc(ROM_PAGER_PAGE_SIZE);
+    if (page == nullptr) {
+      break;
+    }
+    rom_pager.pages[rom_pager.page_count] = page;
+    rom_pager.page_bank[rom_pager.page_count] = ROM_PAGER_NONE;
+    rom_pager.page_used[rom_pager.page_count] = 0;
+    rom_pager.page_count++;
+  }
+  if (rom_pager.page_count < ROM_PAGER_MIN_PAGES) {
+    Serial.printf("E rom pager: not enough RAM for %d pages\r\n", ROM_PAGER_MIN_PAGES);
+    rom_pager_close();
+    return false;
+  }
+
+  for (uint32_t bank = 0; bank < ROM_PAGER_MAX_BANKS; bank++) {
+    rom_pager.next_bank[bank] = ROM_PAGER_NONE;
+  }
+  rom_pager.prefetch_bank = ROM_PAGER_NONE;
+  rom_pager.fill_page = -1;
+  rom_pager.current_bank = ROM_PAGER_NONE;
+  rom_pager.current = nullptr;
+  rom_pager.stamp = 0;
+  rom_pager_reset_stats();
+  return true;
+}
+
+static bool open_file(const char* path, uint32_t data_offset) {
+  rom_pager_close();
+
+  if (!pager_file.open(path, O_RDONLY)) {
+    Serial.printf("E rom pager: f_open(%s) error\r\n", path);
+    return false;
+  }
+  pager_data_offset = data_offset;
+  return true;
+}
+
+bool rom_pager_open(const char* path, uint32_t base, uint32_t data_offset) {
+  if (!open_file(path, data_offset)) {
+    return false;
+  }
+  uint32_t size = pager_file.size() - data_offset;
+  rom_pager.bank_count = (size + ROM_PAGER_PAGE_SIZE - 1) / ROM_PAGER_PAGE_SIZE;
+  if (rom_pager.bank_count > ROM_PAGER_MAX_BANKS) {
+    Serial.printf("E rom pager: %lu bytes is too large\r\n", size);
+    pager_file.close();
+    return false;
+  }
+  if (!alloc_pages()) {
+    return false;
+  }
+  rom_pager.base = base;
+
+  Serial.printf("I rom pager: %lu banks above 0x%06lx, %lu pages of %d KiB\r\n",
+      rom_pager.bank_count - base / ROM_PAGER_PAGE_SIZE, base, rom_pager.page_count, ROM_PAGER_PAGE_SIZE / 1024);
+  return true;
+}
+
+bool rom_pager_open_file(const char* path, uint32_t base, uint32_t data_offset) {
+  if (!open_file(path, data_offset)) {
+    return false;
+  }
+  rom_pager.base = base;
+  Serial.printf("I rom pager: %lu bytes above 0x%06lx read from SD\r\n",
+      (uint32_t)pager_file.size() - data_offset - base, base);
+  return true;
+}
+
+void rom_pager_read_file(uint32_t offset, uint8_t* dest, uint32_t len) {
+  int nread = -1;
+  if (pager_file.seekSet(pager_data_offset + offset)) {
+    nread = pager_file.read(dest, len);
+  }
+  if (nread < 0) {
+    error("ROM paging: SD read failed");
+  }
+  // 文件末尾之外按空 flash 处理
+  memset(dest + nread, 0xFF, len - nread);
+}
+
+#if ENABLE_ROM_COMPRESSION
+bool rom_pager_open_compressed(const uint8_t* image, uint32_t bank_count) {
+  rom_pager_close();
+
+  if (bank_count > ROM_PAGER_MAX_BANKS) {
+    return false;
+  }
+  rom_pager.bank_count = bank_count;
+  if (!alloc_pages()) {
+    return false;
+  }
+  rom_pager.image = image;
+  rom_pager.base = ROM_LZ4_RAW_SIZE;
+
+  Serial.printf("I rom pager: %lu compressed banks, %lu pages of %d KiB\r\n",
+      bank_count, rom_pager.page_count, ROM_PAGER_PAGE_SIZE / 1024);
+  return true;
+}
+
+static void decompress_page(uint32_t bank, uint8_t* page) {
+  const uint32_t* index = (const uint32_t*)(rom_pager.image + ROM_LZ4_INDEX_OFFSET);
+  const uint8_t* block = rom_pager.image + index[bank];
+  const uint32_t len = index[bank + 1] - index[bank];
+
+  int32_t size = ROM_PAGER_PAGE_SIZE;
+  if (len == ROM_PAGER_PAGE_SIZE) {
+    memcpy(page, block, ROM_PAGER_PAGE_SIZE);
+  } else {
+    size = lz4block_decompress(block, len, page, ROM_PAGER_PAGE_SIZE);
+  }
+  if (size != ROM_PAGER_PAGE_SIZE) {
+    Serial.printf("E rom pager: bank %lu is corrupt\r\n", bank);
+    error("ROM paging: bad compressed bank");
+  }
+}
+#endif
+
+void rom_pager_close() {
+  rom_pager.base = 0xFFFFFFFF;
+  rom_pager.image = nullptr;
+  rom_pager.current_bank = ROM_PAGER_NONE;
+  rom_pager.current = nullptr;
+  rom_pager.prefetch_bank = ROM_PAGER_NONE;
+  rom_pager.fill_page = -1;
+  for (uint32_t i = 0; i < rom_pager.page_count; i++) {
+    free(rom_pager.pages[i]);
+    rom_pager.pages[i] = nullptr;
+  }
+  rom_pager.page_count = 0;
+  if (pager_file.isOpen()) {
+    pager_file.close();
+  }
+}
+
+static int find_page(uint32_t bank) {
+  for (uint32_t i = 0; i < rom_pager.page_count; i++) {
+    if (rom_pager.page_bank[i] == bank) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Least recently used page, never the current one. The page being read
+ * ahead is only taken when there is no other, its read ahead is dropped.
+ */
+static int pick_victim() {
+  int victim = -1;
+  for (uint32_t i = 0; i < rom_pager.page_count; i++) {
+    if (rom_pager.pages[i] == rom_pager.current || (int32_t)i == rom_pager.fill_page) {
+      continue;
+    }
+    if (victim < 0 || rom_pager.page_used[i] < rom_pager.page_used[victim]) {
+      victim = i;
+    }
+  }
+  if (victim < 0) {
+    victim = rom_pager.fill_page;
+    rom_pager.fill_page = -1;
+  }
+  rom_pager.page_bank[victim] = ROM_PAGER_NONE;
+  return victim;
+}
+
+// read len bytes of bank starting at offset into the same place of page
+static void read_part(uint32_t bank, uint8_t* page, uint32_t offset, uint32_t len) {
+  rom_pager_read_file(bank * ROM_PAGER_PAGE_SIZE + offset, page + offset, len);
+}
+
+static void assign_page(int page, uint32_t bank) {
+  rom_pager.page_bank[page] = bank;
+  rom_pager.page_used[page] = ++rom_pager.stamp;
+}
+
+/**
+ * Read bank into the least recently used page right away
+ */
+static int load_page(uint32_t bank) {
+  int victim = pick_victim();
+  uint8_t* page = rom_pager.pages[victim];
+
+#if ENABLE_ROM_COMPRESSION
+  if (rom_pager.image) {
+    decompress_page(bank, page);
+  } else
+#endif
+  {
+    read_part(bank, page, 0, ROM_PAGER_PAGE_SIZE);
+  }
+  assign_page(victim, bank);
+  return victim;
+}
+
+// the MBC switched to the bank being read ahead: read the rest now
+static int finish_fill() {
+  const int page = rom_pager.fill_page;
+  read_part(rom_pager.fill_bank, rom_pager.pages[page], rom_pager.fill_done, ROM_PAGER_PAGE_SIZE - rom_pager.fill_done);
+  assign_page(page, rom_pager.fill_bank);
+  rom_pager.fill_page = -1;
+  return page;
+}
+
+/**
+ * Slow path of rom_pager_read(): the MBC switched to another bank.
+ */
+uint8_t rom_pager_switch(uint32_t addr) {
+  const uint32_t bank = addr / ROM_PAGER_PAGE_SIZE;
+  if (bank >= rom_pager.bank_count) {
+    return 0xFF;
+  }
+
+  if (rom_pager.current_bank != ROM_PAGER_NONE) {
+    rom_pager.next_bank[rom_pager.current_bank] = bank;
+  }
+
+  int page = find_page(bank);
+  if (page >= 0) {
+    rom_pager.hits++;
+    rom_pager.page_used[page] = ++rom_pager.stamp;
+  } else if (rom_pager.fill_page >= 0 && rom_pager.fill_bank == bank) {
+    rom_pager.misses++;
+    page = finish_fill();
+  } else {
+    rom_pager.misses++;
+    page = load_page(bank);
+  }
+  rom_pager.current_bank = bank;
+  rom_pager.current = rom_pager.pages[page];
+
+  // 按上次的切换顺序预取下一个 bank
+  uint16_t next = rom_pager.next_bank[bank];
+  if (next != ROM_PAGER_NONE && find_page(next) < 0) {
+    rom_pager.prefetch_bank = next;
+  }
+
+  return rom_pager.current[addr % ROM_PAGER_PAGE_SIZE];
+}
+
+/**
+ * Called from the frame slack time. Starts reading ahead the predicted bank
+ * or continues it with one ROM_PAGER_PREFETCH_STEP read, so a call never
+ * costs more than one card transfer. The page only becomes visible once it
+ * is complete. A compressed bank comes from flash and is decompressed in
+ * one step.
+ */
+bool rom_pager_idle() {
+  if (rom_pager.page_count == 0) {
+    return false;
+  }
+  if (rom_pager.fill_page < 0) {
+    const uint16_t bank = rom_pager.prefetch_bank;
+    rom_pager.prefetch_bank = ROM_PAGER_NONE;
+    if (bank == ROM_PAGER_NONE || find_page(bank) >= 0) {
+      return false;
+    }
+    const int page = pick_victim();
+#if ENABLE_ROM_COMPRESSION
+    if (rom_pager.image) {
+      decompress_page(bank, rom_pager.pages[page]);
+      assign_page(page, bank);
+      rom_pager.prefetches++;
+      return true;
+    }
+#endif
+    rom_pager.fill_page = page;
+    rom_pager.fill_bank = bank;
+    rom_pager.fill_done = 0;
+  }
+
+  read_part(rom_pager.fill_bank, rom_pager.pages[rom_pager.fill_page], rom_pager.fill_done, ROM_PAGER_PREFETCH_STEP);
+  rom_pager.fill_done += ROM_PAGER_PREFETCH_STEP;
+  if (rom_pager.fill_done == ROM_PAGER_PAGE_SIZE) {
+    assign_page(rom_pager.fill_page, rom_pager.fill_bank);
+    rom_pager.fill_page = -1;
+    rom_pager.prefetches++;
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <Arduino.h>
+#include "common.h"
+
+#if ENABLE_ROM_PAGING
+#if ENABLE_EXT_PSRAM || ENABLE_RP2040_PSRAM
+#error "ENABLE_ROM_PAGING is for boards without PSRAM"
+#endif
+#if !ENABLE_SDCARD
+#error "ENABLE_ROM_PAGING requires ENABLE_SDCARD"
+#endif
+#if !ENABLE_NES_BANK_CACHE
+#error "ENABLE_ROM_PAGING requires ENABLE_NES_BANK_CACHE for NES banks"
+#endif
+#elif ENABLE_ROM_COMPRESSION
+#error "ENABLE_ROM_COMPRESSION requires ENABLE_ROM_PAGING"
+#endif
+
+#if ENABLE_ROM_PAGING
+
+/**
+ * Demand paging of the ROM part that does not fit in flash.
+ * Banks above the flash copy are read from the still open SD file into a
+ * small pool of SRAM pages on first access, least recently used page is
+ * replaced. Each bank remembers which bank was switched to after it last
+ * time, that one is read ahead from the frame slack time in steps of
+ * ROM_PAGER_PREFETCH_STEP bytes, one card read per rom_pager_idle() call.
+ *
+ * NES banks are paged by the bank cache (InfoNES_BankCache.h), which reads
+ * them from the file opened with rom_pager_open_file().
+ *
+ * With ENABLE_ROM_COMPRESSION the pages can instead come from a ROM stored
+ * LZ4 compressed in flash, one block per bank, and are decompressed on the
+ * bank switch.
+ */
+#define ROM_PAGER_PAGE_SIZE (16 * 1024)  // one GB ROM bank
+#define ROM_PAGER_MAX_PAGES 8
+#define ROM_PAGER_MIN_PAGES 2
+#define ROM_PAGER_MAX_BANKS 512          // 8 MB
+#define ROM_PAGER_NONE 0xFFFF
+// 预取时一次从 SD 读取的长度, 与 SD_IO_CHUNK_SIZE 相同
+#define ROM_PAGER_PREFETCH_STEP 4096
+
+#if ENABLE_ROM_COMPRESSION
+// 压缩 ROM 在 flash 中的布局: bank 0/1 原样存放 (rom_bank0 直接复制),
+// 接着一个扇区的索引 (每个 bank 的起始偏移, 最后一项是结尾), 然后是压缩数据.
+// 长度等于一个 bank 的块是原样存放的.
+#define ROM_LZ4_RAW_SIZE (2 * ROM_PAGER_PAGE_SIZE)
+#define ROM_LZ4_INDEX_OFFSET ROM_LZ4_RAW_SIZE
+#define ROM_LZ4_DATA_OFFSET (ROM_LZ4_INDEX_OFFSET + 4096)
+#endif
+
+typedef struct rom_pager_t {
+  uint32_t base;                          // first paged address, 0xFFFFFFFF when not paging
+  const uint8_t* image;                   // compressed ROM in flash, nullptr when paging from SD
+  uint32_t current_bank;
+  const uint8_t* current;                 // page holding current_bank
+  uint8_t* pages[ROM_PAGER_MAX_PAGES];
+  uint16_t page_bank[ROM_PAGER_MAX_PAGES];
+  uint32_t page_used[ROM_PAGER_MAX_PAGES]; // LRU stamp
+  uint32_t page_count;
+  uint32_t bank_count;
+  uint16_t next_bank[ROM_PAGER_MAX_BANKS]; // bank switched to after this one last time
+  uint16_t prefetch_bank;                 // predicted bank, not started yet
+  int32_t fill_page;                      // page being read ahead, -1 when none
+  uint16_t fill_bank;
+  uint32_t fill_done;                     // bytes of fill_bank already in fill_page
+  uint32_t stamp;
+  uint32_t hits;                          // bank switches served from the pool
+  uint32_t misses;                        // bank switches that waited for the card or decompression
+  uint32_t prefetches;
+} rom_pager_t;
+
+extern rom_pager_t rom_pager;
+
+// Page the part of path above base (a multiple of ROM_PAGER_PAGE_SIZE), the ROM starts at data_offset in the file
+bool rom_pager_open(const char* path, uint32_t base, uint32_t data_offset = 0);
+// Keep path open for reads above base without a page pool, for the NES bank cache
+bool rom_pager_open_file(const char* path, uint32_t base, uint32_t data_offset = 0);
+// Read len bytes at ROM offset from the open file, 0xFF past its end
+void rom_pager_read_file(uint32_t offset, uint8_t* dest, uint32_t len);
+#if ENABLE_ROM_COMPRESSION
+// Page a ROM of bank_count banks stored compressed at image
+bool rom_pager_open_compressed(const uint8_t* image, uint32_t bank_count);
+#endif
+void rom_pager_close();
+uint8_t rom_pager_switch(uint32_t addr);
+// One step of reading ahead the predicted bank, false when there was nothing to do
+bool rom_pager_idle();
+void rom_pager_reset_stats();
+
+inline uint8_t rom_pager_read(uint32_t addr) {
+  if (addr / ROM_PAGER_PAGE_SIZE == rom_pager.current_bank) {
+    return rom_pager.current[addr % ROM_PAGER_PAGE_SIZE];
+  }
+  return rom_pager_switch(addr);
+}
+
+#endif
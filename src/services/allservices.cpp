@@ -1,4 +1,6 @@
 #include "allservices.h"
+#include "rompager.h"
+#include "InfoNES_BankCache.h"
 
 Services::Services() {
 }
@@ -11,6 +13,19 @@ void Services::initAll() {
 #if ENABLE_SOUND
   soundService.initSound();
 #endif
+#if ENABLE_SOUND && ((ENABLE_SDCARD && ENABLE_SD_ASYNC_IO) || ENABLE_ROM_PAGING)
+  // 存档写入和 ROM 预取在等待帧定时的空闲时间里进行, 每次一步, 存档优先
+  soundService.setIdleCallback([this]() {
+    bool busy = false;
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+    busy = sdIoService.poll();
+#endif
+#if ENABLE_ROM_PAGING
+    busy = busy || rom_pager_idle() || nes_bank_cache_idle();
+#endif
+    return busy;
+  });
+#endif
 }
 
 Services srv;
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include "tfcardservice.h"
 #include "soundservice.h"
 #include "batteryservice.h"
+#include "sdioservice.h"
 
 #define PRESSED_KEY(x) (srv.inputService.isButtonPressed(x))
 
@@ -14,6 +15,9 @@ public:
   InputService inputService;
   CardService cardService;
   SoundService soundService;
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+  SdIoService sdIoService;
+#endif
 };
 
 extern Services srv;
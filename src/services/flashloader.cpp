@@ -0,0 +1,172 @@
+#include "flashloader.h"
+
+#if ENABLE_SDCARD
+#include <Arduino.h>
+#include "common.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+/**
+ * Start a CRC-32 of len bytes (multiple of 4) through the DMA sniffer.
+ * The words are copied to a dummy destination, only the checksum matters.
+ */
+void FlashLoader::startCrc(const void* src, uint32_t len) {
+  dma_channel_config config = dma_channel_get_default_config(_dmaChannel);
+  channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+  channel_config_set_read_increment(&config, true);
+  channel_config_set_write_increment(&config, false);
+  channel_config_set_sniff_enable(&config, true);
+
+  dma_sniffer_enable(_dmaChannel, DMA_SNIFF_CTRL_CALC_VALUE_CRC32R, true);
+  dma_hw->sniff_data = 0xFFFFFFFF;
+  dma_channel_configure(_dmaChannel, &config, &_crcSink, src, len / 4, true);
+}
+
+uint32_t FlashLoader::finishCrc() {
+  dma_channel_wait_for_finish_blocking(_dmaChannel);
+  return dma_hw->sniff_data;
+}
+
+void FlashLoader::claimDma() {
+  if (_dmaChannel < 0) {
+    _dmaChannel = dma_claim_unused_channel(true);
+  }
+}
+
+/**
+ * Erase and program the sectors of one chunk that differ from flash.
+ * The chunk never crosses a 64KiB block boundary. Returns whether anything was written.
+ */
+bool FlashLoader::programChunk(const uint8_t* buffer, uint32_t offset, uint32_t len) {
+  const uint32_t flashOffset = ((uint32_t)&RS_rom[offset]) - XIP_BASE;
+  const uint32_t sectors = len / FLASH_SECTOR_SIZE;
+  uint32_t differ = 0;
+  uint32_t differMask = 0;
+
+  for (uint32_t i = 0; i < sectors; i++) {
+    const uint32_t at = i * FLASH_SECTOR_SIZE;
+    if (memcmp(&RS_rom[offset + at], buffer + at, FLASH_SECTOR_SIZE) != 0) {
+      differMask |= 1u << i;
+      differ++;
+    }
+  }
+  if (differ == 0) {
+    return false;
+  }
+
+  uint32_t ints = save_and_disable_interrupts();
+  if (len == FLASH_BLOCK_SIZE && differ >= FLASH_LOADER_BLOCK_ERASE_MIN_SECTORS) {
+    // aligned whole block: the boot ROM issues a single 64KiB block erase
+    flash_range_erase(flashOffset, FLASH_BLOCK_SIZE);
+    flash_range_program(flashOffset, buffer, FLASH_BLOCK_SIZE);
+    _sectorsWritten += sectors;
+  } else {
+    for (uint32_t i = 0; i < sectors; i++) {
+      if (differMask & (1u << i)) {
+        const uint32_t at = i * FLASH_SECTOR_SIZE;
+        flash_range_erase(flashOffset + at, FLASH_SECTOR_SIZE);
+        flash_range_program(flashOffset + at, buffer + at, FLASH_SECTOR_SIZE);
+      }
+    }
+    _sectorsWritten += differ;
+  }
+  restore_interrupts(ints);
+
+  return true;
+}
+
+void FlashLoader::load(FsFile& file, uint32_t size, std::function<void(uint32_t offset)> onChunk) {
+  static_assert(FLASH_LOADER_CHUNK_SIZE == FLASH_BLOCK_SIZE, "chunks are whole flash blocks");
+  // only used when the chunk buffer can't be allocated, word aligned for the CRC DMA
+  static alignas(4) uint8_t sectorBuffer[FLASH_SECTOR_SIZE];
+  uint32_t capacity = FLASH_LOADER_CHUNK_SIZE;
+  uint8_t* buffer = (uint8_t*)malloc(capacity);
+  if (buffer == nullptr) {
+    // 内存不足时退回逐扇区装载
+    Serial.printf("I flash loader: no RAM for 64KiB chunks, using sectors\r\n");
+    buffer = sectorBuffer;
+    capacity = FLASH_SECTOR_SIZE;
+  }
+
+  claimDma();
+  _sectorsWritten = 0;
+
+  bool verifyPending = false;
+  uint32_t verifyExpected = 0;
+  uint32_t verifyOffset = 0;
+
+  uint32_t offset = 0;
+  while (offset < size) {
+    const uint32_t flashOffset = ((uint32_t)&RS_rom[offset]) - XIP_BASE;
+    uint32_t wanted = size - offset;
+    uint32_t len = capacity - (flashOffset % capacity); // stop at the next block boundary
+    if (wanted < len) {
+      len = (wanted + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    } else {
+      wanted = len;
+    }
+
+    // the read overlaps the DMA check of the previous chunk
+    int nread = file.read(buffer, wanted);
+    if (nread != (int)wanted) {
+      error("Failed to read file!");
+    }
+    // 末尾不足一个扇区时补 0xFF, 与擦除后的内容一致
+    memset(buffer + wanted, 0xFF, len - wanted);
+
+    if (verifyPending) {
+      verifyPending = false;
+      if (finishCrc() != verifyExpected) {
+        Serial.printf("E flash verify failed @ %07lx\r\n", verifyOffset);
+        error("Programming failed - Flash mismatch");
+      }
+    }
+
+    if (programChunk(buffer, offset, len)) {
+      startCrc(buffer, len);
+      verifyExpected = finishCrc();
+      verifyOffset = offset;
+      startCrc(&RS_rom[offset], len);
+      verifyPending = true;
+    }
+
+    offset += len;
+    // 每 64KiB 刷新一次进度
+    if (onChunk && ((flashOffset + len) % FLASH_BLOCK_SIZE == 0 || offset >= size)) {
+      onChunk(offset);
+    }
+  }
+
+  if (verifyPending && finishCrc() != verifyExpected) {
+    Serial.printf("E flash verify failed @ %07lx\r\n", verifyOffset);
+    error("Programming failed - Flash mismatch");
+  }
+
+  if (buffer != sectorBuffer) {
+    free(buffer);
+  }
+}
+
+uint32_t FlashLoader::checksum(const void* src, uint32_t len) {
+  claimDma();
+  startCrc(src, (len + 3) & ~3);
+  return finishCrc();
+}
+
+void FlashLoader::writeSector(const uint8_t* buffer, uint32_t offset) {
+  claimDma();
+  if (!programChunk(buffer, offset, FLASH_SECTOR_SIZE)) {
+    return;
+  }
+
+  startCrc(buffer, FLASH_SECTOR_SIZE);
+  uint32_t expected = finishCrc();
+  startCrc(&RS_rom[offset], FLASH_SECTOR_SIZE);
+  if (finishCrc() != expected) {
+    Serial.printf("E flash verify failed @ %07lx\r\n", offset);
+    error("Programming failed - Flash mismatch");
+  }
+}
+
+#endif
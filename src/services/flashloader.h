@@ -0,0 +1,42 @@
+#pragma once
+#if ENABLE_SDCARD
+#include "SdFat.h"
+
+#include <functional>
+#include <stdint.h>
+
+// 一次从 SD 读入并编程的最大长度, 按 flash 的 64KiB 块对齐
+#define FLASH_LOADER_CHUNK_SIZE (64 * 1024)
+// 块内不同的扇区达到这个数量时改用一次 64KiB 块擦除 (约 150ms, 扇区擦除约 45ms)
+#define FLASH_LOADER_BLOCK_ERASE_MIN_SECTORS 4
+
+/**
+ * Programs a ROM file from SD into the flash ROM region (RS_rom).
+ * The file is read in chunks ending on 64KiB flash block boundaries, only
+ * the sectors that differ from flash are erased and programmed (with one
+ * block erase when enough of the block differs). The result is checked with
+ * a DMA sniffer CRC of the flash, which runs while the next chunk is read
+ * from the card.
+ */
+class FlashLoader {
+public:
+  // program size bytes from the current file position, starting at ROM offset 0
+  void load(FsFile& file, uint32_t size, std::function<void(uint32_t offset)> onChunk);
+  // program one sector at ROM offset unless flash already holds it, then verify it (buffer word aligned)
+  void writeSector(const uint8_t* buffer, uint32_t offset);
+  uint32_t sectorsWritten() { return _sectorsWritten; }
+  // raw DMA sniffer CRC-32 of len bytes rounded up to whole words, src word aligned
+  uint32_t checksum(const void* src, uint32_t len);
+
+private:
+  void claimDma();
+  bool programChunk(const uint8_t* buffer, uint32_t offset, uint32_t len);
+  void startCrc(const void* src, uint32_t len);
+  uint32_t finishCrc();
+
+  int _dmaChannel = -1;
+  uint32_t _crcSink;
+  uint32_t _sectorsWritten = 0;
+};
+
+#endif
@@ -1,4 +1,14 @@
 #include "inputservice.h"
+#include "allservices.h"
+#if ENABLE_EXT_PSRAM
+#include "psram.h"
+#endif
+#if ENABLE_ROM_PAGING
+#include "rompager.h"
+#endif
+#if ENABLE_NES_BANK_CACHE
+#include "InfoNES_BankCache.h"
+#endif
 
 InputService::InputService() {
 }
@@ -85,12 +95,72 @@ void InputService::handleSerial() {
     fps = ((uint64_t)frames * 1000 * 1000) / diff;
     Serial.printf("Frames: %u\tTime: %lu us\tFPS: %lu\r\n",
         frames, diff, fps);
+#if ENABLE_SOUND
+    Serial.printf("Audio ring: %lu/%lu frames\tMin: %lu\tMax: %lu\tUnderrun: %lu\tOverrun: %lu\r\n",
+        srv.soundService.getRingFill(), srv.soundService.getRing()->size,
+        srv.soundService.getRingMinFill(), srv.soundService.getRingMaxFill(),
+        srv.soundService.getUnderrunCount(), srv.soundService.getOverrunCount());
+    Serial.printf("Resample ratio: %ld ppm\r\n",
+        ((int32_t)srv.soundService.getResampleStep() - (int32_t)AUDIO_RESAMPLER_ONE) * 1000000 / (int32_t)AUDIO_RESAMPLER_ONE);
+    srv.soundService.resetRingStats();
+#if ENABLE_AUDIO_TELEMETRY
+    srv.soundService.printTelemetry();
+#endif
+#endif
+#if ENABLE_EXT_PSRAM
+    Serial.printf("PSRAM cache: hits %lu\tmisses %lu\tread ahead %lu\r\n", psram_cache.hits, psram_cache.misses,
+        psram_cache.prefetched);
+    psram_cache_reset_stats();
+#endif
+#if ENABLE_ROM_PAGING
+    if (rom_pager.page_count) {
+      Serial.printf("ROM pager: hits %lu\tmisses %lu\tprefetches %lu\r\n",
+          rom_pager.hits, rom_pager.misses, rom_pager.prefetches);
+      rom_pager_reset_stats();
+    }
+#endif
+#if ENABLE_NES_BANK_CACHE
+    if (nes_prg_cache.slot_count || nes_chr_cache.slot_count) {
+      Serial.printf("NES bank cache: PRG hits %lu\tmisses %lu\tCHR hits %lu\tmisses %lu\r\n",
+          nes_prg_cache.hits, nes_prg_cache.misses, nes_chr_cache.hits, nes_chr_cache.misses);
+#if ENABLE_ROM_PAGING
+      if (nes_prg_cache.next_bank || nes_chr_cache.next_bank) {
+        Serial.printf("NES bank cache: PRG prefetches %lu\tCHR prefetches %lu\r\n",
+            nes_prg_cache.prefetches, nes_chr_cache.prefetches);
+      }
+#endif
+      nes_bank_cache_reset_stats();
+    }
+#endif
     Serial.flush();
     frames = 0;
     start_time = time_us_64();
     break;
   }
 
+#if ENABLE_SOUND && ENABLE_AUDIO_CAPTURE
+  case 'r': {
+    srv.soundService.toggleCapture();
+    break;
+  }
+#endif
+
+#if ENABLE_SOUND && ENABLE_AUDIO_TELEMETRY
+  case 't': {
+    bool enabled = srv.soundService.toggleTelemetry();
+    Serial.printf("I Audio telemetry %s\r\n", enabled ? "on" : "off");
+    break;
+  }
+#endif
+
+  case 'U': {
+    // ROM upload, the host waits for the answer before sending any frame
+    if (_serialUploadCallback) {
+      _serialUploadCallback();
+    }
+    break;
+  }
+
   case '\n':
   case '\r': {
     setButtonPressed(ButtonID::BTN_START);
@@ -39,6 +39,9 @@ public:
 
   void unsetAfterHandleJoypadCallback();
 
+  // 串口 'U' 命令, 只在 ROM 浏览器打开时响应
+  void setSerialUploadCallback(std::function<void()> callback) { _serialUploadCallback = callback; }
+
   // 存储当前按键状态的结构体
   typedef struct {
     uint16_t current_state; // 使用位掩码存储8个按键的状态
@@ -51,6 +54,7 @@ public:
 private:
   std::function<void()> _afterHandleJoypadCallback;
   std::function<void()> _prevAfterHandleJoypadCallback;
+  std::function<void()> _serialUploadCallback;
   void setButtonPressed(ButtonID button);
 #if ENABLE_INPUT == INPUT_PCF8574
   void initJoypadI2CIoExpander();
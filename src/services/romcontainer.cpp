@@ -0,0 +1,53 @@
+#include "romcontainer.h"
+
+#if ENABLE_SDCARD
+#include <Arduino.h>
+#include "romlibrary.h"
+
+static_assert(sizeof(rom_container_t) == 596, "layout shared with tools/romcontainer.py");
+
+bool RomContainer::isContainer(const char* filename) {
+  size_t len = strlen(filename);
+  size_t extLen = strlen(ROM_CONTAINER_EXT);
+  return len > extLen && strcasecmp(filename + len - extLen, ROM_CONTAINER_EXT) == 0;
+}
+
+bool RomContainer::open(FsFile& file, GameType type) {
+  _valid = false;
+  if (file.read(&_header, sizeof(_header)) != sizeof(_header)) {
+    Serial.printf("E container: short header\r\n");
+    return false;
+  }
+
+  if (_header.magic != ROM_CONTAINER_MAGIC || _header.version != ROM_CONTAINER_VERSION) {
+    Serial.printf("E container: unknown format\r\n");
+    return false;
+  }
+  uint32_t crc = RomLibrary::crc32(0, (const uint8_t*)&_header, offsetof(rom_container_t, header_crc));
+  if (crc != _header.header_crc) {
+    Serial.printf("E container: header CRC mismatch\r\n");
+    return false;
+  }
+
+  uint8_t system = type == GameType_NES ? ROM_CONTAINER_NES : ROM_CONTAINER_GB;
+  if (_header.system != system) {
+    Serial.printf("E container: built for another system\r\n");
+    return false;
+  }
+  if (_header.data_offset < sizeof(_header) || _header.data_offset % ROM_CONTAINER_ALIGN
+      || file.size() < (uint64_t)_header.data_offset + _header.rom_size
+      || _header.prg_size + _header.chr_size > _header.rom_size) {
+    Serial.printf("E container: bad layout\r\n");
+    return false;
+  }
+
+  if (!file.seekSet(_header.data_offset)) {
+    return false;
+  }
+  _header.title[sizeof(_header.title) - 1] = 0;
+  Serial.printf("I container: %s, %lu bytes, mapper %u\r\n", _header.title, _header.rom_size, _header.mapper);
+  _valid = true;
+  return true;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+#if ENABLE_SDCARD
+#include "SdFat.h"
+#include "common.h"
+
+#include <stdint.h>
+
+#define ROM_CONTAINER_EXT ".pgc"
+#define ROM_CONTAINER_MAGIC 0x31434750 // "PGC1"
+#define ROM_CONTAINER_VERSION 1
+// 数据从扇区边界开始, SD 读取可以直接进缓冲区, flash 按扇区编程
+#define ROM_CONTAINER_ALIGN 4096
+
+#define ROM_CONTAINER_GB 0
+#define ROM_CONTAINER_NES 1
+
+/**
+ * Header of a preprocessed ROM container (.pgc), written by
+ * tools/romcontainer.py. Everything the loaders would otherwise parse out of
+ * the ROM is stored here, the ROM data follows at data_offset ready to be
+ * copied to flash as is. For NES that is PRG followed by CHR, without the
+ * iNES header and trainer which live in the container header.
+ * All fields are little endian.
+ */
+struct rom_container_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t data_offset;   // multiple of ROM_CONTAINER_ALIGN
+  uint8_t system;         // ROM_CONTAINER_GB / ROM_CONTAINER_NES
+  uint8_t cgb;            // GB: CGB flag (0x143)
+  uint16_t mapper;        // GB: cartridge type (0x147), NES: mapper number
+  uint32_t rom_size;      // bytes of ROM data
+  uint32_t prg_size;      // NES: PRG bytes, GB: rom_size
+  uint32_t chr_size;      // NES: CHR bytes
+  uint32_t ram_size;      // cartridge RAM bytes
+  uint32_t rom_crc;       // CRC-32 of the ROM data
+  char title[32];
+  uint8_t ines[16];       // NES: iNES header of the source file
+  uint8_t trainer[512];   // NES: trainer when ines[6] & 4
+  uint32_t header_crc;    // CRC-32 of the header up to this field
+};
+
+/**
+ * Reads and checks the header of a container file, so the loaders can
+ * take the ROM data without looking at the ROM itself.
+ */
+class RomContainer {
+public:
+  static bool isContainer(const char* filename);
+  // read and check the header, position file at the ROM data. false for a broken container
+  bool open(FsFile& file, GameType type);
+  void clear() { _valid = false; }
+  // header of the container loaded last, nullptr for a plain ROM file
+  const rom_container_t* header() { return _valid ? &_header : nullptr; }
+
+private:
+  rom_container_t _header;
+  bool _valid = false;
+};
+
+#endif
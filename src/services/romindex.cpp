@@ -0,0 +1,418 @@
+#include "romindex.h"
+
+#if ENABLE_SDCARD
+#include <Arduino.h>
+#include <algorithm>
+#include "InfoNES_Mapper.h"
+#include "romcontainer.h"
+#include "romlibrary.h"
+
+static bool hasExtension(const char* name, const char* const* extensions) {
+  size_t len = strlen(name);
+  for (uint8_t i = 0; extensions[i]; i++) {
+    size_t extLen = strlen(extensions[i]);
+    if (len > extLen && strcasecmp(name + len - extLen, extensions[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static const char* const nesExtensions[] = {".nes", nullptr};
+
+static void indexPath(char* path, size_t size, const char* dir) {
+  snprintf(path, size, "%s%s", dir, ROM_INDEX_NAME);
+}
+
+/**
+ * One pass over the directory: CRC of what the index would list
+ */
+static uint32_t directoryStamp(const char* dir, const char* const* extensions, uint32_t* count) {
+  FsFile root;
+  FsFile file;
+  char name[ROM_INDEX_MAX_NAME + 1];
+  uint32_t crc = 0;
+  *count = 0;
+
+  if (!root.open(dir)) {
+    return 0;
+  }
+  while (file.openNext(&root, O_RDONLY)) {
+    file.getName(name, sizeof(name));
+    if (!file.isDir() && hasExtension(name, extensions)) {
+      uint32_t size = file.size();
+      uint16_t date[2] = {0, 0};
+      file.getModifyDateTime(&date[0], &date[1]);
+      crc = RomLibrary::crc32(crc, (const uint8_t*)name, strlen(name) + 1);
+      crc = RomLibrary::crc32(crc, (const uint8_t*)&size, sizeof(size));
+      crc = RomLibrary::crc32(crc, (const uint8_t*)date, sizeof(date));
+      (*count)++;
+    }
+    file.close();
+  }
+  root.close();
+  return crc;
+}
+
+bool RomIndex::open(SdFs& sd, const char* dir, const char* const* extensions) {
+  close();
+
+  uint32_t count;
+  uint32_t stamp = directoryStamp(dir, extensions, &count);
+
+  char path[ROM_INDEX_MAX_NAME + 1];
+  indexPath(path, sizeof(path), dir);
+  if (_file.open(path, O_RDONLY)) {
+    if (_file.read(&_header, sizeof(_header)) == sizeof(_header) && _header.magic == ROM_INDEX_MAGIC
+        && _header.version == ROM_INDEX_VERSION && _header.count == count && _header.stamp == stamp) {
+      return true;
+    }
+    _file.close();
+  }
+
+  Serial.printf("I rom index: rebuilding %s (%lu files)\r\n", path, count);
+  if (!rebuild(sd, dir, extensions, path)) {
+    Serial.printf("E rom index: rebuild of %s failed\r\n", path);
+    close();
+    return false;
+  }
+  if (!_file.open(path, O_RDONLY) || _file.read(&_header, sizeof(_header)) != sizeof(_header)) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+void RomIndex::close() {
+  if (_file.isOpen()) {
+    _file.close();
+  }
+  _header = {};
+}
+
+/**
+ * Cartridge types peanut_gb accepts, see cart_mbc[] in gb_init()
+ */
+static bool gbCartSupported(uint8_t type) {
+  static const int8_t cartMbc[] = {
+      0, 1, 1, 1, -1, 2, 2, -1, 0, 0, -1, 0, 0, 0, -1, 3,
+      3, 3, 3, 3, -1, -1, -1, -1, -1, 5, 5, 5, 5, 5, 5, -1};
+  return type < sizeof(cartMbc) && cartMbc[type] != -1;
+}
+
+static bool nesMapperSupported(uint16_t mapper) {
+  for (int i = 0; MapperTable[i].nMapperNo != -1; i++) {
+    if (MapperTable[i].nMapperNo == mapper) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void readNesMeta(const uint8_t* ines, rom_meta_t* meta) {
+  meta->system = ROM_META_NES;
+  if (memcmp(ines, "NES\x1a", 4) != 0) {
+    meta->status = ROM_META_BAD;
+    return;
+  }
+  // 与 InfoNES_Reset() 相同: 保留字节不为 0 时只用低 4 位
+  meta->mapper = ines[6] >> 4;
+  if (ines[12] == 0 && ines[13] == 0 && ines[14] == 0 && ines[15] == 0) {
+    meta->mapper |= ines[7] & 0xF0;
+  }
+  meta->mirroring = (ines[6] & 8) ? 2 : (ines[6] & 1);
+  meta->rom_size = ines[4] * 0x4000;
+  meta->chr_size = ines[5] * 0x2000;
+  meta->ram_size = (ines[6] & 2) ? 0x2000 : 0;
+  meta->status = nesMapperSupported(meta->mapper) ? ROM_META_OK : ROM_META_UNSUPPORTED;
+}
+
+static void readGbMeta(const uint8_t* header, rom_meta_t* meta) {
+  static const uint32_t ramSizes[] = {0, 2048, 8192, 32768, 131072, 65536};
+  meta->system = ROM_META_GB;
+
+  uint8_t checksum = 0;
+  for (uint16_t i = 0x134; i <= 0x14C; i++) {
+    checksum = checksum - header[i] - 1;
+  }
+  if (checksum != header[0x14D]) {
+    meta->status = ROM_META_BAD;
+    return;
+  }
+
+  memcpy(meta->title, &header[0x134], 16);
+  meta->title[16] = 0;
+  meta->cgb = header[0x143];
+  meta->mapper = header[0x147];
+  meta->rom_size = header[0x148] <= 8 ? (32768u << header[0x148]) : 0;
+  meta->ram_size = header[0x149] < 6 ? ramSizes[header[0x149]] : 0;
+
+  meta->status = gbCartSupported(meta->mapper) ? ROM_META_OK : ROM_META_UNSUPPORTED;
+#if !PEANUT_FULL_GBC_SUPPORT
+  if (meta->cgb == 0xC0) {
+    meta->status = ROM_META_UNSUPPORTED; // CGB only
+  }
+#endif
+}
+
+void RomIndex::readMeta(FsFile& file, const char* name, rom_meta_t* meta) {
+  memset(meta, 0, sizeof(*meta));
+  meta->status = ROM_META_BAD;
+  meta->system = hasExtension(name, nesExtensions) ? ROM_META_NES : ROM_META_GB;
+  if (!file.seekSet(0)) {
+    return;
+  }
+
+  if (RomContainer::isContainer(name)) {
+    rom_container_t header;
+    if (file.read(&header, sizeof(header)) != sizeof(header) || header.magic != ROM_CONTAINER_MAGIC
+        || RomLibrary::crc32(0, (const uint8_t*)&header, offsetof(rom_container_t, header_crc)) != header.header_crc) {
+      return;
+    }
+    if (header.system == ROM_CONTAINER_NES) {
+      readNesMeta(header.ines, meta);
+    } else {
+      meta->system = ROM_META_GB;
+      meta->cgb = header.cgb;
+      meta->mapper = header.mapper;
+      meta->rom_size = header.rom_size;
+      meta->ram_size = header.ram_size;
+      meta->status = gbCartSupported(header.mapper) ? ROM_META_OK : ROM_META_UNSUPPORTED;
+#if !PEANUT_FULL_GBC_SUPPORT
+      if (header.cgb == 0xC0) {
+        meta->status = ROM_META_UNSUPPORTED;
+      }
+#endif
+    }
+    memcpy(meta->title, header.title, sizeof(meta->title) - 1);
+    meta->title[sizeof(meta->title) - 1] = 0;
+    return;
+  }
+
+  if (meta->system == ROM_META_NES) {
+    uint8_t ines[16];
+    if (file.read(ines, sizeof(ines)) == sizeof(ines)) {
+      readNesMeta(ines, meta);
+    }
+  } else {
+    uint8_t header[0x150];
+    if (file.read(header, sizeof(header)) == sizeof(header)) {
+      readGbMeta(header, meta);
+    }
+  }
+}
+
+/**
+ * Walks the previous index in name order alongside the new one
+ */
+struct PreviousIndex {
+  FsFile entries;
+  FsFile names;
+  uint32_t remaining = 0;
+  bool valid = false; // entry and name hold the current old entry
+  rom_index_entry_t entry;
+  char name[ROM_INDEX_MAX_NAME + 1];
+
+  void open(const char* path) {
+    rom_index_header_t header;
+    if (!entries.open(path, O_RDONLY) || !names.open(path, O_RDONLY)
+        || entries.read(&header, sizeof(header)) != sizeof(header) || header.magic != ROM_INDEX_MAGIC
+        || header.version != ROM_INDEX_VERSION || !names.seekSet(header.names_offset)) {
+      return;
+    }
+    remaining = header.count;
+    next();
+  }
+
+  void next() {
+    valid = remaining > 0 && entries.read(&entry, sizeof(entry)) == sizeof(entry)
+        && entry.name_length <= ROM_INDEX_MAX_NAME
+        && names.read(name, entry.name_length + 1) == (int)entry.name_length + 1;
+    if (valid) {
+      remaining--;
+    }
+  }
+
+  // metadata of the unchanged file name, false when it is new or changed
+  bool find(const char* fileName, const rom_index_entry_t& e, rom_meta_t* meta) {
+    while (valid && strcasecmp(name, fileName) < 0) {
+      next();
+    }
+    if (!valid || strcmp(name, fileName) != 0 || entry.size != e.size || entry.mdate != e.mdate
+        || entry.mtime != e.mtime) {
+      return false;
+    }
+    *meta = entry.meta;
+    return true;
+  }
+
+  void close() {
+    if (entries.isOpen()) {
+      entries.close();
+    }
+    if (names.isOpen()) {
+      names.close();
+    }
+  }
+};
+
+bool RomIndex::rebuild(SdFs& sd, const char* dir, const char* const* extensions, const char* path) {
+  FsFile root;
+  FsFile file;
+  char name[ROM_INDEX_MAX_NAME + 1];
+
+  // 名字全部放进一块内存, 排序后按顺序写出
+  char* names = nullptr;
+  uint32_t namesSize = 0;
+  uint32_t namesCapacity = 0;
+  rom_index_entry_t* entries = nullptr;
+  uint32_t count = 0;
+  uint32_t capacity = 0;
+  uint32_t stamp = 0;
+  bool ok = root.open(dir);
+
+  while (ok && file.openNext(&root, O_RDONLY)) {
+    file.getName(name, sizeof(name));
+    if (file.isDir() || !hasExtension(name, extensions)) {
+      file.close();
+      continue;
+    }
+    if (count == 0xFFFF) {
+      // the menu pages count in uint16_t
+      file.close();
+      break;
+    }
+
+    uint32_t length = strlen(name);
+    if (namesSize + length + 1 > namesCapacity) {
+      namesCapacity = max(namesCapacity * 2, (uint32_t)4096);
+      char* grown = (char*)realloc(names, namesCapacity);
+      ok = grown != nullptr;
+      if (ok) {
+        names = grown;
+      }
+    }
+    if (ok && count == capacity) {
+      capacity = max(capacity * 2, (uint32_t)64);
+      rom_index_entry_t* grown = (rom_index_entry_t*)realloc(entries, capacity * sizeof(rom_index_entry_t));
+      ok = grown != nullptr;
+      if (ok) {
+        entries = grown;
+      }
+    }
+
+    if (ok) {
+      // the metadata is filled in while writing, only the name part is kept in RAM
+      rom_index_entry_t* e = &entries[count++];
+      memset(e, 0, offsetof(rom_index_entry_t, meta));
+      e->name_offset = namesSize;
+      e->name_length = length;
+      e->size = file.size();
+      file.getModifyDateTime(&e->mdate, &e->mtime);
+      memcpy(names + namesSize, name, length + 1);
+      namesSize += length + 1;
+
+      uint16_t date[2] = {e->mdate, e->mtime};
+      stamp = RomLibrary::crc32(stamp, (const uint8_t*)name, length + 1);
+      stamp = RomLibrary::crc32(stamp, (const uint8_t*)&e->size, sizeof(e->size));
+      stamp = RomLibrary::crc32(stamp, (const uint8_t*)date, sizeof(date));
+    }
+    file.close();
+  }
+  if (root.isOpen()) {
+    root.close();
+  }
+
+  char tmpPath[ROM_INDEX_MAX_NAME + 1];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+  if (ok) {
+    std::sort(entries, entries + count, [names](const rom_index_entry_t& a, const rom_index_entry_t& b) {
+      return strcasecmp(names + a.name_offset, names + b.name_offset) < 0;
+    });
+
+    PreviousIndex previous;
+    previous.open(path);
+    uint32_t parsed = 0;
+
+    rom_index_header_t header = {ROM_INDEX_MAGIC, ROM_INDEX_VERSION, count, stamp,
+        (uint32_t)(sizeof(rom_index_header_t) + count * sizeof(rom_index_entry_t))};
+    ok = file.open(tmpPath, O_RDWR | O_CREAT | O_TRUNC);
+    ok = ok && file.write(&header, sizeof(header)) == sizeof(header);
+
+    // 名字按排序后的顺序写, 一页的名字在文件里是连续的
+    uint32_t offset = 0;
+    for (uint32_t i = 0; ok && i < count; i++) {
+      rom_index_entry_t e = entries[i];
+      const char* entryName = names + e.name_offset;
+      if (!previous.find(entryName, e, &e.meta)) {
+        FsFile rom;
+        snprintf(name, sizeof(name), "%s%s", dir, entryName);
+        memset(&e.meta, 0, sizeof(e.meta));
+        e.meta.status = ROM_META_BAD;
+        if (rom.open(name, O_RDONLY)) {
+          readMeta(rom, entryName, &e.meta);
+          rom.close();
+        }
+        parsed++;
+      }
+      e.name_offset = offset;
+      offset += e.name_length + 1;
+      ok = file.write(&e, sizeof(e)) == sizeof(e);
+    }
+    previous.close();
+
+    for (uint32_t i = 0; ok && i < count; i++) {
+      const uint32_t len = entries[i].name_length + 1;
+      ok = file.write(names + entries[i].name_offset, len) == (int)len;
+    }
+    if (file.isOpen()) {
+      ok = file.close() && ok;
+    }
+    if (ok) {
+      sd.remove(path);
+      ok = sd.rename(tmpPath, path);
+    }
+    if (!ok) {
+      sd.remove(tmpPath);
+    }
+    Serial.printf("I rom index: %lu headers read, %lu reused\r\n", parsed, count - parsed);
+  }
+
+  free(entries);
+  free(names);
+  return ok;
+}
+
+uint16_t RomIndex::readNames(uint16_t first, uint16_t n, char (*names)[ROM_INDEX_MAX_NAME + 1], rom_meta_t* metas) {
+  if (!_file.isOpen() || first >= _header.count) {
+    return 0;
+  }
+  n = min(n, (uint16_t)ROM_INDEX_MAX_PAGE);
+  n = min(n, (uint16_t)(_header.count - first));
+
+  rom_index_entry_t entries[ROM_INDEX_MAX_PAGE];
+  const int entriesSize = n * sizeof(rom_index_entry_t);
+  if (!_file.seekSet(sizeof(rom_index_header_t) + first * sizeof(rom_index_entry_t))
+      || _file.read(entries, entriesSize) != entriesSize) {
+    return 0;
+  }
+
+  // 一页的名字是连续的, 一次定位后顺序读出
+  if (!_file.seekSet(_header.names_offset + entries[0].name_offset)) {
+    return 0;
+  }
+  for (uint16_t i = 0; i < n; i++) {
+    const int len = entries[i].name_length + 1;
+    if (len > ROM_INDEX_MAX_NAME + 1 || _file.read(names[i], len) != len) {
+      return i;
+    }
+    names[i][len - 1] = 0;
+    if (metas) {
+      metas[i] = entries[i].meta;
+    }
+  }
+  return n;
+}
+
+#endif
@@ -0,0 +1,84 @@
+#pragma once
+#if ENABLE_SDCARD
+#include "SdFat.h"
+
+#include <stdint.h>
+
+#define ROM_INDEX_NAME ".romindex"
+#define ROM_INDEX_MAGIC 0x58444952 // "RIDX"
+#define ROM_INDEX_VERSION 2
+#define ROM_INDEX_MAX_NAME 255
+#define ROM_INDEX_MAX_PAGE 16 // names returned by one readNames()
+
+struct rom_index_header_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;         // entries
+  uint32_t stamp;         // CRC-32 over names, sizes and dates of the listed files
+  uint32_t names_offset;  // file offset of the name blob
+};
+
+#define ROM_META_GB 0
+#define ROM_META_NES 1
+
+#define ROM_META_OK 0
+#define ROM_META_UNSUPPORTED 1 // valid, but this build cannot run it
+#define ROM_META_BAD 2         // header missing or broken
+
+// 从 ROM 头部取出的信息, 文件浏览器不用再打开 ROM
+struct rom_meta_t {
+  uint8_t system;         // ROM_META_GB / ROM_META_NES
+  uint8_t status;         // ROM_META_OK / ROM_META_UNSUPPORTED / ROM_META_BAD
+  uint8_t cgb;            // GB: CGB flag (0x143)
+  uint8_t mirroring;      // NES: 0 horizontal, 1 vertical, 2 four screen
+  uint16_t mapper;        // GB: cartridge type (0x147), NES: mapper number
+  uint16_t reserved;
+  uint32_t rom_size;      // GB: ROM bytes from the header, NES: PRG bytes
+  uint32_t chr_size;      // NES: CHR bytes
+  uint32_t ram_size;      // cartridge RAM bytes
+  char title[20];         // GB header or container title
+};
+
+// one ROM file, entries are sorted by name (case insensitive)
+struct rom_index_entry_t {
+  uint32_t name_offset;   // relative to names_offset, names are stored in entry order
+  uint16_t name_length;   // without the terminating 0
+  uint16_t mdate;
+  uint16_t mtime;
+  uint16_t reserved;
+  uint32_t size;
+  rom_meta_t meta;
+};
+
+/**
+ * Sorted listing of the ROM files of one directory, kept in an index file
+ * inside that directory. Listing a page is one seek and a sequential read
+ * instead of walking the directory from its first entry.
+ * FAT does not maintain directory timestamps reliably, so the index is
+ * checked against one pass over the directory when it is opened and
+ * rebuilt when any listed file was added, removed or changed.
+ * Each entry carries the header metadata of its ROM. A rebuild takes it
+ * over from the previous index for unchanged files and only reads the
+ * headers of new or modified ones.
+ */
+class RomIndex {
+public:
+  // extensions is a nullptr terminated list. false when no index could be built
+  bool open(SdFs& sd, const char* dir, const char* const* extensions);
+  void close();
+  bool isOpen() { return _file.isOpen(); }
+  uint16_t count() { return _header.count; }
+  // names (and metadata when metas is set) of entries first .. first + n - 1, returns how many were read
+  uint16_t readNames(uint16_t first, uint16_t n, char (*names)[ROM_INDEX_MAX_NAME + 1], rom_meta_t* metas = nullptr);
+
+  // parse the header of a .gb/.gbc/.nes/.pgc file
+  static void readMeta(FsFile& file, const char* name, rom_meta_t* meta);
+
+private:
+  bool rebuild(SdFs& sd, const char* dir, const char* const* extensions, const char* path);
+
+  FsFile _file;
+  rom_index_header_t _header = {};
+};
+
+#endif
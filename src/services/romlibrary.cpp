@@ -0,0 +1,228 @@
+#include "romlibrary.h"
+
+#if ENABLE_SDCARD
+#include <Arduino.h>
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+static_assert(sizeof(rom_library_t) <= ROM_LIBRARY_BYTES, "allocation table must fit its pages");
+static_assert(ROM_LIBRARY_BYTES <= ROM_LIBRARY_TABLE_SIZE, "allocation table must fit its sector");
+static_assert(ROM_LIBRARY_BYTES % FLASH_PAGE_SIZE == 0, "flash is programmed in whole pages");
+
+// RAM copy of the table while it is modified, kept off the stack of the loaders
+static union {
+  rom_library_t table;
+  uint8_t bytes[ROM_LIBRARY_BYTES];
+} scratch;
+
+static const uint8_t* tableSector() {
+  return &_FS_end - ROM_LIBRARY_TABLE_SIZE;
+}
+
+static uint32_t tableFlashOffset() {
+  return (uint32_t)tableSector() - XIP_BASE;
+}
+
+static const uint8_t* romStart(uint32_t offset) {
+  return &_FS_start + offset;
+}
+
+const rom_library_t* RomLibrary::stored() {
+  return (const rom_library_t*)tableSector();
+}
+
+rom_library_t* RomLibrary::load() {
+  rom_library_t* table = &scratch.table;
+  const rom_library_t* t = stored();
+  memset(scratch.bytes, 0xFF, sizeof(scratch.bytes));
+  if (t->magic == ROM_LIBRARY_MAGIC && t->version == ROM_LIBRARY_VERSION) {
+    memcpy(table, t, sizeof(*table));
+    return table;
+  }
+  memset(table, 0, sizeof(*table));
+  table->magic = ROM_LIBRARY_MAGIC;
+  table->version = ROM_LIBRARY_VERSION;
+  for (int i = 0; i < ROM_LIBRARY_SLOTS; i++) {
+    table->entries[i].offset = ROM_LIBRARY_FREE;
+  }
+  return table;
+}
+
+void RomLibrary::save() {
+  uint32_t ints = save_and_disable_interrupts();
+  flash_range_erase(tableFlashOffset(), FLASH_SECTOR_SIZE);
+  flash_range_program(tableFlashOffset(), scratch.bytes, sizeof(scratch.bytes));
+  restore_interrupts(ints);
+}
+
+const rom_library_entry_t* RomLibrary::entry(int slot) {
+  return &stored()->entries[slot];
+}
+
+int RomLibrary::find(const char* path, FsFile& file, uint32_t size, uint32_t format, uint32_t content,
+    FlashLoader& loader) {
+  const rom_library_t* t = stored();
+  uint16_t mdate = 0;
+  uint16_t mtime = 0;
+  file.getModifyDateTime(&mdate, &mtime);
+
+  if (t->magic != ROM_LIBRARY_MAGIC || t->version != ROM_LIBRARY_VERSION) {
+    return -1;
+  }
+  for (int i = 0; i < ROM_LIBRARY_SLOTS; i++) {
+    const rom_library_entry_t* e = &t->entries[i];
+    if (e->offset == ROM_LIBRARY_FREE || e->format != format) {
+      continue;
+    }
+    if (size && e->size != size) {
+      continue;
+    }
+    // 容器头里的 CRC 认得出同一个 ROM, 文件改名或重新拷贝后也不必重新编程
+    if (content) {
+      if (e->content != content) {
+        continue;
+      }
+    } else if (e->mdate != mdate || e->mtime != mtime || strncmp(e->path, path, sizeof(e->path)) != 0) {
+      continue;
+    }
+    if (e->offset + e->size > (uint32_t)MAX_ROM_SIZE) {
+      continue;
+    }
+    // 确认 flash 内容没有被固件升级等覆盖, 用 DMA 校验, 每次启动都要读完整个 ROM
+    if (loader.checksum(romStart(e->offset), e->size) == e->crc) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void RomLibrary::touch(int slot) {
+  rom_library_t* table = load();
+  // 重复启动同一个 ROM 时不必重写表扇区
+  if (table->entries[slot].used == table->stamp) {
+    return;
+  }
+  table->entries[slot].used = ++table->stamp;
+  save();
+}
+
+int32_t RomLibrary::allocate(const char* path, uint32_t size) {
+  size = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+  if (size > (uint32_t)MAX_ROM_SIZE) {
+    return -1;
+  }
+
+  rom_library_t* table = load();
+  rom_library_entry_t* entries = table->entries;
+
+  // 同一文件的旧副本已经过期
+  for (int i = 0; i < ROM_LIBRARY_SLOTS; i++) {
+    if (entries[i].offset != ROM_LIBRARY_FREE && strncmp(entries[i].path, path, sizeof(entries[i].path)) == 0) {
+      entries[i].offset = ROM_LIBRARY_FREE;
+    }
+  }
+
+  while (true) {
+    // resident extents sorted by offset
+    uint32_t starts[ROM_LIBRARY_SLOTS];
+    uint32_t ends[ROM_LIBRARY_SLOTS];
+    int count = 0;
+    for (int i = 0; i < ROM_LIBRARY_SLOTS; i++) {
+      const rom_library_entry_t* e = &entries[i];
+      if (e->offset == ROM_LIBRARY_FREE) {
+        continue;
+      }
+      int j = count++;
+      while (j > 0 && starts[j - 1] > e->offset) {
+        starts[j] = starts[j - 1];
+        ends[j] = ends[j - 1];
+        j--;
+      }
+      starts[j] = e->offset;
+      ends[j] = (e->offset + e->size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    }
+
+    // best fit: the smallest gap between resident ROMs that is large enough
+    int32_t best = -1;
+    uint32_t bestSize = 0;
+    uint32_t start = 0;
+    for (int i = 0; i <= count; i++) {
+      uint32_t end = i < count ? starts[i] : (uint32_t)MAX_ROM_SIZE;
+      if (end > start && end - start >= size && (best < 0 || end - start < bestSize)) {
+        best = start;
+        bestSize = end - start;
+      }
+      if (i < count && ends[i] > start) {
+        start = ends[i];
+      }
+    }
+
+    if (best >= 0 && count < ROM_LIBRARY_SLOTS) {
+      save();
+      return best;
+    }
+
+    // 空间或表项不足, 淘汰最久没玩的 ROM
+    int lru = -1;
+    for (int i = 0; i < ROM_LIBRARY_SLOTS; i++) {
+      if (entries[i].offset != ROM_LIBRARY_FREE && (lru < 0 || entries[i].used < entries[lru].used)) {
+        lru = i;
+      }
+    }
+    if (lru < 0) {
+      save();
+      return -1;
+    }
+    Serial.printf("I ROM library: evict %s\r\n", entries[lru].path);
+    entries[lru].offset = ROM_LIBRARY_FREE;
+  }
+}
+
+void RomLibrary::add(const char* path, FsFile& file, uint32_t offset, uint32_t size, uint32_t content,
+    FlashLoader& loader, uint32_t format) {
+  rom_library_t* table = load();
+
+  int slot = -1;
+  for (int i = 0; i < ROM_LIBRARY_SLOTS; i++) {
+    if (table->entries[i].offset == ROM_LIBRARY_FREE) {
+      slot = i;
+      break;
+    }
+  }
+  if (slot < 0) {
+    return;
+  }
+
+  rom_library_entry_t* e = &table->entries[slot];
+  e->offset = offset;
+  e->size = size;
+  e->format = format;
+  e->mdate = 0;
+  e->mtime = 0;
+  file.getModifyDateTime(&e->mdate, &e->mtime);
+  e->crc = loader.checksum(romStart(offset), size);
+  e->content = content;
+  e->used = ++table->stamp;
+  memset(e->path, 0, sizeof(e->path));
+  strncpy(e->path, path, sizeof(e->path) - 1);
+  save();
+}
+
+/**
+ * Standard CRC-32 (reflected, polynomial 0xEDB88320), nibble table driven
+ */
+uint32_t RomLibrary::crc32(uint32_t crc, const uint8_t* data, size_t len) {
+  static const uint32_t table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+  crc = ~crc;
+  for (size_t i = 0; i < len; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+#endif
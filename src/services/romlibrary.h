@@ -0,0 +1,71 @@
+#pragma once
+#if ENABLE_SDCARD
+#include "SdFat.h"
+#include "common.h"
+#include "flashloader.h"
+
+#include <stdint.h>
+
+#define ROM_LIBRARY_MAGIC 0x524C4942 // "RLIB"
+#define ROM_LIBRARY_VERSION 3
+#define ROM_LIBRARY_SLOTS 8
+#define ROM_LIBRARY_PATH_LENGTH 256
+#define ROM_LIBRARY_BYTES 2560 // programmed part of the table sector, whole pages
+#define ROM_LIBRARY_FREE 0xFFFFFFFF
+
+// flash 里 ROM 的存放方式
+#define ROM_FORMAT_RAW 0
+#define ROM_FORMAT_LZ4 1 // banks compressed one by one, see rompager.h
+
+// 一个常驻 flash 的 ROM
+struct rom_library_entry_t {
+  uint32_t offset;    // start in the ROM region, sector aligned, ROM_LIBRARY_FREE for an empty slot
+  uint32_t size;      // bytes held in flash
+  uint32_t format;    // ROM_FORMAT_*
+  uint16_t mdate;     // FAT modification date/time of the SD file
+  uint16_t mtime;
+  uint32_t crc;       // DMA sniffer checksum of the flash copy, see FlashLoader::checksum
+  uint32_t content;   // CRC-32 of the ROM from its container header, 0 for a plain ROM file
+  uint32_t used;      // LRU stamp, higher is more recent
+  char path[ROM_LIBRARY_PATH_LENGTH];
+};
+
+struct rom_library_t {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t stamp;
+  rom_library_entry_t entries[ROM_LIBRARY_SLOTS];
+};
+
+/**
+ * Keeps several ROMs resident in the flash ROM region at once. The allocation
+ * table lives in the last sector of the region, each ROM occupies a sector
+ * aligned extent. When no free extent is large enough the least recently
+ * played ROMs are evicted. An entry is removed before its extent is touched
+ * and added once programming completed, a partial load never looks valid.
+ */
+class RomLibrary {
+public:
+  /**
+   * slot holding this exact file stored as format (size 0: any size), -1 if none.
+   * With a content CRC any entry holding the same ROM matches, whatever its path and date.
+   */
+  int find(const char* path, FsFile& file, uint32_t size, uint32_t format, uint32_t content, FlashLoader& loader);
+  const rom_library_entry_t* entry(int slot);
+  // mark a slot as just played
+  void touch(int slot);
+  // reserve size bytes for path, evicting older ROMs if needed. Returns the ROM offset, -1 if too large
+  int32_t allocate(const char* path, uint32_t size);
+  // record the ROM programmed at offset
+  void add(const char* path, FsFile& file, uint32_t offset, uint32_t size, uint32_t content, FlashLoader& loader,
+      uint32_t format = ROM_FORMAT_RAW);
+
+  static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t len);
+
+private:
+  const rom_library_t* stored();
+  rom_library_t* load();
+  void save();
+};
+
+#endif
@@ -0,0 +1,220 @@
+#include "romsearch.h"
+
+#if ENABLE_SDCARD
+#include <Arduino.h>
+
+// decode the next name of a block into out, which holds the previous one
+static const uint8_t* decodeName(const uint8_t* p, char* out) {
+  uint8_t shared = p[0];
+  uint8_t length = p[1];
+  memcpy(out + shared, p + 2, length);
+  out[shared + length] = 0;
+  return p + 2 + length;
+}
+
+static uint8_t lowerChar(char c) {
+  return tolower((uint8_t)c);
+}
+
+bool RomSearch::append(const char* name, const char* previous) {
+  uint32_t length = strlen(name);
+  uint32_t shared = 0;
+  if (_count % ROM_SEARCH_BLOCK != 0) {
+    while (shared < length && name[shared] == previous[shared]) {
+      shared++;
+    }
+  } else {
+    _restarts[_count / ROM_SEARCH_BLOCK] = _blobSize;
+  }
+
+  const uint32_t needed = 2 + length - shared;
+  if (_blobSize + needed > _blobCapacity) {
+    uint32_t capacity = max(_blobCapacity * 2, _blobSize + needed);
+    uint8_t* grown = (uint8_t*)realloc(_blob, capacity);
+    if (grown == nullptr) {
+      return false;
+    }
+    _blob = grown;
+    _blobCapacity = capacity;
+  }
+  _blob[_blobSize] = shared;
+  _blob[_blobSize + 1] = length - shared;
+  memcpy(_blob + _blobSize + 2, name + shared, length - shared);
+  _blobSize += needed;
+  _count++;
+  return true;
+}
+
+bool RomSearch::load(RomIndex& index) {
+  clear();
+  if (!index.isOpen() || index.count() == 0) {
+    return false;
+  }
+
+  const uint16_t total = index.count();
+  char(*names)[ROM_INDEX_MAX_NAME + 1] = (char(*)[ROM_INDEX_MAX_NAME + 1])malloc(ROM_INDEX_MAX_PAGE * (ROM_INDEX_MAX_NAME + 1));
+  _restarts = (uint32_t*)malloc((total / ROM_SEARCH_BLOCK + 1) * sizeof(uint32_t));
+  // 文件名平均 20 多个字节, 压缩后大约一半
+  _blobCapacity = total * 16;
+  _blob = (uint8_t*)malloc(_blobCapacity);
+  bool ok = names != nullptr && _restarts != nullptr && _blob != nullptr;
+
+  // front coding predecessor, kept apart from the page buffer it outlives
+  char previous[ROM_INDEX_MAX_NAME + 1] = "";
+  for (uint16_t first = 0; ok && first < total; first += ROM_INDEX_MAX_PAGE) {
+    uint16_t n = index.readNames(first, min(total - first, ROM_INDEX_MAX_PAGE), names);
+    ok = n > 0;
+    for (uint16_t i = 0; ok && i < n; i++) {
+      ok = append(names[i], previous);
+      strcpy(previous, names[i]);
+    }
+  }
+  free(names);
+
+  if (!ok) {
+    Serial.printf("E rom search: not enough memory for %u names\r\n", total);
+    clear();
+    return false;
+  }
+  // give back what the estimate reserved too much
+  uint8_t* shrunk = (uint8_t*)realloc(_blob, _blobSize);
+  if (shrunk != nullptr) {
+    _blob = shrunk;
+    _blobCapacity = _blobSize;
+  }
+  Serial.printf("I rom search: %u names in %lu bytes\r\n", _count,
+      (unsigned long)(_blobSize + (_count / ROM_SEARCH_BLOCK + 1) * sizeof(uint32_t)));
+  return true;
+}
+
+void RomSearch::clear() {
+  free(_blob);
+  free(_restarts);
+  _blob = nullptr;
+  _restarts = nullptr;
+  _blobSize = 0;
+  _blobCapacity = 0;
+  _count = 0;
+}
+
+const uint8_t* RomSearch::seekBlock(uint16_t block, char* out) {
+  return decodeName(_blob + _restarts[block], out);
+}
+
+bool RomSearch::name(uint16_t pos, char* out, size_t size) {
+  if (pos >= _count) {
+    return false;
+  }
+  char current[ROM_INDEX_MAX_NAME + 1];
+  const uint8_t* p = seekBlock(pos / ROM_SEARCH_BLOCK, current);
+  for (uint16_t i = pos - pos % ROM_SEARCH_BLOCK; i < pos; i++) {
+    p = decodeName(p, current);
+  }
+  snprintf(out, size, "%s", current);
+  return true;
+}
+
+uint16_t RomSearch::lowerBound(const char* key) {
+  return search(key, SIZE_MAX, false);
+}
+
+// first position whose first length bytes compare above (after) or not below key
+uint16_t RomSearch::search(const char* key, size_t length, bool after) {
+  if (_count == 0) {
+    return 0;
+  }
+  char current[ROM_INDEX_MAX_NAME + 1];
+  auto before = [&]() {
+    int cmp = strncasecmp(current, key, length);
+    return after ? cmp <= 0 : cmp < 0;
+  };
+
+  // last block whose first name is before key
+  int32_t low = 0;
+  int32_t high = (_count - 1) / ROM_SEARCH_BLOCK;
+  int32_t block = -1;
+  while (low <= high) {
+    int32_t mid = (low + high) / 2;
+    seekBlock(mid, current);
+    if (before()) {
+      block = mid;
+      low = mid + 1;
+    } else {
+      high = mid - 1;
+    }
+  }
+  if (block < 0) {
+    return 0;
+  }
+
+  uint16_t pos = block * ROM_SEARCH_BLOCK;
+  const uint8_t* p = seekBlock(block, current);
+  const uint16_t end = min((uint32_t)_count, (uint32_t)(pos + ROM_SEARCH_BLOCK));
+  for (pos++; pos < end; pos++) {
+    p = decodeName(p, current);
+    if (!before()) {
+      break;
+    }
+  }
+  return pos;
+}
+
+int32_t RomSearch::find(const char* prefix) {
+  uint16_t pos = lowerBound(prefix);
+  char current[ROM_INDEX_MAX_NAME + 1];
+  if (!name(pos, current, sizeof(current)) || strncasecmp(current, prefix, strlen(prefix)) != 0) {
+    return -1;
+  }
+  return pos;
+}
+
+// the name at pos is longer than length and starts with the first length bytes of prefix
+bool RomSearch::hasPrefix(uint16_t pos, const char* prefix, size_t length) {
+  char current[ROM_INDEX_MAX_NAME + 1];
+  return name(pos, current, sizeof(current)) && strlen(current) > length && strncasecmp(current, prefix, length) == 0;
+}
+
+// first position after all names starting with the first length bytes of prefix
+uint16_t RomSearch::groupEnd(const char* prefix, size_t length) {
+  return length == 0 ? _count : search(prefix, length, true);
+}
+
+bool RomSearch::stepPrefix(char* prefix, bool forward) {
+  const size_t length = strlen(prefix);
+  if (length == 0 || length > ROM_SEARCH_MAX_PREFIX) {
+    return false;
+  }
+  const size_t parent = length - 1;
+
+  uint16_t pos;
+  if (forward) {
+    pos = groupEnd(prefix, length);
+    if (pos >= _count || !hasPrefix(pos, prefix, parent)) {
+      // wrap around to the first name of the parent group
+      pos = search(prefix, parent, false);
+      if (pos < _count && !hasPrefix(pos, prefix, parent)) {
+        pos++; // the parent prefix itself is a name, it sorts first
+      }
+    }
+  } else {
+    pos = lowerBound(prefix);
+    if (pos == 0 || !hasPrefix(pos - 1, prefix, parent)) {
+      // wrap around to the last name of the parent group
+      pos = groupEnd(prefix, parent);
+    }
+    if (pos == 0) {
+      return false;
+    }
+    pos--;
+  }
+  if (pos >= _count || !hasPrefix(pos, prefix, parent)) {
+    return false;
+  }
+
+  char current[ROM_INDEX_MAX_NAME + 1];
+  name(pos, current, sizeof(current));
+  prefix[parent] = lowerChar(current[parent]);
+  return true;
+}
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+#if ENABLE_SDCARD
+#include "romindex.h"
+
+#include <stdint.h>
+
+#define ROM_SEARCH_BLOCK 16 // names per restart point
+#define ROM_SEARCH_MAX_PREFIX 16
+
+/**
+ * The sorted names of a RomIndex kept in RAM for the file browser search.
+ * Names are front coded: each one stores how many bytes it shares with the
+ * previous name and the rest. Every ROM_SEARCH_BLOCK names a full name is
+ * stored as restart point, so a lookup is a binary search over the restart
+ * points and a short scan inside one block.
+ * Comparisons are case insensitive, the same order the index is sorted in.
+ */
+class RomSearch {
+public:
+  ~RomSearch() { clear(); }
+  // copy the names out of an open index, false when there is not enough RAM
+  bool load(RomIndex& index);
+  void clear();
+  bool isLoaded() { return _blob != nullptr; }
+  uint16_t count() { return _count; }
+  // position of the first name not below key, count() when there is none
+  uint16_t lowerBound(const char* key);
+  // position of the first name starting with prefix, -1 when there is none
+  int32_t find(const char* prefix);
+  // replace the last character of prefix by the next or previous one some name
+  // continues the rest of prefix with, wrapping around. false when there is none
+  bool stepPrefix(char* prefix, bool forward);
+  // copy the name at pos, false when pos is out of range
+  bool name(uint16_t pos, char* out, size_t size);
+
+private:
+  // decode the first name of block into out, returns where the next name is stored
+  const uint8_t* seekBlock(uint16_t block, char* out);
+  bool hasPrefix(uint16_t pos, const char* prefix, size_t length);
+  uint16_t groupEnd(const char* prefix, size_t length);
+  uint16_t search(const char* key, size_t length, bool after);
+  bool append(const char* name, const char* previous);
+
+  uint8_t* _blob = nullptr;      // per name: shared length, suffix length, suffix
+  uint32_t _blobSize = 0;
+  uint32_t _blobCapacity = 0;
+  uint32_t* _restarts = nullptr; // blob offset of every ROM_SEARCH_BLOCK-th name
+  uint16_t _count = 0;
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "romupload.h"
+
+#if ENABLE_SDCARD && ENABLE_SERIAL_ROM_UPLOAD
+#include <Arduino.h>
+#include "romlibrary.h"
+#if ENABLE_EXT_PSRAM
+#include "psram.h"
+#endif
+
+#define ROM_UPLOAD_HEADER_SIZE 5 // type, seq, len
+#define ROM_UPLOAD_START_SIZE 9  // size, crc, type, then the name
+
+static uint16_t getU16(const uint8_t* p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool RomUpload::readBytes(uint8_t* buffer, size_t len) {
+  return Serial.readBytes(buffer, len) == len;
+}
+
+void RomUpload::send(uint8_t type, uint16_t seq, const void* payload, uint16_t len) {
+  uint8_t header[2 + ROM_UPLOAD_HEADER_SIZE] = {ROM_UPLOAD_SYNC0, ROM_UPLOAD_SYNC1, type,
+      (uint8_t)seq, (uint8_t)(seq >> 8), (uint8_t)len, (uint8_t)(len >> 8)};
+  uint32_t crc = RomLibrary::crc32(0, header + 2, ROM_UPLOAD_HEADER_SIZE);
+  crc = RomLibrary::crc32(crc, (const uint8_t*)payload, len);
+  const uint8_t trailer[4] = {(uint8_t)crc, (uint8_t)(crc >> 8), (uint8_t)(crc >> 16), (uint8_t)(crc >> 24)};
+
+  Serial.write(header, sizeof(header));
+  if (len > 0) {
+    Serial.write((const uint8_t*)payload, len);
+  }
+  Serial.write(trailer, sizeof(trailer));
+  // 立即发出, 主机在等这个应答
+  Serial.flush();
+}
+
+/**
+ * Skip to the next sync, log lines and stray bytes in between are ignored
+ */
+bool RomUpload::readFrame(bool* valid) {
+  uint8_t previous = 0;
+  uint8_t c = 0;
+  do {
+    previous = c;
+    if (!readBytes(&c, 1)) {
+      return false;
+    }
+  } while (previous != ROM_UPLOAD_SYNC0 || c != ROM_UPLOAD_SYNC1);
+
+  uint8_t header[ROM_UPLOAD_HEADER_SIZE];
+  if (!readBytes(header, sizeof(header))) {
+    return false;
+  }
+  _frame.type = header[0];
+  _frame.seq = getU16(header + 1);
+  _frame.len = getU16(header + 3);
+  if (_frame.len > ROM_UPLOAD_CHUNK_SIZE) {
+    // a corrupted length, look for the next sync
+    *valid = false;
+    return true;
+  }
+
+  uint8_t trailer[4];
+  if (!readBytes(_frame.payload, _frame.len) || !readBytes(trailer, sizeof(trailer))) {
+    return false;
+  }
+  uint32_t crc = RomLibrary::crc32(0, header, sizeof(header));
+  crc = RomLibrary::crc32(crc, _frame.payload, _frame.len);
+  *valid = crc == getU32(trailer);
+  return true;
+}
+
+void RomUpload::abort(RomUploadStatus status) {
+  send(ROM_UPLOAD_ABORT, 0, &status, 1);
+  Serial.printf("E rom upload aborted (%u)\r\n", status);
+}
+
+bool RomUpload::begin() {
+  Serial.setTimeout(ROM_UPLOAD_TIMEOUT_MS);
+
+#if ENABLE_EXT_PSRAM
+  // like load_cart_rom_file_to_rom_and_PSRAM: GB ROMs continue in PSRAM above ROM_FLASH_SPLIT
+  const uint32_t maxSize = psram_size_bytes();
+#else
+  const uint32_t maxSize = MAX_ROM_SIZE;
+#endif
+  const uint8_t ready[7] = {(uint8_t)ROM_UPLOAD_CHUNK_SIZE, (uint8_t)(ROM_UPLOAD_CHUNK_SIZE >> 8), ROM_UPLOAD_WINDOW,
+      (uint8_t)maxSize, (uint8_t)(maxSize >> 8), (uint8_t)(maxSize >> 16), (uint8_t)(maxSize >> 24)};
+  send(ROM_UPLOAD_READY, 0, ready, sizeof(ready));
+
+  bool valid = false;
+  if (!readFrame(&valid)) {
+    abort(ROM_UPLOAD_TIMED_OUT);
+    return false;
+  }
+  if (!valid || _frame.type != ROM_UPLOAD_START || _frame.len <= ROM_UPLOAD_START_SIZE) {
+    abort(ROM_UPLOAD_BAD_START);
+    return false;
+  }
+
+  _size = getU32(_frame.payload);
+  _crc = getU32(_frame.payload + 4);
+  const uint8_t type = _frame.payload[8];
+  const uint16_t nameLength = min(_frame.len - ROM_UPLOAD_START_SIZE, ROM_UPLOAD_MAX_NAME);
+  memcpy(_name, _frame.payload + ROM_UPLOAD_START_SIZE, nameLength);
+  _name[nameLength] = 0;
+
+  // the name becomes part of save file paths
+  if (_size == 0 || type > GameType_NES || strlen(_name) != nameLength || strchr(_name, '/') != nullptr) {
+    abort(ROM_UPLOAD_BAD_START);
+    return false;
+  }
+  _type = (GameType)type;
+  _flashSize = _size;
+  bool tooLarge = _size > maxSize;
+#if ENABLE_EXT_PSRAM
+  if (_type == GameType_GB) {
+    _flashSize = min(_size, ROM_FLASH_SPLIT);
+  } else {
+    // NES reads its banks through pointers, PSRAM is not mapped
+    tooLarge = _size > ROM_FLASH_SPLIT;
+  }
+#endif
+  if (tooLarge) {
+    abort(ROM_UPLOAD_TOO_LARGE);
+    return false;
+  }
+  Serial.printf("I rom upload: %s, %lu bytes\r\n", _name, _size);
+  return true;
+}
+
+void RomUpload::flushSector(FlashLoader& loader, const uint8_t* sector, uint32_t offset) {
+#if ENABLE_EXT_PSRAM
+  if (offset >= _flashSize) {
+    // PSRAM 地址就是 ROM 地址, 见 gb_rom_read
+    if (!psram_write(offset, sector, FLASH_SECTOR_SIZE)) {
+      error("psram: psram_write failed");
+    }
+  } else
+#endif
+  {
+    loader.writeSector(sector, offset);
+  }
+  // 每 64KiB 刷新一次进度
+  if (_onChunk && (offset + FLASH_SECTOR_SIZE) % FLASH_BLOCK_SIZE == 0) {
+    _onChunk(offset + FLASH_SECTOR_SIZE);
+  }
+}
+
+bool RomUpload::receive(FlashLoader& loader, std::function<void(uint32_t offset)> onChunk) {
+  _onChunk = onChunk;
+  uint8_t* sectors = (uint8_t*)malloc(2 * FLASH_SECTOR_SIZE);
+  if (sectors == nullptr) {
+    abort(ROM_UPLOAD_NO_MEMORY);
+    return false;
+  }
+#if ENABLE_EXT_PSRAM
+  // 和从 SD 卡装载一样, 读缓存从空开始
+  if (!psram_init()) {
+    error("PSRAM init failed");
+  }
+#endif
+
+  const uint32_t chunks = (_size + ROM_UPLOAD_CHUNK_SIZE - 1) / ROM_UPLOAD_CHUNK_SIZE;
+  const uint32_t started = millis();
+  const uint32_t sectorsBefore = loader.sectorsWritten();
+  uint32_t expected = 0;
+  bool nakSent = false;
+  uint8_t* fill = sectors;
+  const uint8_t* pending = nullptr; // full sector waiting to be programmed
+  uint32_t pendingOffset = 0;
+
+  send(ROM_UPLOAD_ACK, 0);
+  while (expected < chunks) {
+    bool valid = false;
+    if (!readFrame(&valid)) {
+      free(sectors);
+      abort(ROM_UPLOAD_TIMED_OUT);
+      return false;
+    }
+    if (valid && _frame.type == ROM_UPLOAD_DATA && _frame.seq < expected) {
+      // a resend after a lost ack
+      send(ROM_UPLOAD_ACK, expected);
+      continue;
+    }
+
+    const uint32_t offset = expected * ROM_UPLOAD_CHUNK_SIZE;
+    const uint32_t length = min(_size - offset, (uint32_t)ROM_UPLOAD_CHUNK_SIZE);
+    if (!valid || _frame.type != ROM_UPLOAD_DATA || _frame.seq != expected || _frame.len != length) {
+      // go back to the first missing chunk, once until it arrives
+      if (!nakSent) {
+        send(ROM_UPLOAD_NAK, expected);
+        nakSent = true;
+      }
+      continue;
+    }
+
+    const uint32_t at = offset % FLASH_SECTOR_SIZE;
+    memcpy(fill + at, _frame.payload, length);
+    expected++;
+    nakSent = false;
+    if (expected < chunks && at + length < FLASH_SECTOR_SIZE) {
+      continue;
+    }
+
+    // 扇区收满: 先应答让主机继续发送, 再编程上一个扇区
+    memset(fill + at + length, 0xFF, FLASH_SECTOR_SIZE - at - length);
+    send(ROM_UPLOAD_ACK, expected);
+    if (pending != nullptr) {
+      flushSector(loader, pending, pendingOffset);
+    }
+    pending = fill;
+    pendingOffset = offset - at;
+    fill = fill == sectors ? sectors + FLASH_SECTOR_SIZE : sectors;
+  }
+  flushSector(loader, pending, pendingOffset);
+
+  uint32_t crc = RomLibrary::crc32(0, RS_rom, _flashSize);
+#if ENABLE_EXT_PSRAM
+  for (uint32_t offset = _flashSize; offset < _size; offset += FLASH_SECTOR_SIZE) {
+    const uint32_t length = min(_size - offset, (uint32_t)FLASH_SECTOR_SIZE);
+    psram_read(offset, sectors, length);
+    crc = RomLibrary::crc32(crc, sectors, length);
+  }
+#endif
+  free(sectors);
+  if (crc != _crc) {
+    abort(ROM_UPLOAD_CRC_MISMATCH);
+    return false;
+  }
+  const uint8_t status = ROM_UPLOAD_OK;
+  send(ROM_UPLOAD_DONE, 0, &status, 1);
+  Serial.printf("I rom upload: %lu bytes in %lu ms, %lu sectors reprogrammed\r\n", _size, millis() - started,
+      loader.sectorsWritten() - sectorsBefore);
+  return true;
+}
+
+#endif
@@ -0,0 +1,89 @@
+#pragma once
+#if ENABLE_SDCARD && ENABLE_SERIAL_ROM_UPLOAD
+#include "common.h"
+#include "flashloader.h"
+#include "hardware/flash.h"
+
+#include <functional>
+#include <stdint.h>
+
+// 帧格式: A5 5A | type | seq (u16) | len (u16) | payload | crc32 (u32), 小端
+#define ROM_UPLOAD_SYNC0 0xA5
+#define ROM_UPLOAD_SYNC1 0x5A
+#define ROM_UPLOAD_CHUNK_SIZE 1024 // data payload, a sector holds a whole number of chunks
+#define ROM_UPLOAD_WINDOW 8        // data frames the host may send ahead of the last ack
+#define ROM_UPLOAD_TIMEOUT_MS 3000 // no frame for this long aborts the upload
+#define ROM_UPLOAD_MAX_NAME 64
+
+// frame types, host to device
+#define ROM_UPLOAD_START 'S' // u32 size, u32 crc32 of the ROM, u8 GameType, name
+#define ROM_UPLOAD_DATA 'D'  // seq: chunk number
+// device to host
+#define ROM_UPLOAD_READY 'R' // u16 chunk size, u8 window, u32 largest ROM
+#define ROM_UPLOAD_ACK 'A'   // seq: next chunk expected, everything before it is received
+#define ROM_UPLOAD_NAK 'N'   // seq: resend from this chunk on
+#define ROM_UPLOAD_DONE 'F'  // u8 status, ROM_UPLOAD_OK when the ROM is in flash
+#define ROM_UPLOAD_ABORT 'X' // u8 status
+
+enum RomUploadStatus : uint8_t {
+  ROM_UPLOAD_OK,
+  ROM_UPLOAD_TOO_LARGE,
+  ROM_UPLOAD_BAD_START,
+  ROM_UPLOAD_TIMED_OUT,
+  ROM_UPLOAD_CRC_MISMATCH,
+  ROM_UPLOAD_NO_MEMORY,
+};
+
+static_assert(FLASH_SECTOR_SIZE % ROM_UPLOAD_CHUNK_SIZE == 0, "chunks fill whole sectors");
+
+/**
+ * Receives a ROM over the USB CDC serial port and programs it straight into
+ * the flash ROM region (RS_rom), the SD card is not involved. With
+ * ENABLE_EXT_PSRAM the part of a GB ROM above ROM_FLASH_SPLIT goes to PSRAM.
+ * The host streams framed chunks with a CRC each, up to ROM_UPLOAD_WINDOW
+ * ahead of the last acknowledgement (go-back-N: a bad or missing chunk is
+ * NAKed and everything from it on is sent again).
+ * Chunks are collected in two sector buffers. A full sector is acknowledged
+ * first and programmed once the next one is complete, so the host keeps
+ * streaming into the other buffer and the USB FIFO while flash is erased.
+ */
+class RomUpload {
+public:
+  /**
+   * answer the 'U' serial command and read the start frame, false when the
+   * host did not follow up with a valid one
+   */
+  bool begin();
+  // program the ROM at RS_rom, true when flash holds it with the announced CRC
+  bool receive(FlashLoader& loader, std::function<void(uint32_t offset)> onChunk);
+
+  uint32_t size() { return _size; }
+  // the part of the ROM that goes to flash, the rest is in PSRAM (ENABLE_EXT_PSRAM)
+  uint32_t flashSize() { return _flashSize; }
+  GameType type() { return _type; }
+  const char* name() { return _name; }
+
+private:
+  // read one frame into _frame, false on timeout. *valid is false for a CRC error
+  bool readFrame(bool* valid);
+  bool readBytes(uint8_t* buffer, size_t len);
+  void send(uint8_t type, uint16_t seq, const void* payload = nullptr, uint16_t len = 0);
+  void abort(RomUploadStatus status);
+  void flushSector(FlashLoader& loader, const uint8_t* sector, uint32_t offset);
+
+  struct {
+    uint8_t type;
+    uint16_t seq;
+    uint16_t len;
+    uint8_t payload[ROM_UPLOAD_CHUNK_SIZE];
+  } _frame;
+
+  std::function<void(uint32_t offset)> _onChunk;
+  uint32_t _size = 0;
+  uint32_t _flashSize = 0;
+  uint32_t _crc = 0;
+  GameType _type = GameType_GB;
+  char _name[ROM_UPLOAD_MAX_NAME + 1];
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "sdioservice.h"
+
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+#include <Arduino.h>
+#if ENABLE_EXT_PSRAM
+#include "psram.h"
+#endif
+
+bool SdIoService::submit(SdIoOp op, const char* path, const void* buffer, uint32_t offset, uint32_t size,
+    SdIoCallback callback, bool ownsBuffer) {
+  if ((uint8_t)(_tail - _head) >= SD_IO_QUEUE_LENGTH || strlen(path) >= SD_IO_MAX_PATH) {
+    return false;
+  }
+  if ((op == SD_IO_WRITE || op == SD_IO_APPEND) && _chunk == nullptr) {
+    // 首次写入时分配, 之后保留
+    _chunk = (uint8_t*)malloc(SD_IO_CHUNK_SIZE);
+    if (_chunk == nullptr) {
+      return false;
+    }
+  }
+
+  sd_io_request_t& request = at(_tail);
+  request.op = op;
+  request.ok = true;
+  request.ownsBuffer = ownsBuffer;
+  strcpy(request.path, path);
+  request.buffer = (uint8_t*)buffer;
+  request.offset = offset;
+  request.size = size;
+  request.done = 0;
+  request.callback = callback;
+  _tail++;
+  return true;
+}
+
+bool SdIoService::read(const char* path, void* buffer, uint32_t offset, uint32_t size, SdIoCallback callback) {
+  return submit(SD_IO_READ, path, buffer, offset, size, callback, false);
+}
+
+bool SdIoService::write(const char* path, const void* data, uint32_t offset, uint32_t size, SdIoCallback callback,
+    bool ownsBuffer) {
+  return submit(SD_IO_WRITE, path, data, offset, size, callback, ownsBuffer);
+}
+
+bool SdIoService::append(const char* path, const void* data, uint32_t size, SdIoCallback callback, bool ownsBuffer) {
+  return submit(SD_IO_APPEND, path, data, 0, size, callback, ownsBuffer);
+}
+
+bool SdIoService::flush(const char* path, SdIoCallback callback) {
+  return submit(SD_IO_FLUSH, path, nullptr, 0, 0, callback, false);
+}
+
+bool SdIoService::openFile(const char* path, bool writable) {
+  if (_file.isOpen() && strcmp(_path, path) == 0 && (_writable || !writable)) {
+    return true;
+  }
+  closeFile();
+  if (!_file.open(path, writable ? O_RDWR | O_CREAT : O_RDONLY)) {
+    return false;
+  }
+  strcpy(_path, path);
+  _writable = writable;
+  return true;
+}
+
+bool SdIoService::closeFile() {
+  bool ok = true;
+  if (_file.isOpen()) {
+    ok = _file.close();
+  }
+  _path[0] = 0;
+  return ok;
+}
+
+void SdIoService::complete(sd_io_request_t& request) {
+  if (!request.ok) {
+    Serial.printf("E sd io: %s failed\r\n", request.path);
+  }
+  if (request.ownsBuffer) {
+    free(request.buffer);
+  }
+  if (request.callback) {
+    request.callback(request.ok);
+    request.callback = nullptr;
+  }
+}
+
+/**
+ * Complete the request at the cursor, only called when no copied write
+ * is waiting in front of it
+ */
+void SdIoService::finishCursor() {
+  sd_io_request_t& request = at(_cursor);
+  _cursor++;
+  _head = _cursor;
+  complete(request);
+}
+
+/**
+ * Write the staging chunk. Its last bytes belong to the writes between head
+ * and cursor, which are done with it. A write the cursor is still copying
+ * fails as a whole when its first part could not be written.
+ */
+bool SdIoService::writePending() {
+  bool ok = _file.seekSet(_pendingOffset) && _file.write(_chunk, _pendingSize) == _pendingSize;
+  _pendingSize = 0;
+
+  while (_head != _cursor) {
+    sd_io_request_t& request = at(_head);
+    _head++;
+    request.ok = request.ok && ok;
+    complete(request);
+  }
+  if (!ok && _cursor != _tail && at(_cursor).done > 0) {
+    at(_cursor).ok = false;
+  }
+  return ok;
+}
+
+/**
+ * Work on the request at the cursor, true when a card transfer was made
+ */
+bool SdIoService::step(sd_io_request_t& request) {
+  const bool isWrite = request.op == SD_IO_WRITE || request.op == SD_IO_APPEND;
+  // 先把暂存块写出: 换文件, 读, flush, 或者不连续的写入
+  if (_pendingSize > 0 && (!isWrite || strcmp(request.path, _path) != 0)) {
+    writePending();
+    return true;
+  }
+  if (!request.ok) {
+    finishCursor();
+    return false;
+  }
+
+  if (request.op == SD_IO_FLUSH) {
+    bool closed = _file.isOpen() && strcmp(request.path, _path) == 0;
+    if (closed) {
+      request.ok = closeFile();
+    }
+    finishCursor();
+    return closed;
+  }
+
+  if (!openFile(request.path, isWrite)) {
+    request.ok = false;
+    finishCursor();
+    return false;
+  }
+
+  if (request.op == SD_IO_READ) {
+    uint32_t n = min(request.size - request.done, (uint32_t)SD_IO_CHUNK_SIZE);
+    request.ok = _file.seekSet(request.offset + request.done)
+        && _file.read(request.buffer + request.done, n) == (int)n;
+    request.done += n;
+    if (!request.ok || request.done == request.size) {
+      finishCursor();
+    }
+    return true;
+  }
+
+  if (request.op == SD_IO_APPEND) {
+    // the staging chunk may extend the file
+    request.offset = max((uint32_t)_file.fileSize(), _pendingSize > 0 ? _pendingOffset + _pendingSize : 0);
+    request.op = SD_IO_WRITE;
+  }
+  if (request.size == 0 && _pendingSize == 0) {
+    finishCursor();
+    return false;
+  }
+  const uint32_t position = request.offset + request.done;
+  if (_pendingSize > 0 && position != _pendingOffset + _pendingSize) {
+    writePending();
+    return true;
+  }
+  if (_pendingSize == 0) {
+    _pendingOffset = position;
+  }
+
+  // 暂存块在下一个对齐边界结束
+  const uint32_t boundary = (_pendingOffset / SD_IO_CHUNK_SIZE + 1) * SD_IO_CHUNK_SIZE;
+  const uint32_t n = min(request.size - request.done, boundary - position);
+  memcpy(_chunk + _pendingSize, request.buffer + request.done, n);
+  _pendingSize += n;
+  request.done += n;
+  if (request.done == request.size) {
+    _cursor++;
+  }
+  if (_pendingOffset + _pendingSize == boundary) {
+    writePending();
+    return true;
+  }
+  return false;
+}
+
+bool SdIoService::poll() {
+#if ENABLE_EXT_PSRAM
+  // the card shares SPI1 with the PSRAM read ahead
+  psram_wait();
+#endif
+  while (_cursor != _tail) {
+    if (step(at(_cursor))) {
+      return true;
+    }
+  }
+  if (_pendingSize > 0) {
+    writePending();
+    return true;
+  }
+  // 队列空了才关闭文件, 目录项只更新一次
+  if (_file.isOpen()) {
+    closeFile();
+    return true;
+  }
+  return false;
+}
+
+void SdIoService::waitIdle() {
+  while (poll()) {
+  }
+}
+
+#endif
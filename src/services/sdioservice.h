@@ -0,0 +1,90 @@
+#pragma once
+#if ENABLE_SDCARD && ENABLE_SD_ASYNC_IO
+#include "SdFat.h"
+#include "baseservice.h"
+
+#include <stdint.h>
+
+// 队列中最多的请求数, 满了以后调用方改为同步读写
+#define SD_IO_QUEUE_LENGTH 8
+// 一次 poll 最多读写一个块, 写入按块在文件中对齐
+#define SD_IO_CHUNK_SIZE 4096
+#define SD_IO_MAX_PATH 64
+
+enum SdIoOp : uint8_t {
+  SD_IO_READ,
+  SD_IO_WRITE,
+  SD_IO_APPEND,
+  SD_IO_FLUSH,
+};
+
+// ok is false when the request failed, called from poll()
+typedef std::function<void(bool ok)> SdIoCallback;
+
+struct sd_io_request_t {
+  SdIoOp op;
+  bool ok;
+  bool ownsBuffer; // free(buffer) when the request completes
+  char path[SD_IO_MAX_PATH];
+  uint8_t* buffer; // read: destination, write/append: source
+  uint32_t offset; // file offset, append: resolved when the request starts
+  uint32_t size;
+  uint32_t done;
+  SdIoCallback callback;
+};
+
+/**
+ * Bounded queue of SD card requests, worked off in small steps from the
+ * frame slack time so a save never stalls emulation for the whole write.
+ * Every poll() does at most one card transfer of up to SD_IO_CHUNK_SIZE
+ * bytes. Contiguous writes to the same file are gathered in a staging chunk
+ * and written at SD_IO_CHUNK_SIZE aligned boundaries, so several small save
+ * regions become a few cluster sized writes.
+ * Requests run in order, a read sees the writes queued before it. Buffers
+ * must stay valid and unchanged until the callback, unless ownsBuffer hands
+ * them over. Core0 only, like every other SdFat user.
+ */
+class SdIoService {
+public:
+  // false when the queue is full or there is no memory for the staging chunk
+  bool read(const char* path, void* buffer, uint32_t offset, uint32_t size, SdIoCallback callback = nullptr);
+  bool write(const char* path, const void* data, uint32_t offset, uint32_t size, SdIoCallback callback = nullptr,
+      bool ownsBuffer = false);
+  bool append(const char* path, const void* data, uint32_t size, SdIoCallback callback = nullptr,
+      bool ownsBuffer = false);
+  // write out everything queued for path and close it
+  bool flush(const char* path, SdIoCallback callback = nullptr);
+
+  // one step of work, false when there was nothing to do
+  bool poll();
+  // finish all requests, before synchronous card access or a reboot
+  void waitIdle();
+  bool isIdle() { return _head == _tail && _pendingSize == 0 && !_file.isOpen(); }
+  uint8_t pending() { return _tail - _head; }
+
+private:
+  bool submit(SdIoOp op, const char* path, const void* buffer, uint32_t offset, uint32_t size,
+      SdIoCallback callback, bool ownsBuffer);
+  sd_io_request_t& at(uint8_t index) { return _queue[index % SD_IO_QUEUE_LENGTH]; }
+  bool openFile(const char* path, bool writable);
+  bool closeFile();
+  bool writePending();
+  void complete(sd_io_request_t& request);
+  void finishCursor();
+  bool step(sd_io_request_t& request);
+
+  sd_io_request_t _queue[SD_IO_QUEUE_LENGTH];
+  // free running, _head: oldest request, _cursor: request being worked on
+  uint8_t _head = 0;
+  uint8_t _cursor = 0;
+  uint8_t _tail = 0;
+
+  FsFile _file;
+  char _path[SD_IO_MAX_PATH] = "";
+  bool _writable = false;
+  uint8_t* _chunk = nullptr;
+  uint32_t _pendingOffset = 0; // file offset of _chunk[0]
+  uint32_t _pendingSize = 0;
+};
+
+#endif
@@ -10,6 +10,7 @@
  */
 uint16_t* stream;
 i2s_config_t i2s_config;
+static const uint32_t sampleRates[AUDIO_SAMPLE_RATE_COUNT] = {22050, 32000, 44100};
 SoundService::SoundService() { // 使用 memset 确保所有成员都被清零，避免未定义行为
   memset(&i2s_config, 0, sizeof(i2s_config_t));
 }
@@ -24,31 +25,242 @@ void SoundService::initSound() {
 
   // Initialize I2S sound driver
   i2s_config = i2s_get_default_config();
-  i2s_config.sample_freq = AUDIO_SAMPLE_RATE;
-  i2s_config.dma_trans_count = AUDIO_SAMPLES;
+  i2s_config.sample_freq = sampleRates[_sampleRateIndex];
   i2s_config.data_pin = I2S_DIN_PIN,
   i2s_config.clock_pin_base = I2S_BCLK_LRC_PIN_BASE;
   // 尝试使用PIO1，如果失败则使用PIO2
   i2s_config.pio = pio1; // 使用PIO1专门处理I2S，避免与TFT_eSPI的PIO0冲突
   i2s_config.volume = 5;
   i2s_init(&i2s_config);
+  audio_resampler_init(&_resampler, AUDIO_TARGET_FILL);
 
   Serial.println("Sound initialized");
 }
 
 void SoundService::handleSoundLoop() {
+#if ENABLE_AUDIO_CORE1
+  // GB: 本帧的寄存器写入日志交给 core1 合成, 上一帧未完成时在此等待
+  if (_core1Job) {
+    audio_frame_close();
+    paceFrame();
+    return;
+  }
+#endif
+  if (!_audioCallback) {
+    return;
+  }
   if (i2s_config.volume != 16) {
-    if(_audioCallback){
-      _audioCallback(NULL, (int16_t*)stream, AUDIO_BUFFER_SIZE_BYTES);
-      i2s_dma_write(&i2s_config, (int16_t*)stream);
+#if ENABLE_AUDIO_TELEMETRY
+    uint32_t telemetry = audio_telemetry_start();
+#endif
+    _audioCallback(NULL, (int16_t*)stream, AUDIO_BUFFER_SIZE_BYTES);
+#if ENABLE_AUDIO_TELEMETRY
+    audio_telemetry_stop(&audio_telemetry.synth_us, telemetry);
+#endif
+  } else {
+    // 静音时仍然推送静音帧, 帧定时按推送的音频长度计算
+    memset(stream, 0, AUDIO_BUFFER_SIZE_BYTES);
+  }
+  paceFrame();
+  pushFrames((int16_t*)stream, audio_frame_samples());
+}
+
+uint32_t SoundService::getUnderrunCount() {
+  return i2s_config.underrun_count;
+}
+
+uint32_t SoundService::getOverrunCount() {
+  return i2s_config.overrun_count;
+}
+
+/**
+ * Resample frames x 2 x 16 bits interleaved samples into the I2S ring
+ */
+uint32_t __not_in_flash_func(SoundService::pushFrames)(const int16_t* samples, uint32_t frames) {
+#if ENABLE_AUDIO_CAPTURE
+  _capture.write(samples, frames);
+#endif
+  _pushedFrames += frames;
+  uint32_t dropped = 0;
+  uint32_t written = audio_resampler_process(&_resampler, samples, frames, &i2s_config.ring, i2s_config.volume, &dropped);
+  if (dropped) {
+    i2s_config.overrun_count++;
+  }
+  return written;
+}
+
+/**
+ * Called once per emulated frame: hold the emulator until the frame deadline,
+ * which advances by the duration of the audio pushed since the last call at
+ * the nominal sample rate. The resampler absorbs the drift between that
+ * timer and the I2S clock, steered by the ring fill sampled right at the
+ * deadline and averaged over frames.
+ * After a stall or at start the ring is refilled to its target without
+ * waiting. The wait queues the capture chunks, then runs the idle callback
+ * which writes them out with the other SD requests.
+ */
+void SoundService::paceFrame() {
+#if ENABLE_AUDIO_TELEMETRY
+  audio_telemetry_frame(&i2s_config.ring);
+#endif
+  const uint32_t pushed = _pushedFrames - _pacedFrames;
+  _pacedFrames += pushed;
+  const uint64_t scaled = (uint64_t)pushed * 1000000 + _paceRemainder;
+  const uint32_t rate = getSampleRate();
+  _frameDeadline += scaled / rate;
+  _paceRemainder = scaled % rate;
+
+  uint32_t fill = audio_ring_fill(&i2s_config.ring);
+  if (fill < _resampler.target_fill / 4) {
+    _catchUp = true;
+  }
+  if (_catchUp) {
+    if (fill < _resampler.target_fill) {
+      return;
+    }
+    _catchUp = false;
+    _frameDeadline = time_us_32();
+    _fillAverage = fill << AUDIO_FILL_AVERAGE_SHIFT;
+  }
+  if ((int32_t)(time_us_32() - _frameDeadline) > (int32_t)(AUDIO_TARGET_FILL * 1000000ull / rate)) {
+    // 落后太多 (例如读卡), 不追赶
+    _frameDeadline = time_us_32();
+  }
+
+  while ((int32_t)(_frameDeadline - time_us_32()) > 0) {
+    bool busy = false;
+#if ENABLE_AUDIO_CAPTURE
+    busy = _capture.flushChunk();
+#endif
+    if (!busy && !(_idleCallback && _idleCallback())) {
+      tight_loop_contents();
+    }
+  }
+
+  fill = audio_ring_fill(&i2s_config.ring);
+  _fillAverage += fill - (_fillAverage >> AUDIO_FILL_AVERAGE_SHIFT);
+  audio_resampler_adjust(&_resampler, _fillAverage >> AUDIO_FILL_AVERAGE_SHIFT);
+}
+
+/**
+ * Current ratio, Q16 input frames per output frame
+ */
+uint32_t SoundService::getResampleStep() {
+  return _resampler.step;
+}
+
+audio_ring_t* SoundService::getRing() {
+  return &i2s_config.ring;
+}
+
+uint32_t SoundService::getRingFill() {
+  return audio_ring_fill(&i2s_config.ring);
+}
+
+uint32_t SoundService::getRingMinFill() {
+  return i2s_config.ring.min_fill;
+}
+
+uint32_t SoundService::getRingMaxFill() {
+  return i2s_config.ring.max_fill;
+}
+
+void SoundService::resetRingStats() {
+  audio_ring_reset_stats(&i2s_config.ring);
+}
+
+#if ENABLE_AUDIO_CAPTURE
+bool SoundService::toggleCapture() {
+  if (_capture.isActive()) {
+    _capture.stop();
+    return false;
+  }
+  return _capture.start(getSampleRate());
+}
+#endif
+
+#if ENABLE_AUDIO_TELEMETRY
+bool SoundService::toggleTelemetry() {
+  audio_telemetry_reset();
+  audio_telemetry.enabled = !audio_telemetry.enabled;
+  return audio_telemetry.enabled;
+}
+
+static void printHistogram(const char* name, const audio_histogram_t* h) {
+  if (h->count == 0) {
+    Serial.printf("%-9s -\r\n", name);
+    return;
+  }
+  Serial.printf("%-9s n=%lu avg=%lu max=%lu |", name, h->count, (uint32_t)(h->sum / h->count), h->max);
+  for (uint8_t i = 0; i < AUDIO_HISTOGRAM_BINS; i++) {
+    if (h->bins[i]) {
+      Serial.printf(" <%lu:%lu", 1ul << i, h->bins[i]);
     }
   }
+  Serial.printf("\r\n");
 }
 
+/**
+ * Histograms since the last report, bins are powers of 2 (upper bound:count)
+ */
+void SoundService::printTelemetry() {
+  if (!audio_telemetry.enabled) {
+    Serial.printf("Audio telemetry off, 't' to start\r\n");
+    return;
+  }
+  printHistogram("fill", &audio_telemetry.fill);
+  printHistogram("produced", &audio_telemetry.produced);
+  printHistogram("consumed", &audio_telemetry.consumed);
+  printHistogram("frame_us", &audio_telemetry.frame_us);
+  printHistogram("synth_us", &audio_telemetry.synth_us);
+  printHistogram("hsync_us", &audio_telemetry.hsync_us);
+  audio_telemetry_reset();
+}
+#endif
+
 uint8_t SoundService::getVolume() {
   return i2s_config.volume;
 }
 
+uint32_t SoundService::getSampleRate() {
+  return sampleRates[_sampleRateIndex];
+}
+
+void SoundService::setSampleRate(uint32_t rate) {
+  for (uint8_t i = 0; i < AUDIO_SAMPLE_RATE_COUNT; i++) {
+    if (sampleRates[i] != rate) {
+      continue;
+    }
+    _sampleRateIndex = i;
+#if ENABLE_AUDIO_CAPTURE
+    // WAV 文件只有一个采样率
+    _capture.stop();
+#endif
+    if (_sampleRateCallback) {
+      _sampleRateCallback(rate);
+    }
+    i2s_set_sample_freq(&i2s_config, rate);
+    Serial.printf("I Sample rate: %lu Hz\n", rate);
+    return;
+  }
+  Serial.printf("E Unsupported sample rate: %lu Hz\n", rate);
+}
+
+void SoundService::nextSampleRate() {
+  setSampleRate(sampleRates[(_sampleRateIndex + 1) % AUDIO_SAMPLE_RATE_COUNT]);
+}
+
+void SoundService::prevSampleRate() {
+  setSampleRate(sampleRates[(_sampleRateIndex + AUDIO_SAMPLE_RATE_COUNT - 1) % AUDIO_SAMPLE_RATE_COUNT]);
+}
+
+void SoundService::setSampleRateCallback(std::function<void(uint32_t rate)> sampleRateCallback) {
+  _sampleRateCallback = sampleRateCallback;
+  if (_sampleRateCallback) {
+    _sampleRateCallback(getSampleRate());
+  }
+}
+
 void SoundService::increaseVolume() {
   if (i2s_config.volume > 0) {
     i2s_config.volume--;
@@ -66,4 +278,24 @@ void SoundService::setAudioCallback(std::function<void(void *userdata, int16_t *
   Serial.println("I Sound callback set.");
 }
 
+void SoundService::setIdleCallback(std::function<bool()> idleCallback) {
+  _idleCallback = idleCallback;
+}
+
+#if ENABLE_AUDIO_CORE1
+void SoundService::setCore1Job(bool (*job)()) {
+  _core1Job = job;
+  Serial.println("I Sound synthesis on core1.");
+}
+
+/**
+ * Called by core1 whenever no LCD command is waiting.
+ * A job must return quickly (one slice of work) to keep lines flowing.
+ */
+bool __not_in_flash_func(SoundService::runCore1Job)() {
+  bool (*job)() = _core1Job;
+  return job && job();
+}
+#endif
+
 #endif
\ No newline at end of file
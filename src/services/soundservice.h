@@ -2,24 +2,101 @@
 #if ENABLE_SOUND
 #include "baseservice.h"
 #include "i2s-audio.h"
+#include "audio_resampler.h"
+#if ENABLE_AUDIO_TELEMETRY
+#include "audio_telemetry.h"
+#endif
+#if ENABLE_AUDIO_CAPTURE
+#include "wavcapture.h"
+#endif
 #include "minigb_apu.h"
 // Project headers
 #include "hedley.h"
 
+// 输出环形缓冲区的目标水位 (帧), 约 23ms 延迟
+#define AUDIO_TARGET_FILL 1024
+// 控制器使用的水位平均: 每帧向新值靠近 1/2^N
+#define AUDIO_FILL_AVERAGE_SHIFT 4
+
+// 可选的输出采样率, 较低的采样率可以省下 CPU
+#define AUDIO_SAMPLE_RATE_COUNT 3
+
+// ENABLE_AUDIO_CORE1=0 时音频合成留在 core0, 便于对比
+#if ENABLE_AUDIO_CORE1 && !ENABLE_LCD
+#error "ENABLE_AUDIO_CORE1 needs core1, which is only started with ENABLE_LCD"
+#endif
+#if ENABLE_AUDIO_CAPTURE && !ENABLE_SDCARD
+#error "ENABLE_AUDIO_CAPTURE writes to the SD card, it needs ENABLE_SDCARD"
+#endif
+
 class SoundService {
 public:
   SoundService();
   void initSound();
 
   void handleSoundLoop();
+  uint32_t getUnderrunCount();
+  uint32_t getOverrunCount();
+
+  // 生产者接口: 经过重采样写入环形缓冲区, 每帧调用 paceFrame 按音频长度定时
+  uint32_t pushFrames(const int16_t* samples, uint32_t frames);
+  void paceFrame();
+  uint32_t getResampleStep();
+  audio_ring_t* getRing();
+
+  // 环形缓冲区水位统计
+  uint32_t getRingFill();
+  uint32_t getRingMinFill();
+  uint32_t getRingMaxFill();
+  void resetRingStats();
+#if ENABLE_AUDIO_CAPTURE
+  // 把送往 I2S 的声音录制为 SD 卡上的 WAV 文件, 返回是否正在录制
+  bool toggleCapture();
+#endif
+#if ENABLE_AUDIO_TELEMETRY
+  // 遥测: 默认关闭, 由串口命令开关, 与 'b' 的报告一起输出
+  bool toggleTelemetry();
+  void printTelemetry();
+#endif
   uint8_t getVolume();
+  // 采样率: I2S 时钟和当前模拟器的声音合成一起切换
+  uint32_t getSampleRate();
+  void setSampleRate(uint32_t rate);
+  void nextSampleRate();
+  void prevSampleRate();
+  // 设置时立即以当前采样率调用一次
+  void setSampleRateCallback(std::function<void(uint32_t rate)> sampleRateCallback);
   void increaseVolume();
   void decreaseVolume();
   void setAudioCallback(std::function<void(void *userdata, int16_t *stream, size_t len)> audioCallback);
+  // paceFrame 等待时执行的任务, 没有工作时返回 false
+  void setIdleCallback(std::function<bool()> idleCallback);
+#if ENABLE_AUDIO_CORE1
+  // core1 在两条 LCD 命令之间执行的合成任务, 没有工作时返回 false
+  void setCore1Job(bool (*job)());
+  bool runCore1Job();
+#endif
 
 private:
+  audio_resampler_t _resampler;
+#if ENABLE_AUDIO_CAPTURE
+  WavCapture _capture;
+#endif
+#if ENABLE_AUDIO_CORE1
+  bool (*volatile _core1Job)() = nullptr;
+#endif
 
   std::function<void(void *userdata, int16_t *stream, size_t len)> _audioCallback;
+  std::function<void(uint32_t rate)> _sampleRateCallback;
+  std::function<bool()> _idleCallback;
+  // 帧定时: 截止时间按已推送的音频长度前进
+  volatile uint32_t _pushedFrames = 0; // input frames, written by the producer core
+  uint32_t _pacedFrames = 0;
+  uint32_t _frameDeadline = 0;         // time_us_32()
+  uint32_t _paceRemainder = 0;         // us * sample rate
+  uint32_t _fillAverage = 0;           // Q AUDIO_FILL_AVERAGE_SHIFT
+  bool _catchUp = true;
+  uint8_t _sampleRateIndex = AUDIO_SAMPLE_RATE_COUNT - 1;
 protected:
 };
 
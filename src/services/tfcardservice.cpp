@@ -2,6 +2,12 @@
 
 #if ENABLE_SDCARD
 #include "allmenus.h"
+#if ENABLE_ROM_PAGING
+#include "rompager.h"
+#endif
+#if ENABLE_ROM_COMPRESSION
+#include "lz4block.h"
+#endif
 
 struct gb_save_state_s gb_realtime_save
 #ifdef ENABLE_RP2040_PSRAM
@@ -32,11 +38,12 @@ void CardService::initSDCard() {
   _gbConfig.dir = "/gb/";
   _gbConfig.fileExt[0] = ".gb";
   _gbConfig.fileExt[1] = ".gbc";
-  _gbConfig.fileExt[2] = nullptr; // 标记结束
+  _gbConfig.fileExt[2] = ROM_CONTAINER_EXT;
+  _gbConfig.fileExt[3] = nullptr; // 标记结束
   _nesConfig.type = GameType_NES;
   _nesConfig.dir = "/nes/";
   _nesConfig.fileExt[0] = ".nes";
-  _nesConfig.fileExt[1] = nullptr;
+  _nesConfig.fileExt[1] = ROM_CONTAINER_EXT;
   _nesConfig.fileExt[2] = nullptr; // 标记结束
   _currentConfig = _nesConfig;
 }
@@ -49,7 +56,7 @@ bool CardService::initSDCard_hardware() {
   return success;
 }
 
-uint16_t CardService::read_file_page_from_card(char filename[FILES_PER_PAGE][MAX_PATH_LENGTH], uint16_t num_page) {
+uint16_t CardService::read_file_page_from_card(char filename[FILES_PER_PAGE][MAX_PATH_LENGTH], uint16_t num_page, rom_meta_t* metas) {
   FsFile dir;
   FsFile file;
 
@@ -57,6 +64,14 @@ uint16_t CardService::read_file_page_from_card(char filename[FILES_PER_PAGE][MAX
   for (uint8_t ifile = 0; ifile < FILES_PER_PAGE; ifile++) {
     strcpy(filename[ifile], "");
   }
+  if (metas) {
+    // without the index nothing is known about the files, all count as supported
+    memset(metas, 0, FILES_PER_PAGE * sizeof(rom_meta_t));
+  }
+
+  if (romIndex.isOpen()) {
+    return romIndex.readNames(num_page * FILES_PER_PAGE, FILES_PER_PAGE, filename, metas);
+  }
 
   if (!dir.open(_currentConfig.dir)) {
     error("Failed to open root dir");
@@ -72,12 +87,10 @@ uint16_t CardService::read_file_page_from_card(char filename[FILES_PER_PAGE][MAX
     auto currentFilenameStr = String(currentFilename);
     currentFilenameStr.toLowerCase();
     bool shouldContinue = true;
-    for (uint8_t index = 0; index < sizeof(_currentConfig.fileExt); index++) {
-      if (_currentConfig.fileExt[index]) {
-        if (currentFilenameStr.endsWith(_currentConfig.fileExt[index])) {
-          shouldContinue = false;
-          break;
-        }
+    for (uint8_t index = 0; _currentConfig.fileExt[index]; index++) {
+      if (currentFilenameStr.endsWith(_currentConfig.fileExt[index])) {
+        shouldContinue = false;
+        break;
       }
     }
     if (shouldContinue) {
@@ -111,10 +124,12 @@ uint16_t CardService::read_file_page_from_card(char filename[FILES_PER_PAGE][MAX
 
 uint16_t CardService::rom_file_selector_display_page(uint16_t num_page) {
   char filename[FILES_PER_PAGE][MAX_PATH_LENGTH];
-  uint16_t num_files = read_file_page_from_card(filename, num_page);
+  rom_meta_t metas[FILES_PER_PAGE];
+  uint16_t num_files = read_file_page_from_card(filename, num_page, metas);
 
   for (uint8_t ifile = 0; ifile < num_files; ifile++) {
     fileListMenu.setTextAtIndex(filename[ifile], ifile);
+    fileListMenu.setItemDisabled(ifile, metas[ifile].status != ROM_META_OK);
   }
   return num_files;
 }
@@ -131,7 +146,31 @@ void CardService::open_rom_file(FsFile& file, char* filename) {
   }
 }
 
+uint32_t CardService::open_rom_data(FsFile& file, char* filename) {
+  open_rom_file(file, filename);
+  romContainer.clear();
+  if (!RomContainer::isContainer(filename)) {
+    return file.size();
+  }
+  if (!romContainer.open(file, _currentConfig.type)) {
+    error("Bad ROM container: " + String(filename));
+  }
+  return romContainer.header()->rom_size;
+}
+
+uint32_t CardService::rom_data_offset() {
+  const rom_container_t* header = romContainer.header();
+  return header ? header->data_offset : 0;
+}
+
+uint32_t CardService::rom_content_crc() {
+  const rom_container_t* header = romContainer.header();
+  return header ? header->rom_crc : 0;
+}
+
 void CardService::rom_file_selector() {
+  romIndex.open(sd, _currentConfig.dir, _currentConfig.fileExt);
+  romSearch.load(romIndex);
   /* display the first page with up to FILES_PER_PAGE rom files */
   num_files = rom_file_selector_display_page(num_page);
 
@@ -139,15 +178,44 @@ void CardService::rom_file_selector() {
   fileListMenu.setOnPrevPageCallback(std::bind(&CardService::onPrevPageCallback, this));
   fileListMenu.setAfterFileSelectedCallback(std::bind(&CardService::afterFileSelectedCallback, this));
   fileListMenu.setOnSelectKeyPressedCallback(std::bind(&CardService::onSelectKeyPressedCallback, this));
+  fileListMenu.setOnSearchCallback(std::bind(&CardService::onSearchCallback, this, std::placeholders::_1, std::placeholders::_2));
+#if ENABLE_SERIAL_ROM_UPLOAD
+  srv.inputService.setSerialUploadCallback(std::bind(&CardService::onSerialUploadCallback, this));
+#endif
   fileListMenu.openMenu();
+#if ENABLE_SERIAL_ROM_UPLOAD
+  srv.inputService.setSerialUploadCallback(nullptr);
+#endif
 }
 
 GameType CardService::getSelectedFileType() {
   return _currentConfig.type;
 }
 
+#if ENABLE_SD_ASYNC_IO
+/**
+ * Hand a save to the SD I/O queue, it is written in the frame slack time and
+ * closed once complete. false when the queue is full, nothing was queued then.
+ */
+bool CardService::queueSave(const char* path, const void* data, uint32_t size, bool ownsBuffer) {
+  String name = String(path);
+  if (!srv.sdIoService.write(path, data, 0, size, nullptr, ownsBuffer)) {
+    return false;
+  }
+  srv.sdIoService.flush(path, [name](bool ok) {
+    if (ok) {
+      Serial.printf("I %s written\r\n", name.c_str());
+    }
+  });
+  return true;
+}
+#endif
+
 bool CardService::readFile(const char* path, const MemoryRegion* regions, size_t region_count) {
   FsFile file;
+#if ENABLE_SD_ASYNC_IO
+  srv.sdIoService.waitIdle();
+#endif
   if (!file.open(path, O_RDONLY)) {
     Serial.printf("E f_open(%s) error\r\n", path);
     return false;
@@ -161,6 +229,29 @@ bool CardService::readFile(const char* path, const MemoryRegion* regions, size_t
 }
 
 bool CardService::saveFile(const char* path, const MemoryRegion* regions, size_t region_count) {
+#if ENABLE_SD_ASYNC_IO
+  // 先复制一份, 游戏继续运行时写入的仍是这一刻的状态
+  size_t total = 0;
+  for (size_t i = 0; i < region_count; i++) {
+    total += regions[i].size;
+  }
+  uint8_t* snapshot = (uint8_t*)malloc(total);
+  if (snapshot != nullptr) {
+    size_t offset = 0;
+    for (size_t i = 0; i < region_count; i++) {
+      memcpy(snapshot + offset, regions[i].address, regions[i].size);
+      offset += regions[i].size;
+    }
+    if (queueSave(path, snapshot, total, true)) {
+      return true;
+    }
+    free(snapshot);
+  }
+  // 内存或队列不够时同步写入
+#endif
+#if ENABLE_EXT_PSRAM
+  psram_wait();
+#endif
   FsFile file;
   if (!file.open(path, O_WRONLY | O_CREAT)) {
     Serial.printf("E saveFile(%s) error\r\n", path);
@@ -185,6 +276,9 @@ void CardService::load_state(gb_s* gb) {
     Serial.println("I no savestate in ram, try loading file ...");
     char filename[RAM_SAVENAME_LENGTH];
     FsFile file;
+#if ENABLE_SD_ASYNC_IO
+    srv.sdIoService.waitIdle();
+#endif
 
     gb_get_rom_name(gb, filename);
 
@@ -257,13 +351,11 @@ void CardService::load_cart_rom_file_to_PSRAM(char* filename) {
   tft.setTextColor(TFT_WHITE, TFT_BLACK);
   tft.println("Loading ROM: ");
 
-  uint8_t buffer[FLASH_SECTOR_SIZE];
+  alignas(4) uint8_t buffer[FLASH_SECTOR_SIZE];
 
   FsFile file;
   Serial.printf("psram: opening file '%s'\r\n", filename);
-  open_rom_file(file, filename);
-
-  uint32_t fileSize = file.size();
+  uint32_t fileSize = open_rom_data(file, filename);
   Serial.printf("psram: file opened, size = %lu\r\n", fileSize);
 
   uint32_t offset = 0;
@@ -327,62 +419,57 @@ void CardService::load_cart_rom_file_to_rom_and_PSRAM(char* filename) {
   tft.setTextColor(TFT_WHITE, TFT_BLACK);
   tft.println("Loading ROM: ");
 
-  uint8_t buffer[FLASH_SECTOR_SIZE];
+  alignas(4) uint8_t buffer[FLASH_SECTOR_SIZE];
 
   FsFile file;
   Serial.printf("psram: opening file '%s'\r\n", filename);
-  open_rom_file(file, filename);
-
-  uint32_t fileSize = file.size();
+  uint32_t fileSize = open_rom_data(file, filename);
   Serial.printf("psram: file opened, size = %lu\r\n", fileSize);
 
-  Serial.printf("I Program target region...\r\n");
+  uint32_t flashSize = min(fileSize, ROM_FLASH_SPLIT);
+  uint32_t sectorsWritten = 0;
 
-  uint32_t offset = 0;
-  bool in_psram_section = false;
+  if (rom_in_flash(filename, file, flashSize)) {
+    // PSRAM 掉电丢失, 超出 flash 的部分仍要重新装载
+    file.seekSet(rom_data_offset() + flashSize);
+  } else {
+    Serial.printf("I Program target region...\r\n");
+    int32_t slot = rom_allocate(filename, flashSize);
+    flashLoader.load(file, flashSize, [](uint32_t) { tft.print("#"); });
+    romLibrary.add(filename, file, slot, flashSize, rom_content_crc(), flashLoader);
+    sectorsWritten = flashLoader.sectorsWritten();
+  }
 
-  while (true) {
-    tft.print("#");
+  uint32_t offset = flashSize;
+  // 每次装载都初始化, 读缓存从空开始
+  if (!psram_init()) {
+    error("PSRAM init failed");
+  }
+  if (offset < fileSize) {
+    Serial.println("\nSwitching to PSRAM section");
+  }
 
-    // Check if we've crossed into PSRAM section
-    if (!in_psram_section && offset >= MAX_ROM_SIZE_MB) {
-      Serial.println("\nSwitching to PSRAM section");
-      in_psram_section = true;
+  while (offset < fileSize) {
+    int nread = file.read(buffer, FLASH_SECTOR_SIZE);
+    if (nread < 0) {
+      error("Failed to read file!");
     }
-    if (offset >= fileSize) {
-      Serial.println("\nReached end of file");
+    if (nread == 0) {
       break;
     }
 
-    // write to flash
-    if (!in_psram_section) {
-      // Use the working write_rom_sector_to_flash function
-      if (!write_rom_sector_to_flash(file, buffer, offset)) {
-        error("Flash programming failed");
-      }
-    } else {
-      // write to PSRAM
-      if (!psram_init()) {
-        error("PSRAM init failed");
-      } else {
-        int nread = file.read(buffer, FLASH_SECTOR_SIZE);
-        if (nread < 0) {
-          error("Failed to read file!");
-        }
-        if (nread == 0) {
-          break;
-        }
-
-        if (!psram_write(offset, buffer, (size_t)nread)) {
-          Serial.println("psram: psram_write failed");
-          return;
-        }
-      }
+    if (!psram_write(offset, buffer, (size_t)nread)) {
+      Serial.println("psram: psram_write failed");
+      return;
     }
     /* Next sector */
     offset += FLASH_SECTOR_SIZE;
+    if (offset % FLASH_BLOCK_SIZE == 0) {
+      tft.print("#");
+    }
   }
 
+  Serial.printf("I %lu flash sectors reprogrammed\r\n", sectorsWritten);
   Serial.printf("I load_cart_rom_file(%s) COMPLETE\r\n", filename);
   close_rom_file(file);
 }
@@ -390,65 +477,235 @@ void CardService::load_cart_rom_file_to_rom_and_PSRAM(char* filename) {
 
 #if !ENABLE_RP2040_PSRAM && !ENABLE_EXT_PSRAM
 void CardService::load_cart_rom_file(char* filename) {
-  uint8_t buffer[FLASH_SECTOR_SIZE];
-
   tft.fillScreen(TFT_BLACK);
   tft.setCursor(0, 0, FONT_ID);
   tft.setTextColor(TFT_WHITE, TFT_BLACK);
   tft.println("Loading ROM: ");
 
   FsFile file;
-  open_rom_file(file, filename);
-
-  Serial.printf("I Program target region...\r\n");
-
-  uint32_t offset = 0;
-  while (write_rom_sector_to_flash(file, buffer, offset)) {
-    tft.print("#");
-
-    /* Next sector */
-    offset += FLASH_SECTOR_SIZE;
-    if (offset >= MAX_ROM_SIZE) {
-      Serial.printf("I MAX_ROM_SIZE = (%d)\r\n", MAX_ROM_SIZE);
-      Serial.printf("I offset = (%d)\r\n", offset);
-      break;
+  uint32_t fileSize = open_rom_data(file, filename);
+  uint32_t flashSize = min(fileSize, (uint32_t)MAX_ROM_SIZE);
+  bool paged = false;
+#if ENABLE_ROM_COMPRESSION
+  if (fileSize > flashSize && _currentConfig.type == GameType_GB) {
+    if (load_cart_rom_file_compressed(filename, file, fileSize)) {
+      close_rom_file(file);
+      Serial.printf("I load_cart_rom_file(%s) COMPLETE\r\n", filename);
+      return;
+    }
+    file.seekSet(rom_data_offset());
+  }
+#endif
+  if (fileSize > flashSize) {
+    Serial.printf("I MAX_ROM_SIZE = (%d)\r\n", MAX_ROM_SIZE);
+#if ENABLE_ROM_PAGING
+    if (_currentConfig.type == GameType_GB) {
+      // flash 只放整数个 bank, 其余的 bank 运行时从 SD 读取
+      flashSize -= flashSize % ROM_PAGER_PAGE_SIZE;
+    }
+    // NES: 跨过 flash 末尾的 bank 由 bank cache 从 SD 读取
+    paged = true;
+#endif
+    if (!paged) {
+      Serial.printf("I file size = (%lu), truncated\r\n", fileSize);
     }
   }
+  if (!rom_in_flash(filename, file, flashSize)) {
+    Serial.printf("I Program target region...\r\n");
+
+    int32_t slot = rom_allocate(filename, flashSize);
+    flashLoader.load(file, flashSize, [](uint32_t) { tft.print("#"); });
+    romLibrary.add(filename, file, slot, flashSize, rom_content_crc(), flashLoader);
 
+    Serial.printf("I %lu of %lu sectors reprogrammed\r\n", flashLoader.sectorsWritten(),
+        (flashSize + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE);
+  }
   close_rom_file(file);
 
+#if ENABLE_ROM_PAGING
+  // 在装载之后打开, 装载时的 64KiB 缓冲区已经释放
+  if (paged) {
+    bool opened = _currentConfig.type == GameType_GB ? rom_pager_open(filename, flashSize, rom_data_offset())
+                                                      : rom_pager_open_file(filename, flashSize, rom_data_offset());
+    if (!opened) {
+      error("ROM too large: " + String(filename));
+    }
+  }
+#endif
   Serial.printf("I load_cart_rom_file(%s) COMPLETE\r\n", filename);
 }
 
 #endif
 
-bool CardService::write_rom_sector_to_flash(FsFile& file, uint8_t* buffer, uint32_t offset) {
-  int nread = file.read(buffer, FLASH_SECTOR_SIZE);
-  if (nread < 0) {
-    error("Failed to read file!");
+#if ENABLE_ROM_COMPRESSION
+/**
+ * Appends data to the flash ROM region one sector at a time
+ */
+struct FlashSectorWriter {
+  FlashLoader& loader;
+  uint32_t limit;   // end of the library slot
+  uint32_t offset;  // ROM offset of the sector being filled
+  uint32_t fill;
+  alignas(4) uint8_t sector[FLASH_SECTOR_SIZE]; // read by the CRC DMA in 32-bit words
+
+  // false when the data would run past the end of the slot
+  bool append(const uint8_t* data, uint32_t len) {
+    while (len) {
+      if (offset + FLASH_SECTOR_SIZE > limit) {
+        return false;
+      }
+      uint32_t n = min(len, (uint32_t)FLASH_SECTOR_SIZE - fill);
+      memcpy(sector + fill, data, n);
+      fill += n;
+      data += n;
+      len -= n;
+      if (fill == FLASH_SECTOR_SIZE) {
+        flush();
+      }
+    }
+    return true;
   }
 
-  if (nread == 0) {
+  void flush() {
+    if (fill == 0) {
+      return;
+    }
+    memset(sector + fill, 0xFF, FLASH_SECTOR_SIZE - fill);
+    loader.writeSector(sector, offset);
+    offset += FLASH_SECTOR_SIZE;
+    fill = 0;
+  }
+
+  uint32_t position() { return offset + fill; }
+};
+
+bool CardService::load_cart_rom_file_compressed(char* filename, FsFile& file, uint32_t romSize) {
+  const uint32_t bankCount = (romSize + ROM_PAGER_PAGE_SIZE - 1) / ROM_PAGER_PAGE_SIZE;
+  if (bankCount > ROM_PAGER_MAX_BANKS || bankCount < 2) {
     return false;
   }
 
-  uint32_t flash_offset = ((uint32_t)&RS_rom[offset]) - XIP_BASE;
+  if (rom_in_flash(filename, file, 0, ROM_FORMAT_LZ4)) {
+    return rom_pager_open_compressed(RS_rom, bankCount);
+  }
 
-  uint32_t ints = save_and_disable_interrupts();
-  flash_range_erase(flash_offset, FLASH_SECTOR_SIZE);
-  flash_range_program(flash_offset, buffer, FLASH_SECTOR_SIZE);
-  restore_interrupts(ints);
+  Serial.printf("I Compress %lu banks into flash...\r\n", bankCount);
 
-  /* Read back target region and check programming */
-  if (memcmp(&RS_rom[offset], buffer, FLASH_SECTOR_SIZE) != 0) {
-    //@REEMscope.close();
-    error("Programming failed - Flash mismatch");
+  uint8_t* bank = (uint8_t*)malloc(ROM_PAGER_PAGE_SIZE);
+  uint8_t* packed = (uint8_t*)malloc(LZ4BLOCK_BOUND(ROM_PAGER_PAGE_SIZE));
+  uint16_t* table = (uint16_t*)malloc(LZ4BLOCK_HASH_SIZE * sizeof(uint16_t));
+  uint32_t* index = (uint32_t*)malloc(FLASH_SECTOR_SIZE);
+  bool fits = bank && packed && table && index;
+  if (!fits) {
+    Serial.printf("E not enough RAM to compress the ROM\r\n");
   }
 
+  // 先按压缩到一半预留空间, 放不下时按压缩后的实际大小重新分配一次
+  uint32_t reserve = min((uint32_t)MAX_ROM_SIZE, ROM_LZ4_DATA_OFFSET + romSize / 2);
+  int32_t slot = -1;
+  uint32_t used = 0;
+  while (fits) {
+    slot = rom_allocate(filename, reserve);
+    file.seekSet(rom_data_offset());
+    memset(index, 0xFF, FLASH_SECTOR_SIZE);
+    FlashSectorWriter writer = {flashLoader, reserve, 0, 0, {}};
+    bool written = true;
+    uint32_t needed = 0; // end of the data once every bank is compressed
+
+    for (uint32_t b = 0; b < bankCount; b++) {
+      int nread = file.read(bank, ROM_PAGER_PAGE_SIZE);
+      if (nread < 0) {
+        error("Failed to read file!");
+      }
+      memset(bank + nread, 0xFF, ROM_PAGER_PAGE_SIZE - nread);
+
+      if (b == ROM_LZ4_RAW_SIZE / ROM_PAGER_PAGE_SIZE) {
+        // 原样存放的 bank 之后留出索引扇区
+        writer.offset = ROM_LZ4_DATA_OFFSET;
+        needed = ROM_LZ4_DATA_OFFSET;
+      }
+      index[b] = writer.position();
+
+      uint32_t len = 0;
+      if (b >= ROM_LZ4_RAW_SIZE / ROM_PAGER_PAGE_SIZE) {
+        len = lz4block_compress(bank, ROM_PAGER_PAGE_SIZE, packed, ROM_PAGER_PAGE_SIZE - 1, table);
+      }
+      const uint8_t* data = len ? packed : bank;
+      if (len == 0) {
+        len = ROM_PAGER_PAGE_SIZE;
+      }
+      needed += len;
+      // 超出预留空间后不再写 flash, 只压缩剩下的 bank 得到实际大小
+      if (written) {
+        written = writer.append(data, len);
+      }
+
+      if (b % 4 == 3) {
+        tft.print("#");
+      }
+    }
+
+    if (written) {
+      index[bankCount] = writer.position();
+      writer.flush();
+      used = writer.offset;
+      flashLoader.writeSector((const uint8_t*)index, ROM_LZ4_INDEX_OFFSET);
+      break;
+    }
+    needed = (needed + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    if (needed <= reserve || needed > (uint32_t)MAX_ROM_SIZE) {
+      fits = false;
+      break;
+    }
+    Serial.printf("I compressed ROM needs %lu bytes, reserving again\r\n", needed);
+    reserve = needed;
+    tft.print("\n");
+  }
+
+  free(index);
+  free(table);
+  free(packed);
+  free(bank);
+
+  if (!fits) {
+    Serial.printf("I ROM does not fit in flash compressed\r\n");
+    return false;
+  }
+
+  romLibrary.add(filename, file, slot, used, rom_content_crc(), flashLoader, ROM_FORMAT_LZ4);
+  Serial.printf("I %lu bytes compressed to %lu\r\n", romSize, used);
+  return rom_pager_open_compressed(RS_rom, bankCount);
+}
+#endif
+
+bool CardService::rom_in_flash(char* filename, FsFile& file, uint32_t size, uint32_t format) {
+  int slot = romLibrary.find(filename, file, size, format, rom_content_crc(), flashLoader);
+  if (slot < 0) {
+    return false;
+  }
+  const rom_library_entry_t* entry = romLibrary.entry(slot);
+  RS_rom = &_FS_start + entry->offset;
+  romLibrary.touch(slot);
+  Serial.printf("I %s already in flash @ %07lx (%lu bytes), skip programming\r\n", filename, entry->offset,
+      entry->size);
   return true;
 }
+
+int32_t CardService::rom_allocate(char* filename, uint32_t size) {
+  int32_t offset = romLibrary.allocate(filename, size);
+  if (offset < 0) {
+    error("ROM too large: " + String(filename));
+  }
+  RS_rom = &_FS_start + offset;
+  Serial.printf("I %s goes to flash @ %07lx\r\n", filename, offset);
+  return offset;
+}
 void CardService::save_state(gb_s* gb) {
   Serial.println("I save_state ...");
+#if ENABLE_SD_ASYNC_IO
+  // the previous save may still be written from gb_realtime_save
+  srv.sdIoService.waitIdle();
+#endif
   gb_realtime_save.mbc = gb->mbc;
   gb_realtime_save.cart_ram = gb->cart_ram;
   gb_realtime_save.num_rom_banks_mask = gb->num_rom_banks_mask;
@@ -505,6 +762,12 @@ void CardService::save_state(gb_s* gb) {
   Serial.printf("I f_open(%s) \r\n", filename);
 
   save_size = sizeof(gb_realtime_save);
+#if ENABLE_SD_ASYNC_IO
+  // gb_realtime_save 本身就是快照, 直接从它写入
+  if (queueSave(filename, &gb_realtime_save, save_size, false)) {
+    return;
+  }
+#endif
   if (save_size > 0) {
     if (!file.open(filename, O_WRONLY | O_CREAT)) {
       Serial.printf("E f_open(%s) error\r\n", filename);
@@ -548,6 +811,7 @@ bool CardService::onNextPageCallback() {
 }
 void CardService::afterFileSelectedCallback() {
   /* copy the rom from the SD card to flash or PSRAM and start the game */
+  romSearch.clear();
   char filenameWithPath[MAX_PATH_LENGTH];
   snprintf(filenameWithPath, sizeof(filenameWithPath), "%s%s", _currentConfig.dir, fileListMenu.getSelectedText());
 
@@ -560,6 +824,55 @@ void CardService::afterFileSelectedCallback() {
 #endif
 }
 
+int32_t CardService::onSearchCallback(char* prefix, int8_t step) {
+  if (!romSearch.isLoaded() || (step != 0 && !romSearch.stepPrefix(prefix, step > 0))) {
+    return -1;
+  }
+  int32_t pos = romSearch.find(prefix);
+  if (pos < 0) {
+    return -1;
+  }
+  /* the page is read from the index, one seek whatever its number */
+  fileListMenu.clearMenu();
+  num_page = pos / FILES_PER_PAGE;
+  num_files = rom_file_selector_display_page(num_page);
+  return pos;
+}
+
+#if ENABLE_SERIAL_ROM_UPLOAD
+/**
+ * 'U' on the serial port while the browser is open: receive a ROM from the
+ * host straight into flash and start it as if it had been selected
+ */
+void CardService::onSerialUploadCallback() {
+  RomUpload upload;
+  if (!upload.begin()) {
+    return;
+  }
+  romSearch.clear();
+  tft.fillScreen(TFT_BLACK);
+  tft.setCursor(0, 0, FONT_ID);
+  tft.setTextColor(TFT_WHITE, TFT_BLACK);
+  tft.println("Receiving ROM: ");
+
+  // 库里的路径不对应 SD 卡上的文件, 不会被当作卡上的 ROM 复用
+  char path[ROM_UPLOAD_MAX_NAME + 8];
+  snprintf(path, sizeof(path), "usb:%s", upload.name());
+  int32_t slot = rom_allocate(path, upload.flashSize());
+  if (!upload.receive(flashLoader, [](uint32_t) { tft.print("#"); })) {
+    error("ROM upload failed");
+  }
+  FsFile none;
+  romLibrary.add(path, none, slot, upload.flashSize(), 0, flashLoader);
+
+  _currentConfig = upload.type() == GameType_NES ? _nesConfig : _gbConfig;
+  // NES save files are named after the selected menu item
+  fileListMenu.setTextAtIndex(upload.name(), fileListMenu.getSelectedIndex());
+  fileListMenu.closeMenu();
+  Serial.printf("I serial upload of %s COMPLETE\r\n", upload.name());
+}
+#endif
+
 void CardService::onSelectKeyPressedCallback() {
   if (_currentConfig.type == GameType::GameType_GB) {
     _currentConfig = _nesConfig;
@@ -567,6 +880,9 @@ void CardService::onSelectKeyPressedCallback() {
     _currentConfig = _gbConfig;
   }
   fileListMenu.setGameType(_currentConfig.type);
+  romIndex.open(sd, _currentConfig.dir, _currentConfig.fileExt);
+  romSearch.load(romIndex);
+  fileListMenu.clearMenu();
   num_page = 0;
   total_pages = 1;
   num_files = rom_file_selector_display_page(num_page);
@@ -576,6 +892,9 @@ void CardService::read_cart_ram_file(gb_s* gb) {
   char filename[RAM_SAVENAME_LENGTH];
   uint_fast32_t save_size;
   FsFile file;
+#if ENABLE_SD_ASYNC_IO
+  srv.sdIoService.waitIdle();
+#endif
 
   gb_get_rom_name(gb, filename);
   save_size = gb_get_save_size(gb);
@@ -611,6 +930,13 @@ void CardService::write_cart_ram_file(gb_s* gb) {
   f.toCharArray(filename, RAM_SAVENAME_LENGTH);
 
   if (save_size > 0) {
+#if ENABLE_SD_ASYNC_IO
+    // saveFile queues a copy, or writes synchronously when it cannot
+    const MemoryRegion ram = {RS_ram, save_size};
+    if (!saveFile(filename, &ram, 1)) {
+      return;
+    }
+#else
     if (!file.open(filename, O_WRONLY | O_CREAT)) {
       Serial.printf("E f_open(%s) error\r\n", filename);
       return;
@@ -620,6 +946,7 @@ void CardService::write_cart_ram_file(gb_s* gb) {
     if (!file.close()) {
       Serial.printf("E f_close error\r\n");
     }
+#endif
   }
 
   Serial.printf("I write_cart_ram_file(%s) COMPLETE (%lu bytes)\r\n", filename, save_size);
@@ -5,6 +5,12 @@
 #include "baseservice.h"
 #include "gb.h"
 #include "hardware/flash.h"
+#include "flashloader.h"
+#include "romcontainer.h"
+#include "romindex.h"
+#include "romlibrary.h"
+#include "romsearch.h"
+#include "romupload.h"
 
 #if ENABLE_EXT_PSRAM
 #include "psram.h"
@@ -12,6 +18,8 @@
 #define RAM_SAVENAME_LENGTH 16 + 7
 
 #define MAX_PATH_LENGTH 256
+static_assert(MAX_PATH_LENGTH == ROM_INDEX_MAX_NAME + 1, "selector pages are read from the ROM index");
+static_assert(FILES_PER_PAGE <= ROM_INDEX_MAX_PAGE, "selector pages are read from the ROM index");
 // 状态文件头部结构
 struct gb_save_state_s {
 
@@ -71,7 +79,7 @@ struct gb_save_state_s {
 struct FileListConfig {
   GameType type = GameType_GB;
   const char* dir;
-  const char* fileExt[3];
+  const char* fileExt[4] = {}; // nullptr terminated
 };
 
 class CardService {
@@ -104,6 +112,10 @@ public:
   bool onPrevPageCallback();
   void afterFileSelectedCallback();
   void onSelectKeyPressedCallback();
+  int32_t onSearchCallback(char* prefix, int8_t step);
+#if ENABLE_SERIAL_ROM_UPLOAD
+  void onSerialUploadCallback();
+#endif
 
   void save_state(struct gb_s* gb);
   void load_state(struct gb_s* gb);
@@ -130,21 +142,54 @@ public:
    */
   void load_cart_rom_file(char* filename);
 #endif
-  bool write_rom_sector_to_flash(FsFile& file, uint8_t* buffer, uint32_t offset);
+  /**
+   * true when the flash library already holds the first size bytes of this file
+   * (size 0: any size), RS_rom then points at it
+   */
+  bool rom_in_flash(char* filename, FsFile& file, uint32_t size, uint32_t format = ROM_FORMAT_RAW);
+  /**
+   * reserve a flash library slot of size bytes and point RS_rom at it, returns its ROM offset
+   */
+  int32_t rom_allocate(char* filename, uint32_t size);
+  /**
+   * header of the loaded ROM when it came from a container, nullptr otherwise
+   */
+  const rom_container_t* loadedContainer() { return romContainer.header(); }
+  // raw card access for the USB mass storage mode
+  SdCard* card() { return sd.card(); }
 
 private:
   bool initSDCard_hardware();
   /**
    * read file names from sd card
    */
-  uint16_t read_file_page_from_card(char filename[FILES_PER_PAGE][MAX_PATH_LENGTH], uint16_t num_page);
+  uint16_t read_file_page_from_card(char filename[FILES_PER_PAGE][MAX_PATH_LENGTH], uint16_t num_page, rom_meta_t* metas = nullptr);
   /**
    * Function used by the rom file selector to display one page of .gb rom files
    */
   uint16_t rom_file_selector_display_page(uint16_t num_page);
 
+#if ENABLE_ROM_COMPRESSION
+  /**
+   * Store a GB rom in flash as LZ4 compressed banks and page it from there,
+   * false when it does not fit even compressed
+   */
+  bool load_cart_rom_file_compressed(char* filename, FsFile& file, uint32_t romSize);
+#endif
+
   void close_rom_file(FsFile& file);
   void open_rom_file(FsFile& file, char* filename);
+  /**
+   * open a ROM or container file positioned at the ROM data, returns the ROM size
+   */
+  uint32_t open_rom_data(FsFile& file, char* filename);
+  // file offset of the ROM data opened by open_rom_data()
+  uint32_t rom_data_offset();
+  // CRC-32 of the ROM data from the container header, 0 for a plain ROM file
+  uint32_t rom_content_crc();
+#if ENABLE_SD_ASYNC_IO
+  bool queueSave(const char* path, const void* data, uint32_t size, bool ownsBuffer);
+#endif
 
 protected:
   SdFs sd;
@@ -156,6 +201,12 @@ protected:
 
   FileListConfig _currentConfig;
 
+  RomLibrary romLibrary;
+  RomContainer romContainer;
+  RomIndex romIndex;
+  RomSearch romSearch;
+  FlashLoader flashLoader;
+
   FileListConfig _gbConfig;
   FileListConfig _nesConfig;
 };
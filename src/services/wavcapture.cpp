@@ -0,0 +1,204 @@
+#include "wavcapture.h"
+
+#if ENABLE_SOUND && ENABLE_AUDIO_CAPTURE
+#include <Arduino.h>
+#include "allservices.h"
+
+static void putLe16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+static void putLe32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+/**
+ * Build the first AUDIO_CAPTURE_DATA_OFFSET bytes of the file: RIFF/fmt
+ * header, a JUNK chunk padding and the data chunk header. Sizes are 0 while
+ * recording and patched on stop. The block is built in the staging ring,
+ * which is empty at both points.
+ */
+void WavCapture::buildHeader(uint32_t dataBytes) {
+  uint8_t* block = (uint8_t*)_ring.buf;
+  const uint32_t junkBytes = AUDIO_CAPTURE_DATA_OFFSET - 12 - 24 - 8 - 8;
+
+  memset(block, 0, AUDIO_CAPTURE_DATA_OFFSET);
+  memcpy(block, "RIFF", 4);
+  putLe32(block + 4, AUDIO_CAPTURE_DATA_OFFSET - 8 + dataBytes);
+  memcpy(block + 8, "WAVE", 4);
+  memcpy(block + 12, "fmt ", 4);
+  putLe32(block + 16, 16);
+  putLe16(block + 20, 1); // PCM
+  putLe16(block + 22, 2); // stereo
+  putLe32(block + 24, _sampleRate);
+  putLe32(block + 28, _sampleRate * 4);
+  putLe16(block + 32, 4);
+  putLe16(block + 34, 16);
+  memcpy(block + 36, "JUNK", 4);
+  putLe32(block + 40, junkBytes);
+  memcpy(block + AUDIO_CAPTURE_DATA_OFFSET - 8, "data", 4);
+  putLe32(block + AUDIO_CAPTURE_DATA_OFFSET - 4, dataBytes);
+}
+
+/**
+ * Write the header through the queue and wait for it, the ring holds it
+ * until then. Called with the producer stopped.
+ */
+static bool writeHeaderBlock(const char* path, const void* block) {
+  bool ok = false;
+  while (!srv.sdIoService.write(path, block, 0, AUDIO_CAPTURE_DATA_OFFSET, [&ok](bool written) { ok = written; })) {
+    if (!srv.sdIoService.poll()) {
+      return false;
+    }
+  }
+  srv.sdIoService.waitIdle();
+  return ok;
+}
+
+bool WavCapture::start(uint32_t sampleRate) {
+  if (_path[0] != 0) {
+    return _active;
+  }
+  if (_ring.buf == nullptr) {
+    // 首次使用时分配, 之后保留: 生产者可能仍在另一个核上访问
+    uint32_t* buf = (uint32_t*)malloc(AUDIO_CAPTURE_RING_FRAMES * sizeof(uint32_t));
+    if (buf == nullptr) {
+      Serial.println("E capture: out of memory");
+      return false;
+    }
+    audio_ring_init(&_ring, buf, AUDIO_CAPTURE_RING_FRAMES);
+  }
+
+  // 只在这里直接访问卡: 创建一个新文件, 之后的写入都经过 SdIoService
+  srv.sdIoService.waitIdle();
+  char filename[sizeof(_path)];
+  FsFile file;
+  bool opened = false;
+  for (uint16_t i = 0; i < 1000 && !opened; i++) {
+    snprintf(filename, sizeof(filename), "/capture%03u.wav", i);
+    opened = file.open(filename, O_WRONLY | O_CREAT | O_EXCL);
+  }
+  if (!opened) {
+    Serial.println("E capture: cannot create file");
+    return false;
+  }
+  file.close();
+
+  // 生产者此时不写入, 索引从 0 开始使块对齐
+  audio_ring_init(&_ring, _ring.buf, AUDIO_CAPTURE_RING_FRAMES);
+
+  _sampleRate = sampleRate;
+  _dataBytes = 0;
+  _droppedFrames = 0;
+  _queuedFrames = 0;
+  buildHeader(0);
+  if (!writeHeaderBlock(filename, _ring.buf)) {
+    Serial.println("E capture: header write error");
+    return false;
+  }
+  strcpy(_path, filename);
+  __atomic_store_n(&_active, true, __ATOMIC_RELEASE);
+  Serial.printf("I capture: recording %s at %lu Hz\r\n", filename, sampleRate);
+  return true;
+}
+
+void WavCapture::stop() {
+  if (_path[0] == 0) {
+    return;
+  }
+  // 之后开始的 write() 看到 _active 为 false; 等待已经开始的结束
+  __atomic_store_n(&_active, false, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n(&_writing, __ATOMIC_SEQ_CST)) {
+    tight_loop_contents();
+  }
+
+  // 剩下的块和最后不足一块的部分, 队列满时先处理已有的请求
+  while (audio_ring_fill(&_ring) > _queuedFrames) {
+    if (!queueChunk(true) && !srv.sdIoService.poll()) {
+      break;
+    }
+  }
+  srv.sdIoService.waitIdle();
+
+  buildHeader(_dataBytes);
+  if (!writeHeaderBlock(_path, _ring.buf)) {
+    Serial.println("E capture: header patch error");
+  }
+  srv.sdIoService.flush(_path);
+  srv.sdIoService.waitIdle();
+  _path[0] = 0;
+  Serial.printf("I capture: %lu bytes written, dropped %lu frames (%lu chunks)\r\n",
+                _dataBytes, _droppedFrames,
+                (_droppedFrames + AUDIO_CAPTURE_CHUNK_FRAMES - 1) / AUDIO_CAPTURE_CHUNK_FRAMES);
+}
+
+// 录制中, 包括写入出错后等待 stop() 的状态
+bool WavCapture::isActive() {
+  return _path[0] != 0;
+}
+
+void __not_in_flash_func(WavCapture::write)(const int16_t* samples, uint32_t frames) {
+  // flag first, then check: stop() either sees the flag or this sees _active cleared
+  __atomic_store_n(&_writing, true, __ATOMIC_SEQ_CST);
+  if (!__atomic_load_n(&_active, __ATOMIC_SEQ_CST)) {
+    __atomic_store_n(&_writing, false, __ATOMIC_RELEASE);
+    return;
+  }
+
+  const uint32_t mask = audio_ring_mask(&_ring);
+  uint32_t head;
+  uint32_t count = audio_ring_reserve(&_ring, frames, &head);
+  for (uint32_t i = 0; i < count; i++) {
+    _ring.buf[(head + i) & mask] = audio_ring_pack(samples[2 * i], samples[2 * i + 1]);
+  }
+  audio_ring_commit(&_ring, count);
+  _droppedFrames += frames - count;
+  __atomic_store_n(&_writing, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * Hand the chunk after the queued ones to SdIoService. The tail only moves
+ * by whole chunks until stop() and the ring holds a whole number of them,
+ * so a chunk never wraps.
+ */
+bool WavCapture::queueChunk(bool partial) {
+  uint32_t tail;
+  const uint32_t count = audio_ring_peek(&_ring, _queuedFrames + AUDIO_CAPTURE_CHUNK_FRAMES, &tail) - _queuedFrames;
+  if (count == 0 || (count < AUDIO_CAPTURE_CHUNK_FRAMES && !partial)) {
+    return false;
+  }
+
+  const uint32_t* chunk = &_ring.buf[(tail + _queuedFrames) & audio_ring_mask(&_ring)];
+  if (!srv.sdIoService.append(_path, chunk, count * sizeof(uint32_t),
+          [this, count](bool ok) { chunkWritten(count, ok); })) {
+    return false;
+  }
+  _queuedFrames += count;
+  return true;
+}
+
+// SdIoService callback, chunks complete in the order they were queued
+void WavCapture::chunkWritten(uint32_t frames, bool ok) {
+  audio_ring_consume(&_ring, frames);
+  _queuedFrames -= frames;
+  if (ok) {
+    _dataBytes += frames * sizeof(uint32_t);
+  } else if (_active) {
+    // 停止接收, 已写入的部分在 stop() 时补写文件头
+    Serial.println("E capture: write error");
+    _active = false;
+  }
+}
+
+bool WavCapture::flushChunk() {
+  if (!_active || _queuedFrames >= AUDIO_CAPTURE_MAX_QUEUED * AUDIO_CAPTURE_CHUNK_FRAMES) {
+    return false;
+  }
+  return queueChunk(false);
+}
+
+#endif
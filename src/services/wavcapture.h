@@ -0,0 +1,53 @@
+#pragma once
+#if ENABLE_SOUND && ENABLE_AUDIO_CAPTURE
+#if !ENABLE_SDCARD || !ENABLE_SD_ASYNC_IO
+#error "ENABLE_AUDIO_CAPTURE requires ENABLE_SDCARD and ENABLE_SD_ASYNC_IO"
+#endif
+#include "audio_ring.h"
+
+#include <stdint.h>
+
+// 一次写入 SD 卡的块: 1024 帧 = 4KiB, 数据区在文件中按 4KiB 对齐
+#define AUDIO_CAPTURE_CHUNK_FRAMES 1024
+// 暂存环形缓冲区 (帧), 必须是块大小的整数倍
+#define AUDIO_CAPTURE_RING_FRAMES (4 * AUDIO_CAPTURE_CHUNK_FRAMES)
+// 44 字节的 WAV 头加 JUNK 填充块, 使 data 从 4096 开始
+#define AUDIO_CAPTURE_DATA_OFFSET 4096
+// 同时交给 SdIoService 的块数, 队列其余位置留给存档
+#define AUDIO_CAPTURE_MAX_QUEUED 2
+
+/**
+ * Tees the 16 bits stereo stream into a RAM ring and appends it to a WAV
+ * file on SD in whole 4KiB chunks through SdIoService, so capture and saves
+ * share one queue and one file handle. A chunk stays in the ring until its
+ * append has completed. Frames that do not fit in the ring are dropped and
+ * counted, the producer never waits for the card.
+ */
+class WavCapture {
+public:
+  bool start(uint32_t sampleRate);
+  void stop();
+  bool isActive();
+
+  // 生产者: pushFrames 调用, 可以在 core1
+  void write(const int16_t* samples, uint32_t frames);
+  // 消费者: core0 空闲时调用, 最多提交一个块, 返回是否提交了
+  bool flushChunk();
+
+private:
+  void buildHeader(uint32_t dataBytes);
+  // queue the next chunk, a partial one too when partial is set. false when there is none
+  bool queueChunk(bool partial);
+  void chunkWritten(uint32_t frames, bool ok);
+
+  char _path[20] = ""; // empty when not recording
+  audio_ring_t _ring = {};
+  uint32_t _queuedFrames = 0; // handed to SdIoService, still in the ring
+  uint32_t _sampleRate = 0;
+  uint32_t _dataBytes = 0;
+  uint32_t _droppedFrames = 0;
+  volatile bool _active = false;
+  volatile bool _writing = false; // write() in progress, stop() waits for it
+};
+
+#endif
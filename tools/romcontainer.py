@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""
+Convert .gb/.gbc/.nes ROM files into the preprocessed container format (.pgc)
+read by src/services/romcontainer.cpp.
+
+The header carries everything the loader would otherwise parse from the ROM,
+the ROM data starts on a 4 KiB boundary so it can be streamed from the SD
+card straight into flash sectors.
+
+usage: romcontainer.py [-o OUTPUT] ROM [ROM ...]
+"""
+
+import argparse
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = 0x31434750  # "PGC1"
+VERSION = 1
+ALIGN = 4096
+
+SYSTEM_GB = 0
+SYSTEM_NES = 1
+
+# must match struct rom_container_t up to header_crc
+HEADER = struct.Struct("<IHHBBHIIIII32s16s512s")
+
+GB_RAM_SIZES = {0: 0, 1: 2048, 2: 8192, 3: 32768, 4: 131072, 5: 65536}
+
+
+def gb_container(data, name):
+    if len(data) < 0x150:
+        raise ValueError("too small for a Game Boy ROM")
+    checksum = 0
+    for b in data[0x134:0x14D]:
+        checksum = (checksum - b - 1) & 0xFF
+    if checksum != data[0x14D]:
+        raise ValueError("header checksum mismatch")
+
+    title = data[0x134:0x144].split(b"\0")[0]
+    fields = dict(
+        system=SYSTEM_GB,
+        cgb=data[0x143],
+        mapper=data[0x147],
+        prg_size=len(data),
+        chr_size=0,
+        ram_size=GB_RAM_SIZES.get(data[0x149], 0),
+        title=title or name.encode(),
+        ines=b"",
+        trainer=b"",
+    )
+    return fields, data
+
+
+def nes_container(data, name):
+    if len(data) < 16 or data[0:4] != b"NES\x1a":
+        raise ValueError("missing iNES header")
+    ines = data[0:16]
+    offset = 16
+    trainer = b""
+    if ines[6] & 4:
+        trainer = data[offset:offset + 512]
+        offset += 512
+
+    prg_size = ines[4] * 0x4000
+    chr_size = ines[5] * 0x2000
+    rom = data[offset:offset + prg_size + chr_size]
+    if len(rom) != prg_size + chr_size:
+        raise ValueError("file shorter than its iNES header says")
+
+    fields = dict(
+        system=SYSTEM_NES,
+        cgb=0,
+        mapper=(ines[6] >> 4) | (ines[7] & 0xF0),
+        prg_size=prg_size,
+        chr_size=chr_size,
+        ram_size=0x2000 if ines[6] & 2 else 0,
+        title=name.encode(),
+        ines=ines,
+        trainer=trainer,
+    )
+    return fields, rom
+
+
+def build(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    name, ext = os.path.splitext(os.path.basename(path))
+    if ext.lower() == ".nes":
+        fields, rom = nes_container(data, name)
+    else:
+        fields, rom = gb_container(data, name)
+
+    header = HEADER.pack(
+        MAGIC, VERSION, ALIGN,
+        fields["system"], fields["cgb"], fields["mapper"],
+        len(rom), fields["prg_size"], fields["chr_size"], fields["ram_size"],
+        zlib.crc32(rom),
+        fields["title"][:31], fields["ines"], fields["trainer"],
+    )
+    header += struct.pack("<I", zlib.crc32(header))
+    return header.ljust(ALIGN, b"\xff") + rom
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("roms", nargs="+", metavar="ROM")
+    parser.add_argument("-o", "--output", help="output file (single ROM) or directory")
+    args = parser.parse_args()
+
+    if args.output and len(args.roms) > 1 and not os.path.isdir(args.output):
+        parser.error("--output must be a directory when converting several ROMs")
+
+    failed = 0
+    for path in args.roms:
+        out = os.path.splitext(path)[0] + ".pgc"
+        if args.output:
+            if os.path.isdir(args.output):
+                out = os.path.join(args.output, os.path.basename(out))
+            else:
+                out = args.output
+        try:
+            container = build(path)
+        except (OSError, ValueError) as e:
+            print("%s: %s" % (path, e), file=sys.stderr)
+            failed += 1
+            continue
+        with open(out, "wb") as f:
+            f.write(container)
+        print("%s -> %s" % (path, out))
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Upload a .gb/.gbc/.nes ROM over the USB serial port straight into the flash
+of a running Pico-GB and start it, the protocol is described in
+src/services/romupload.h. The device must show the ROM browser.
+
+usage: romupload.py [-p PORT] [-v] ROM
+
+Needs pyserial (pip install pyserial).
+"""
+
+import argparse
+import os
+import struct
+import sys
+import time
+import zlib
+
+import serial
+
+SYNC = b"\xa5\x5a"
+HEADER = struct.Struct("<BHH")  # type, seq, len
+
+START, DATA = b"S", b"D"
+READY, ACK, NAK, DONE, ABORT = b"R", b"A", b"N", b"F", b"X"
+
+GAME_GB = 0
+GAME_NES = 1
+
+STATUS = {
+    0: "ok",
+    1: "ROM too large for the flash region",
+    2: "start frame rejected",
+    3: "device timed out",
+    4: "CRC mismatch after programming",
+    5: "device out of memory",
+}
+
+RESEND_TIMEOUT = 1.0  # no ack for this long: send again from the last ack
+DONE_TIMEOUT = 15.0   # programming the last sectors and checking the ROM CRC
+
+
+class Link:
+    def __init__(self, port, verbose):
+        self.port = port
+        self.verbose = verbose
+        self.buffer = b""
+
+    def send(self, kind, seq=0, payload=b""):
+        body = HEADER.pack(kind[0], seq, len(payload)) + payload
+        self.port.write(SYNC + body + struct.pack("<I", zlib.crc32(body)))
+
+    def receive(self, timeout):
+        """next valid frame as (type, seq, payload), None on timeout"""
+        deadline = time.monotonic() + timeout
+        while True:
+            start = self.buffer.find(SYNC)
+            if start < 0:
+                self.log(self.buffer[:-1])
+                self.buffer = self.buffer[-1:]
+            else:
+                self.log(self.buffer[:start])
+                self.buffer = self.buffer[start:]
+                frame = self.parse()
+                if frame:
+                    return frame
+            if time.monotonic() >= deadline:
+                return None
+            self.buffer += self.port.read(max(1, self.port.in_waiting))
+
+    def parse(self):
+        if len(self.buffer) < 2 + HEADER.size:
+            return None
+        kind, seq, length = HEADER.unpack_from(self.buffer, 2)
+        if length > 1024:
+            self.buffer = self.buffer[2:]
+            return None
+        end = 2 + HEADER.size + length + 4
+        if len(self.buffer) < end:
+            return None
+        body = self.buffer[2:end - 4]
+        (crc,) = struct.unpack_from("<I", self.buffer, end - 4)
+        if zlib.crc32(body) != crc:
+            # not a frame after all, skip the sync
+            self.buffer = self.buffer[2:]
+            return None
+        self.buffer = self.buffer[end:]
+        return bytes([kind]), seq, body[HEADER.size:]
+
+    def log(self, data):
+        if self.verbose and data:
+            sys.stderr.write(data.decode("ascii", "replace"))
+
+
+def fail(frame):
+    if frame is None:
+        raise RuntimeError("no answer from the device")
+    kind, _, payload = frame
+    if kind == ABORT:
+        raise RuntimeError("device aborted: " + STATUS.get(payload[0], str(payload[0])))
+    raise RuntimeError("unexpected frame %r" % kind)
+
+
+def upload(link, rom, name, game):
+    link.port.reset_input_buffer()
+    link.port.write(b"U")
+    frame = link.receive(2.0)
+    if frame is None or frame[0] != READY:
+        fail(frame)
+    chunk, window, max_size = struct.unpack("<HBI", frame[2])
+    if len(rom) > max_size:
+        raise RuntimeError("%d bytes, the device takes at most %d" % (len(rom), max_size))
+
+    start = struct.pack("<IIB", len(rom), zlib.crc32(rom), game) + name.encode()[:64]
+    for _ in range(3):
+        link.send(START, 0, start)
+        # a lost answer: the device NAKs the repeated start frame
+        frame = link.receive(3.0)
+        if frame is not None:
+            break
+    if frame is None or frame[0] not in (ACK, NAK):
+        fail(frame)
+
+    chunks = (len(rom) + chunk - 1) // chunk
+    base = next_seq = 0
+    last_progress = time.monotonic()
+    started = last_progress
+    while base < chunks:
+        while next_seq < chunks and next_seq < base + window:
+            link.send(DATA, next_seq, rom[next_seq * chunk:(next_seq + 1) * chunk])
+            next_seq += 1
+
+        frame = link.receive(RESEND_TIMEOUT)
+        if frame is None:
+            if time.monotonic() - last_progress > 3 * RESEND_TIMEOUT:
+                raise RuntimeError("device stopped answering")
+            next_seq = base
+            continue
+        kind, seq, _ = frame
+        if kind == ACK:
+            if seq > base:
+                base = seq
+                last_progress = time.monotonic()
+                print("\r%3d%%" % (base * 100 // chunks), end="", flush=True)
+            next_seq = max(next_seq, base)
+        elif kind == NAK:
+            base = max(base, seq)
+            next_seq = base
+        elif kind == DONE:
+            # the last ack got lost
+            break
+        else:
+            fail(frame)
+
+    if frame is None or frame[0] != DONE:
+        frame = link.receive(DONE_TIMEOUT)
+    if frame is None or frame[0] != DONE or frame[2][0] != 0:
+        fail(frame)
+    elapsed = time.monotonic() - started
+    print("\r%d bytes in %.1f s, %.0f KB/s" % (len(rom), elapsed, len(rom) / 1024 / elapsed))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("rom", metavar="ROM")
+    parser.add_argument("-p", "--port", default="/dev/ttyACM0", help="serial port of the device")
+    parser.add_argument("-v", "--verbose", action="store_true", help="show the device log")
+    args = parser.parse_args()
+
+    name = os.path.basename(args.rom)
+    game = GAME_NES if os.path.splitext(name)[1].lower() == ".nes" else GAME_GB
+    try:
+        with open(args.rom, "rb") as f:
+            rom = f.read()
+        with serial.Serial(args.port, 115200, timeout=0.05) as port:
+            upload(Link(port, args.verbose), rom, name, game)
+    except (OSError, serial.SerialException, RuntimeError) as e:
+        print("%s: %s" % (args.rom, e), file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())